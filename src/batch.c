@@ -0,0 +1,284 @@
+#include "batch.h"
+#include "image.h"
+#include "csr.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_JOB_ARGS 64
+#define LINE_SIZE 4096
+
+struct program
+{
+    char *file_name;
+    struct program_image *image; // NULL if it could not be loaded
+};
+
+enum job_status
+{
+    JOB_DONE, // nothing to compare with
+    JOB_PASS,
+    JOB_FAIL,
+    JOB_ERROR
+};
+
+struct job
+{
+    int program;
+    char *input;    // NULL for no input
+    char *expected; // NULL for no comparison
+    int num_args;
+    char *args[MAX_JOB_ARGS]; // args[0] is "--"
+    enum job_status status;
+    enum stop_reason stop;
+    long int insns;
+};
+
+struct batch;
+
+// Every worker starts out with its own contiguous range of jobs. It takes
+// jobs from the front of its range, and when that is empty steals from the
+// back of the other workers' ranges, so a few long jobs don't hold up the
+// rest.
+struct worker
+{
+    pthread_mutex_t lock;
+    int next, end;
+    int index;
+    struct batch *batch;
+    pthread_t thread;
+};
+
+struct batch
+{
+    struct program *programs;
+    int num_programs;
+    struct job *jobs;
+    int num_jobs;
+    struct worker *workers;
+    int threads;
+    long int max_insns; // limits for every job, 0 for none
+    double max_seconds;
+};
+
+static int find_program(struct batch *batch, const char *file_name)
+{
+    for (int i = 0; i < batch->num_programs; ++i)
+    {
+        if (!strcmp(batch->programs[i].file_name, file_name))
+            return i;
+    }
+    batch->programs = realloc(batch->programs, (batch->num_programs + 1) * sizeof(struct program));
+    struct program *program = &batch->programs[batch->num_programs];
+    program->file_name = strdup(file_name);
+    program->image = image_load(file_name, stderr);
+    if (program->image == NULL)
+        fprintf(stderr, "Could not load %s\n", file_name);
+    return batch->num_programs++;
+}
+
+static int read_manifest(struct batch *batch, const char *manifest)
+{
+    FILE *file = fopen(manifest, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not open manifest %s\n", manifest);
+        return 0;
+    }
+    char line[LINE_SIZE];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        line_number++;
+        char *save;
+        char *field[3];
+        int fields = 0;
+        char *token = strtok_r(line, " \t\n", &save);
+        if (token == NULL || token[0] == '#')
+            continue;
+        while (token && fields < 3)
+        {
+            field[fields++] = token;
+            if (fields < 3)
+                token = strtok_r(NULL, " \t\n", &save);
+        }
+        if (fields < 3)
+        {
+            fprintf(stderr, "%s:%d: expected 'elf-file stdin-file expected-output-file args...'\n", manifest,
+                    line_number);
+            fclose(file);
+            return 0;
+        }
+        batch->jobs = realloc(batch->jobs, (batch->num_jobs + 1) * sizeof(struct job));
+        struct job *job = &batch->jobs[batch->num_jobs++];
+        job->program = find_program(batch, field[0]);
+        job->input = strcmp(field[1], "-") ? strdup(field[1]) : NULL;
+        job->expected = strcmp(field[2], "-") ? strdup(field[2]) : NULL;
+        job->args[0] = strdup("--");
+        job->num_args = 1;
+        while ((token = strtok_r(NULL, " \t\n", &save)) && job->num_args < MAX_JOB_ARGS)
+            job->args[job->num_args++] = strdup(token);
+        job->status = JOB_ERROR;
+        job->stop = STOP_NONE;
+        job->insns = 0;
+    }
+    fclose(file);
+    return 1;
+}
+
+// does the rest of output match the file?
+static int same_contents(FILE *output, const char *file_name)
+{
+    FILE *expected = fopen(file_name, "rb");
+    if (expected == NULL)
+        return 0;
+    char a[4096], b[4096];
+    size_t n, m;
+    int same = 1;
+    do
+    {
+        n = fread(a, 1, sizeof(a), output);
+        m = fread(b, 1, sizeof(b), expected);
+        same = n == m && memcmp(a, b, n) == 0;
+    } while (same && n > 0);
+    fclose(expected);
+    return same;
+}
+
+static void run_job(struct batch *batch, struct job *job)
+{
+    struct program_image *image = batch->programs[job->program].image;
+    if (image == NULL)
+        return;
+    int in_fd = open(job->input ? job->input : "/dev/null", O_RDONLY);
+    FILE *output = tmpfile();
+    if (in_fd < 0 || output == NULL)
+    {
+        if (in_fd >= 0)
+            close(in_fd);
+        if (output)
+            fclose(output);
+        return;
+    }
+
+    struct Stat stats = image_run(image, job->num_args, job->args, in_fd, fileno(output), batch->max_insns,
+                                  batch->max_seconds);
+    close(in_fd);
+
+    if (stats.fatal_cause >= 0)
+        fprintf(output, "%s at %x (mtval %x)\n", exception_name(stats.fatal_cause), stats.fatal_pc,
+                stats.fatal_tval);
+    job->insns = stats.insns;
+    job->stop = stats.stop;
+    job->status = JOB_DONE;
+    // a job that ran out of time didn't finish, what it wrote so far says little
+    if (stats.stop == STOP_BUDGET || stats.stop == STOP_TIMEOUT)
+        job->status = JOB_FAIL;
+    else if (job->expected)
+    {
+        fflush(output);
+        rewind(output);
+        job->status = same_contents(output, job->expected) ? JOB_PASS : JOB_FAIL;
+    }
+    fclose(output);
+}
+
+// next job from the worker's own range, or -1 if it is empty
+static int take_job(struct worker *worker, int steal)
+{
+    int job = -1;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->next < worker->end)
+        job = steal ? --worker->end : worker->next++;
+    pthread_mutex_unlock(&worker->lock);
+    return job;
+}
+
+static void *worker_thread(void *arg)
+{
+    struct worker *self = arg;
+    struct batch *batch = self->batch;
+    for (;;)
+    {
+        int job = take_job(self, 0);
+        for (int i = 1; job < 0 && i < batch->threads; ++i)
+            job = take_job(&batch->workers[(self->index + i) % batch->threads], 1);
+        if (job < 0)
+            return NULL;
+        run_job(batch, &batch->jobs[job]);
+    }
+}
+
+int batch_run(const char *manifest, int threads, long int max_insns, double max_seconds)
+{
+    struct batch batch = {.max_insns = max_insns, .max_seconds = max_seconds};
+    if (!read_manifest(&batch, manifest))
+        return 1;
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > batch.num_jobs)
+        threads = batch.num_jobs ? batch.num_jobs : 1;
+
+    struct timespec before, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    batch.threads = threads;
+    batch.workers = calloc(threads, sizeof(struct worker));
+    for (int i = 0; i < threads; ++i)
+    {
+        struct worker *worker = &batch.workers[i];
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->next = (long)batch.num_jobs * i / threads;
+        worker->end = (long)batch.num_jobs * (i + 1) / threads;
+        worker->index = i;
+        worker->batch = &batch;
+    }
+    for (int i = 0; i < threads; ++i)
+        pthread_create(&batch.workers[i].thread, NULL, worker_thread, &batch.workers[i]);
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(batch.workers[i].thread, NULL);
+        pthread_mutex_destroy(&batch.workers[i].lock);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &after);
+
+    static const char *status_names[] = {"done", "pass", "FAIL", "ERROR"};
+    int count[4] = {0};
+    long int insns = 0;
+    for (int i = 0; i < batch.num_jobs; ++i)
+    {
+        struct job *job = &batch.jobs[i];
+        count[job->status]++;
+        insns += job->insns;
+        printf("%-5s %s", status_names[job->status], batch.programs[job->program].file_name);
+        for (int arg = 1; arg < job->num_args; ++arg)
+            printf(" %s", job->args[arg]);
+        if (job->stop == STOP_BUDGET || job->stop == STOP_TIMEOUT)
+            printf("  (%ld instructions, stopped by the %s)\n", job->insns,
+                   job->stop == STOP_BUDGET ? "instruction budget" : "watchdog");
+        else
+            printf("  (%ld instructions)\n", job->insns);
+        for (int arg = 0; arg < job->num_args; ++arg)
+            free(job->args[arg]);
+        free(job->input);
+        free(job->expected);
+    }
+    double seconds = (after.tv_sec - before.tv_sec) + (after.tv_nsec - before.tv_nsec) / 1e9;
+    printf("\n%d jobs on %d threads: %d passed, %d failed, %d errors, %d not checked\n", batch.num_jobs, threads,
+           count[JOB_PASS], count[JOB_FAIL], count[JOB_ERROR], count[JOB_DONE]);
+    printf("Simulated %ld instructions in %.3f s (%f MIPS)\n", insns, seconds, insns / seconds / 1000000);
+
+    for (int i = 0; i < batch.num_programs; ++i)
+    {
+        if (batch.programs[i].image)
+            image_delete(batch.programs[i].image);
+        free(batch.programs[i].file_name);
+    }
+    free(batch.programs);
+    free(batch.jobs);
+    free(batch.workers);
+    return count[JOB_FAIL] || count[JOB_ERROR];
+}
@@ -0,0 +1,23 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+// Batch mode: run the jobs of a manifest on a pool of threads. Each line of
+// the manifest is a job
+//
+//   elf-file stdin-file expected-output-file args...
+//
+// where '-' means no stdin / nothing to compare with, and lines starting
+// with '#' are comments. A job's output is what the program writes to the
+// console, followed by the message if it dies of an exception. Every ELF
+// file is loaded once into a program image that its jobs share.
+//
+// max_insns and max_seconds limit every job like -i and -t do a single run,
+// so a job that never exits can't hold up the batch. A job stopped by
+// either fails, whether it has an expected output or not.
+
+// threads 0 means one per host core, max_insns and max_seconds 0 mean no
+// limit. Prints a line per job and a summary, returns 0 if every job with
+// an expected output matched it and none was stopped by a limit
+int batch_run(const char *manifest, int threads, long int max_insns, double max_seconds);
+
+#endif
@@ -0,0 +1,309 @@
+#include "bench.h"
+#include "image.h"
+#include "console.h"
+#include "syscall.h"
+#include "uart.h"
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// instructions each kernel runs
+#define BENCH_INSNS 30000000
+
+// where the built-in kernels are
+#define CODE 0x10000
+#define BUFFER 0x100000
+#define CHASE 0x4000000
+#define CHASE_NODES 0x40000 // a cache line each
+#define CHASE_STRIDE 64
+
+// a slower kernel mean is a regression beyond this fraction and the noise
+#define REGRESSION 0.05
+
+static const uint32_t loop_code[] = {
+    0x00000293, // li t0, 0
+    0x00100313, // li t1, 1
+    0x006282b3, // loop: add t0, t0, t1
+    0x0062c3b3, // xor t2, t0, t1
+    0x00339e13, // slli t3, t2, 3
+    0x405e0333, // sub t1, t3, t0
+    0x0ff37e93, // andi t4, t1, 255
+    0x01d2e2b3, // or t0, t0, t4
+    0x001f0f13, // addi t5, t5, 1
+    0xfe5ff06f, // j loop
+};
+
+static const uint32_t memcpy_code[] = {
+    0x00100537, // again: lui a0, 0x100
+    0x002005b7, // lui a1, 0x200
+    0x00110637, // lui a2, 0x110
+    0x00052283, // copy: lw t0, 0(a0)
+    0x00452303, // lw t1, 4(a0)
+    0x0055a023, // sw t0, 0(a1)
+    0x0065a223, // sw t1, 4(a1)
+    0x00850513, // addi a0, a0, 8
+    0x00858593, // addi a1, a1, 8
+    0xfec564e3, // bltu a0, a2, copy
+    0xfd9ff06f, // j again
+};
+
+static const uint32_t chase_code[] = {
+    0x04000537, // lui a0, 0x4000
+    0x00052503, // next: lw a0, 0(a0)
+    0x00052503, // lw a0, 0(a0)
+    0x00052503, // lw a0, 0(a0)
+    0x00052503, // lw a0, 0(a0)
+    0x00128293, // addi t0, t0, 1
+    0xfedff06f, // j next
+};
+
+static const uint32_t io_code[] = {
+    0x001005b7, // lui a1, 0x100
+    0x00100513, // again: li a0, 1
+    0x01000613, // li a2, 16
+    0x04000893, // li a7, 64 (write)
+    0x00000073, // ecall
+    0x02e00513, // li a0, '.'
+    0x00200893, // li a7, 2 (putchar)
+    0x00000073, // ecall
+    0xfe5ff06f, // j again
+};
+
+// 64 KiB of data to copy
+static void memcpy_setup(struct memory *mem)
+{
+    for (int i = 0; i < 0x10000; i += 4)
+        memory_wr_w(mem, BUFFER + i, i * 0x9e3779b9);
+}
+
+// each node holds the address of the next, in a random order
+static void chase_setup(struct memory *mem)
+{
+    int *order = malloc(CHASE_NODES * sizeof(int));
+    uint32_t random = 1;
+    for (int i = 0; i < CHASE_NODES; ++i)
+        order[i] = i;
+    for (int i = CHASE_NODES - 1; i > 1; --i)
+    {
+        random = random * 1664525 + 1013904223;
+        int j = 1 + (random >> 8) % i; // node 0 stays first
+        int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (int i = 0; i < CHASE_NODES; ++i)
+        memory_wr_w(mem, CHASE + order[i] * CHASE_STRIDE, CHASE + order[(i + 1) % CHASE_NODES] * CHASE_STRIDE);
+    free(order);
+}
+
+static void io_setup(struct memory *mem)
+{
+    memory_wr_bytes(mem, BUFFER, "0123456789abcde\n", 16);
+}
+
+struct kernel
+{
+    const char *name;
+    const char *elf_file; // or the code below
+    char *arg;
+    const uint32_t *code;
+    int code_size;
+    void (*setup)(struct memory *mem);
+};
+
+static const struct kernel kernels[] = {
+    {"loop", NULL, NULL, loop_code, sizeof(loop_code), NULL},
+    {"memcpy", NULL, NULL, memcpy_code, sizeof(memcpy_code), memcpy_setup},
+    {"sieve", "tests/erat.riscv", NULL, NULL, 0, NULL},
+    {"fib", "tests/fib.riscv", "32", NULL, 0, NULL},
+    {"chase", NULL, NULL, chase_code, sizeof(chase_code), chase_setup},
+    {"io", NULL, NULL, io_code, sizeof(io_code), io_setup},
+};
+#define NUM_KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+struct result
+{
+    const char *name;
+    long int insns;
+    double *mips;
+    double mean, stddev, min, max;
+};
+
+// A kernel's program, loaded once. Every run gets a copy of its memory
+static struct program_image *kernel_image(const struct kernel *k)
+{
+    if (k->elf_file)
+    {
+        if (access(k->elf_file, R_OK))
+            return NULL;
+        return image_load(k->elf_file, stderr);
+    }
+    struct program_image *image = calloc(1, sizeof(struct program_image));
+    image->mem = memory_create();
+    memory_wr_bytes(image->mem, CODE, k->code, k->code_size);
+    if (k->setup)
+        k->setup(image->mem);
+    image->info.start = CODE;
+    image->info.data_end = CODE + k->code_size;
+    return image;
+}
+
+static void kernel_image_delete(const struct kernel *k, struct program_image *image)
+{
+    if (k->elf_file)
+        image_delete(image);
+    else
+    {
+        memory_delete(image->mem);
+        free(image);
+    }
+}
+
+// One run of the kernel, returns its MIPS and sets *insns
+static double run_once(const struct kernel *k, struct program_image *image, int null_fd, long int *insns)
+{
+    char *args[] = {"--", k->arg};
+    struct memory *mem = image_instantiate(image);
+    write_program_args(mem, k->arg ? 2 : 1, args);
+    struct console *console = console_create(null_fd, null_fd);
+    struct uart *uart = uart_create(console);
+    memory_map_device(mem, UART_BASE, UART_SIZE, uart, uart_read, uart_write);
+    struct syscalls *syscalls = syscalls_create(console, image->info.data_end);
+    struct sim_options options = {.max_insns = BENCH_INSNS, .symbols = image->symbols};
+    struct machine *m = machine_create(mem, syscalls, image->info.start, &options);
+
+    struct timespec before, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    machine_run(m, 0);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    double seconds = (after.tv_sec - before.tv_sec) + (after.tv_nsec - before.tv_nsec) / 1e9;
+
+    *insns = machine_stats(m).insns;
+    machine_delete(m);
+    syscalls_delete(syscalls);
+    uart_delete(uart);
+    console_delete(console);
+    memory_delete(mem);
+    return *insns / seconds / 1e6;
+}
+
+static void summarize(struct result *r, int runs)
+{
+    r->mean = 0;
+    r->min = r->max = r->mips[0];
+    for (int i = 0; i < runs; ++i)
+    {
+        r->mean += r->mips[i] / runs;
+        r->min = r->mips[i] < r->min ? r->mips[i] : r->min;
+        r->max = r->mips[i] > r->max ? r->mips[i] : r->max;
+    }
+    double squares = 0;
+    for (int i = 0; i < runs; ++i)
+        squares += (r->mips[i] - r->mean) * (r->mips[i] - r->mean);
+    r->stddev = runs > 1 ? sqrt(squares / (runs - 1)) : 0;
+}
+
+static int write_json(const char *json_file, struct result *results, int num_results, int runs)
+{
+    FILE *json = fopen(json_file, "w");
+    if (json == NULL)
+        return 1;
+    fprintf(json, "{\n  \"runs\": %d,\n  \"insns\": %d,\n  \"time\": %ld,\n  \"kernels\": [\n", runs, BENCH_INSNS,
+            (long)time(NULL));
+    for (int i = 0; i < num_results; ++i)
+    {
+        struct result *r = &results[i];
+        // one kernel per line, which is what read_baseline expects
+        fprintf(json,
+                "    {\"name\": \"%s\", \"insns\": %ld, \"mean_mips\": %.3f, \"stddev_mips\": %.3f, "
+                "\"min_mips\": %.3f, \"max_mips\": %.3f, \"mips\": [",
+                r->name, r->insns, r->mean, r->stddev, r->min, r->max);
+        for (int run = 0; run < runs; ++run)
+            fprintf(json, "%s%.3f", run ? ", " : "", r->mips[run]);
+        fprintf(json, "]}%s\n", i + 1 < num_results ? "," : "");
+    }
+    fprintf(json, "  ]\n}\n");
+    return fclose(json) != 0;
+}
+
+// the mean and standard deviation of a kernel in a JSON file written by
+// write_json, returns 0 if it isn't there
+static int read_baseline(FILE *baseline, const char *name, double *mean, double *stddev)
+{
+    char line[4096], kernel[64];
+    rewind(baseline);
+    while (fgets(line, sizeof(line), baseline))
+    {
+        const char *entry = strstr(line, "{\"name\": \"");
+        if (entry && sscanf(entry, "{\"name\": \"%63[^\"]\", \"insns\": %*d, \"mean_mips\": %lf, \"stddev_mips\": %lf",
+                            kernel, mean, stddev) == 3 &&
+            !strcmp(kernel, name))
+            return 1;
+    }
+    return 0;
+}
+
+int bench_run(int runs, const char *json_file, const char *baseline_file)
+{
+    if (runs < 1)
+        runs = 1;
+    FILE *baseline = NULL;
+    if (baseline_file && (baseline = fopen(baseline_file, "r")) == NULL)
+    {
+        fprintf(stderr, "Could not open %s\n", baseline_file);
+        return 1;
+    }
+    int null_fd = open("/dev/null", O_RDWR);
+    struct result results[NUM_KERNELS];
+    int num_results = 0, slower = 0;
+
+    printf("%-8s %12s %10s %8s %10s %10s%s\n", "kernel", "insns", "mean MIPS", "stddev", "min", "max",
+           baseline ? "   baseline  change" : "");
+    for (int i = 0; i < NUM_KERNELS; ++i)
+    {
+        const struct kernel *k = &kernels[i];
+        struct program_image *image = kernel_image(k);
+        if (image == NULL)
+        {
+            printf("%-8s left out, %s not found\n", k->name, k->elf_file);
+            continue;
+        }
+        struct result *r = &results[num_results++];
+        r->name = k->name;
+        r->mips = malloc(runs * sizeof(double));
+        for (int run = 0; run < runs; ++run)
+            r->mips[run] = run_once(k, image, null_fd, &r->insns);
+        kernel_image_delete(k, image);
+        summarize(r, runs);
+
+        printf("%-8s %12ld %10.2f %8.2f %10.2f %10.2f", r->name, r->insns, r->mean, r->stddev, r->min, r->max);
+        double base_mean, base_stddev;
+        if (baseline && read_baseline(baseline, r->name, &base_mean, &base_stddev))
+        {
+            double change = (r->mean - base_mean) / base_mean;
+            double noise = 2 * sqrt(r->stddev * r->stddev + base_stddev * base_stddev);
+            int regression = change < -REGRESSION && base_mean - r->mean > noise;
+            printf(" %10.2f %+6.1f%%%s", base_mean, 100 * change, regression ? "  slower" : "");
+            slower += regression;
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    close(null_fd);
+    if (baseline)
+        fclose(baseline);
+
+    int failed = write_json(json_file, results, num_results, runs);
+    if (failed)
+        fprintf(stderr, "Could not write %s\n", json_file);
+    for (int i = 0; i < num_results; ++i)
+        free(results[i].mips);
+    if (slower)
+        printf("%d kernel%s slower than the baseline\n", slower, slower > 1 ? "s are" : " is");
+    return failed || slower;
+}
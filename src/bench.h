@@ -0,0 +1,27 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+// Benchmark mode: throughput of the simulator on a fixed set of guest
+// kernels, to catch performance regressions. Each kernel runs for the same
+// number of instructions every time, on a fresh machine, and the time of
+// the run alone is measured with the monotonic clock. The kernels are
+//
+//   loop    integer ALU instructions in a tight loop
+//   memcpy  word copies through a 64 KiB buffer
+//   sieve   tests/erat.riscv, the sieve of Eratosthenes
+//   fib     tests/fib.riscv, recursive calls
+//   chase   pointer chasing through a random cycle spread over 16 MiB
+//   io      write and putchar system calls, output to /dev/null
+//
+// The ELF kernels are looked for relative to the current directory and are
+// left out if they aren't there.
+//
+// Results are printed as a table and written as JSON, with the MIPS of every
+// run and their mean, standard deviation, minimum and maximum per kernel.
+
+// baseline is a JSON file from an earlier run, or NULL. A kernel whose mean
+// is more than 5% and two standard deviations below the baseline is
+// reported as slower. Returns 0 if nothing is
+int bench_run(int runs, const char *json_file, const char *baseline);
+
+#endif
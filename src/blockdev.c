@@ -0,0 +1,103 @@
+#include "blockdev.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct blockdev
+{
+    int fd;
+    int writable;
+    struct memory *mem;
+    unsigned int sectors;
+    unsigned int sector, addr, count;
+    unsigned int status;
+};
+
+struct blockdev *blockdev_open(const char *file_name, struct memory *mem)
+{
+    int writable = 1;
+    int fd = open(file_name, O_RDWR);
+    if (fd < 0)
+    {
+        writable = 0;
+        fd = open(file_name, O_RDONLY);
+    }
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+        return NULL;
+    struct blockdev *blockdev = calloc(1, sizeof(struct blockdev));
+    blockdev->fd = fd;
+    blockdev->writable = writable;
+    blockdev->mem = mem;
+    blockdev->sectors = st.st_size / BLOCK_SIZE;
+    return blockdev;
+}
+
+void blockdev_close(struct blockdev *blockdev)
+{
+    close(blockdev->fd);
+    free(blockdev);
+}
+
+static unsigned int transfer(struct blockdev *blockdev, int command)
+{
+    if (blockdev->sector > blockdev->sectors || blockdev->count > blockdev->sectors - blockdev->sector)
+        return 1;
+    if (command == BLOCKDEV_CMD_WRITE && !blockdev->writable)
+        return 1;
+    size_t len = (size_t)blockdev->count * BLOCK_SIZE;
+    off_t pos = (off_t)blockdev->sector * BLOCK_SIZE;
+    char *buf = malloc(len ? len : 1);
+    unsigned int status = 0;
+    if (command == BLOCKDEV_CMD_READ)
+    {
+        if (pread(blockdev->fd, buf, len, pos) != (ssize_t)len)
+            status = 1;
+        else
+            memory_wr_bytes(blockdev->mem, blockdev->addr, buf, len);
+    }
+    else
+    {
+        memory_rd_bytes(blockdev->mem, blockdev->addr, buf, len);
+        if (pwrite(blockdev->fd, buf, len, pos) != (ssize_t)len)
+            status = 1;
+    }
+    free(buf);
+    return status;
+}
+
+int blockdev_read(void *dev, unsigned int offset, int size)
+{
+    struct blockdev *blockdev = dev;
+    if (size != 4)
+        return 0;
+    switch (offset)
+    {
+    case BLOCKDEV_SECTOR: return blockdev->sector;
+    case BLOCKDEV_ADDR: return blockdev->addr;
+    case BLOCKDEV_COUNT: return blockdev->count;
+    case BLOCKDEV_STATUS: return blockdev->status;
+    case BLOCKDEV_CAPACITY: return blockdev->sectors;
+    }
+    return 0;
+}
+
+void blockdev_write(void *dev, unsigned int offset, int size, int data)
+{
+    struct blockdev *blockdev = dev;
+    if (size != 4)
+        return;
+    switch (offset)
+    {
+    case BLOCKDEV_SECTOR: blockdev->sector = data; break;
+    case BLOCKDEV_ADDR: blockdev->addr = data; break;
+    case BLOCKDEV_COUNT: blockdev->count = data; break;
+    case BLOCKDEV_COMMAND:
+        if (data == BLOCKDEV_CMD_READ || data == BLOCKDEV_CMD_WRITE)
+            blockdev->status = transfer(blockdev, data);
+        else
+            blockdev->status = 1;
+        break;
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef __BLOCKDEV_H__
+#define __BLOCKDEV_H__
+
+#include "memory.h"
+
+// A block device backed by a host file. The guest sets up sector, buffer
+// address and sector count, then writes a command. The transfer to or from
+// guest memory is done by the time the command store completes.
+#define BLOCKDEV_BASE 0xc1000000u
+#define BLOCKDEV_SIZE 0x10000
+#define BLOCK_SIZE 512
+
+#define BLOCKDEV_SECTOR 0x00   // first sector of the transfer
+#define BLOCKDEV_ADDR 0x04     // guest address of the buffer
+#define BLOCKDEV_COUNT 0x08    // number of sectors
+#define BLOCKDEV_COMMAND 0x0c  // write BLOCKDEV_CMD_*
+#define BLOCKDEV_STATUS 0x10   // 0 when the last command succeeded
+#define BLOCKDEV_CAPACITY 0x14 // size of the device in sectors
+
+#define BLOCKDEV_CMD_READ 1
+#define BLOCKDEV_CMD_WRITE 2
+
+struct blockdev;
+
+// open the host file, NULL if it can't be opened
+struct blockdev *blockdev_open(const char *file_name, struct memory *mem);
+void blockdev_close(struct blockdev *blockdev);
+
+// device callbacks, registers are word sized
+int blockdev_read(void *blockdev, unsigned int offset, int size);
+void blockdev_write(void *blockdev, unsigned int offset, int size, int data);
+
+#endif
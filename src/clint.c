@@ -0,0 +1,92 @@
+#include "clint.h"
+#include "csr.h"
+#include <time.h>
+
+uint64_t host_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * TIME_FREQ + (uint64_t)ts.tv_nsec / (1000000000 / TIME_FREQ);
+}
+
+// the clock mtime is kept relative to
+static uint64_t now(struct clint *clint)
+{
+    return clint->virtual_time ? clint->insns / VIRTUAL_INSNS_PER_TICK : host_time();
+}
+
+void clint_init(struct clint *clint, int virtual_time)
+{
+    for (int hart = 0; hart < MAX_HARTS; ++hart)
+    {
+        clint->msip[hart] = 0;
+        clint->mtimecmp[hart] = ~0ull;
+    }
+    clint->virtual_time = virtual_time;
+    clint->insns = 0;
+    clint->time_base = now(clint);
+}
+
+void clint_advance(struct clint *clint, uint64_t insns)
+{
+    clint->insns += insns;
+}
+
+uint64_t clint_mtime(struct clint *clint)
+{
+    return now(clint) - clint->time_base;
+}
+
+int clint_read(void *dev, unsigned int offset, int size)
+{
+    struct clint *clint = dev;
+    if (size != 4)
+        return 0;
+    if (offset - CLINT_MSIP < 4 * MAX_HARTS)
+        return clint->msip[(offset - CLINT_MSIP) / 4];
+    if (offset - CLINT_MTIMECMP < 8 * MAX_HARTS)
+    {
+        uint64_t mtimecmp = clint->mtimecmp[(offset - CLINT_MTIMECMP) / 8];
+        return offset & 4 ? mtimecmp >> 32 : mtimecmp;
+    }
+    switch (offset)
+    {
+    case CLINT_MTIME: return clint_mtime(clint);
+    case CLINT_MTIME + 4: return clint_mtime(clint) >> 32;
+    }
+    return 0;
+}
+
+void clint_write(void *dev, unsigned int offset, int size, int value)
+{
+    struct clint *clint = dev;
+    uint64_t mtime;
+    if (size != 4)
+        return;
+    if (offset - CLINT_MSIP < 4 * MAX_HARTS)
+    {
+        clint->msip[(offset - CLINT_MSIP) / 4] = value & 1;
+        return;
+    }
+    if (offset - CLINT_MTIMECMP < 8 * MAX_HARTS)
+    {
+        uint64_t *mtimecmp = &clint->mtimecmp[(offset - CLINT_MTIMECMP) / 8];
+        if (offset & 4)
+            *mtimecmp = (*mtimecmp & 0xffffffffull) | (uint64_t)(unsigned)value << 32;
+        else
+            *mtimecmp = (*mtimecmp & ~0xffffffffull) | (unsigned)value;
+        return;
+    }
+    switch (offset)
+    {
+    case CLINT_MTIME: // move the time base so mtime reads back as written
+    case CLINT_MTIME + 4:
+        mtime = clint_mtime(clint);
+        if (offset == CLINT_MTIME)
+            mtime = (mtime & ~0xffffffffull) | (unsigned)value;
+        else
+            mtime = (mtime & 0xffffffffull) | (uint64_t)(unsigned)value << 32;
+        clint->time_base = now(clint) - mtime;
+        break;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef __CLINT_H__
+#define __CLINT_H__
+
+#include <stdint.h>
+
+// Core local interruptor, the machine timer and software interrupt. Uses
+// the usual register layout. Devices live at 0xc0000000-0xc3ffffff, clear of
+// the heap (from 0x2000000 up) and the stack (from 0 down) of programs.
+#define CLINT_BASE 0xc2000000u
+#define CLINT_SIZE 0x10000
+#define CLINT_MSIP 0x0000
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME 0xbff8
+
+// msip is a word and mtimecmp a doubleword per hart
+#define MAX_HARTS 64
+
+struct clint
+{
+    unsigned int msip[MAX_HARTS];
+    uint64_t mtimecmp[MAX_HARTS];
+    uint64_t time_base; // host time when mtime was 0
+    // with virtual time mtime follows the instructions simulated instead of
+    // the host clock, so a run can be repeated exactly
+    int virtual_time;
+    uint64_t insns;
+};
+
+// instructions per mtime tick with virtual time, i.e. 100 MIPS
+#define VIRTUAL_INSNS_PER_TICK 100
+
+// host monotonic clock in TIME_FREQ ticks
+uint64_t host_time(void);
+
+void clint_init(struct clint *clint, int virtual_time);
+
+// count simulated instructions for virtual time
+void clint_advance(struct clint *clint, uint64_t insns);
+
+// mtime, also what the time CSR reads
+uint64_t clint_mtime(struct clint *clint);
+
+// device callbacks, registers are word sized
+int clint_read(void *clint, unsigned int offset, int size);
+void clint_write(void *clint, unsigned int offset, int size, int value);
+
+#endif
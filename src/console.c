@@ -0,0 +1,179 @@
+#include "console.h"
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OUT_BUFFER_SIZE 0x10000
+#define IN_BUFFER_SIZE 0x1000
+#define COPY_SIZE 0x1000 // bytes copied from or to simulated memory at a time
+
+struct console
+{
+    int in_fd, out_fd;
+    int line_flush; // output is a terminal
+    int eof;
+    size_t out_len;
+    size_t in_pos, in_len;
+    char out[OUT_BUFFER_SIZE];
+    char in[IN_BUFFER_SIZE];
+    // Harts on their own threads use the console through system calls and
+    // the UART at the same time. Simulated memory is never accessed with the
+    // lock held: the UART calls in with the memory's device lock held, and
+    // a copy from a device page would take them in the other order
+    pthread_mutex_t lock;
+};
+
+struct console *console_create(int in_fd, int out_fd)
+{
+    struct console *console = malloc(sizeof(struct console));
+    console->in_fd = in_fd;
+    console->out_fd = out_fd;
+    console->line_flush = isatty(out_fd);
+    console->eof = 0;
+    console->out_len = console->in_pos = console->in_len = 0;
+    pthread_mutex_init(&console->lock, NULL);
+    return console;
+}
+
+void console_delete(struct console *console)
+{
+    console_flush(console);
+    pthread_mutex_destroy(&console->lock);
+    free(console);
+}
+
+// the console_ functions below take the lock, these expect it to be held
+static void flush(struct console *console)
+{
+    size_t done = 0;
+    while (done < console->out_len)
+    {
+        ssize_t n = write(console->out_fd, console->out + done, console->out_len - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    console->out_len = 0;
+}
+
+static void put(struct console *console, const char *data, int len)
+{
+    while (len > 0)
+    {
+        if (console->out_len == OUT_BUFFER_SIZE)
+            flush(console);
+        int chunk = OUT_BUFFER_SIZE - console->out_len;
+        if (chunk > len)
+            chunk = len;
+        memcpy(console->out + console->out_len, data, chunk);
+        console->out_len += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+void console_flush(struct console *console)
+{
+    pthread_mutex_lock(&console->lock);
+    flush(console);
+    pthread_mutex_unlock(&console->lock);
+}
+
+void console_putc(struct console *console, int c)
+{
+    char ch = c;
+    pthread_mutex_lock(&console->lock);
+    put(console, &ch, 1);
+    if (c == '\n' && console->line_flush)
+        flush(console);
+    pthread_mutex_unlock(&console->lock);
+}
+
+// a write of up to COPY_SIZE bytes goes to the output in one piece
+void console_write(struct console *console, struct memory *mem, int addr, int len)
+{
+    char data[COPY_SIZE];
+    while (len > 0)
+    {
+        int chunk = len < COPY_SIZE ? len : COPY_SIZE;
+        memory_rd_bytes(mem, addr, data, chunk);
+        pthread_mutex_lock(&console->lock);
+        put(console, data, chunk);
+        if (console->line_flush && chunk == len)
+            flush(console);
+        pthread_mutex_unlock(&console->lock);
+        addr += chunk;
+        len -= chunk;
+    }
+}
+
+// refill the input buffer, waiting for input if wait is set
+static int fill(struct console *console, int wait)
+{
+    if (console->in_pos < console->in_len)
+        return 1;
+    if (console->eof)
+        return 0;
+    if (wait) // whoever is on the other end should see everything up to here first
+        flush(console);
+    else
+    {
+        struct pollfd pfd = {console->in_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 0) <= 0)
+            return 0;
+    }
+    ssize_t n = read(console->in_fd, console->in, IN_BUFFER_SIZE);
+    if (n <= 0)
+    {
+        console->eof = 1;
+        return 0;
+    }
+    console->in_pos = 0;
+    console->in_len = n;
+    return 1;
+}
+
+int console_getc(struct console *console)
+{
+    pthread_mutex_lock(&console->lock);
+    int c = fill(console, 1) ? (unsigned char)console->in[console->in_pos++] : -1;
+    pthread_mutex_unlock(&console->lock);
+    return c;
+}
+
+int console_read(struct console *console, struct memory *mem, int addr, int len)
+{
+    char data[COPY_SIZE];
+    int done = 0;
+    while (done < len)
+    {
+        pthread_mutex_lock(&console->lock);
+        int chunk = 0;
+        if (fill(console, done == 0))
+        {
+            chunk = console->in_len - console->in_pos;
+            if (chunk > len - done)
+                chunk = len - done;
+            if (chunk > COPY_SIZE)
+                chunk = COPY_SIZE;
+            memcpy(data, console->in + console->in_pos, chunk);
+            console->in_pos += chunk;
+        }
+        pthread_mutex_unlock(&console->lock);
+        if (chunk == 0)
+            break;
+        memory_wr_bytes(mem, addr + done, data, chunk);
+        done += chunk;
+    }
+    return done;
+}
+
+int console_input_ready(struct console *console)
+{
+    pthread_mutex_lock(&console->lock);
+    int ready = fill(console, 0);
+    pthread_mutex_unlock(&console->lock);
+    return ready;
+}
@@ -0,0 +1,32 @@
+#ifndef __CONSOLE_H__
+#define __CONSOLE_H__
+
+#include "memory.h"
+#include <stddef.h>
+
+// The simulated program's console. Output is collected in a large buffer
+// and written when it fills up, when input is read, and on exit, and at
+// every newline if the output is a terminal. Input is read in blocks too.
+// The functions can be called from several threads at once.
+struct console;
+
+// out_fd is where output goes, e.g. 1 or a file opened with -o
+struct console *console_create(int in_fd, int out_fd);
+
+// flushes any output left
+void console_delete(struct console *console);
+void console_flush(struct console *console);
+
+void console_putc(struct console *console, int c);
+// copy len bytes at addr in simulated memory to the output
+void console_write(struct console *console, struct memory *mem, int addr, int len);
+
+// next input character, -1 at end of input
+int console_getc(struct console *console);
+// read up to len bytes of input to addr in simulated memory, returns the
+// number read: what is available once there is at least one, 0 at the end
+int console_read(struct console *console, struct memory *mem, int addr, int len);
+// is there input to read without waiting?
+int console_input_ready(struct console *console);
+
+#endif
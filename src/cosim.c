@@ -0,0 +1,287 @@
+#include "cosim.h"
+#include "image.h"
+#include "console.h"
+#include "csr.h"
+#include "decode.h"
+#include "disassemble.h"
+#include "syscall.h"
+#include "uart.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// instructions shown before a divergence
+#define WINDOW 16
+
+struct mem_write
+{
+    unsigned int addr;
+    int size;
+    unsigned int value;
+};
+
+struct engine
+{
+    const char *name;
+    struct memory *mem;
+    struct console *console;
+    struct uart *uart;
+    struct syscalls *syscalls;
+    struct machine *machine;
+    FILE *in, *out;
+    // the writes of the current block
+    struct mem_write *writes;
+    int num_writes, max_writes;
+};
+
+struct executed
+{
+    long int insn;
+    unsigned int pc, raw;
+    int len;
+};
+
+// the watch function of every page, called after each write
+static void record_write(void *arg, int addr, int size)
+{
+    struct engine *e = arg;
+    if (e->num_writes == e->max_writes)
+    {
+        e->max_writes = e->max_writes ? 2 * e->max_writes : 64;
+        e->writes = realloc(e->writes, e->max_writes * sizeof(struct mem_write));
+    }
+    struct mem_write *w = &e->writes[e->num_writes++];
+    w->addr = addr;
+    w->size = size;
+    w->value = size == 4 ? memory_rd_w(e->mem, addr) : size == 2 ? memory_rd_h(e->mem, addr) : memory_rd_b(e->mem, addr);
+}
+
+static void engine_start(struct engine *e, const char *name, struct program_image *image, int num_args,
+                         char *args[], const void *input, size_t input_len)
+{
+    memset(e, 0, sizeof(struct engine));
+    e->name = name;
+    e->in = tmpfile();
+    e->out = tmpfile();
+    fwrite(input, 1, input_len, e->in);
+    fflush(e->in);
+    rewind(e->in);
+    e->mem = image_instantiate(image);
+    write_program_args(e->mem, num_args, args);
+    e->console = console_create(fileno(e->in), fileno(e->out));
+    e->uart = uart_create(e->console);
+    memory_map_device(e->mem, UART_BASE, UART_SIZE, e->uart, uart_read, uart_write);
+    e->syscalls = syscalls_create(e->console, image->info.data_end);
+    struct sim_options options = {.deterministic = 1, .symbols = image->symbols};
+    e->machine = machine_create(e->mem, e->syscalls, image->info.start, &options);
+    memory_set_watch(e->mem, record_write, e);
+    for (unsigned int page = 0; page < 0x10000; ++page)
+        memory_watch_page(e->mem, page << 16, 1);
+}
+
+static void engine_stop(struct engine *e)
+{
+    memory_set_watch(e->mem, NULL, NULL);
+    machine_delete(e->machine);
+    syscalls_delete(e->syscalls);
+    uart_delete(e->uart);
+    console_delete(e->console);
+    memory_delete(e->mem);
+    fclose(e->in);
+    fclose(e->out);
+    free(e->writes);
+}
+
+static void engine_run(struct engine *e, long int insns)
+{
+    if (insns > 0 && machine_running(e->machine))
+        machine_run(e->machine, insns);
+}
+
+// the whole output, *len is set to its length
+static char *engine_output(struct engine *e, long int *len)
+{
+    console_flush(e->console);
+    *len = lseek(fileno(e->out), 0, SEEK_END);
+    char *output = malloc(*len + 1);
+    *len = pread(fileno(e->out), output, *len, 0);
+    return output;
+}
+
+static void print_write(FILE *report, struct engine *e, int i)
+{
+    if (i < e->num_writes)
+        fprintf(report, "    %-9s M[%x] <- %x (%d bytes)\n", e->name, e->writes[i].addr, e->writes[i].value,
+                e->writes[i].size);
+    else
+        fprintf(report, "    %-9s no write\n", e->name);
+}
+
+// the first thing that differs in a block is preceded by where the block is
+static void difference(FILE *report, int *differences, unsigned int block_pc, long int block_start)
+{
+    if ((*differences)++ == 0)
+        fprintf(report, "The engines diverge in the block at %x, instruction %ld:\n", block_pc, block_start);
+}
+
+// Prints what differs between the two engines after the block at block_pc,
+// returns 0 if nothing does
+static int compare(struct engine *a, struct engine *b, FILE *report, unsigned int block_pc, long int block_start)
+{
+    int differences = 0;
+    struct Stat sa = machine_stats(a->machine), sb = machine_stats(b->machine);
+    if (sa.insns != sb.insns)
+    {
+        difference(report, &differences, block_pc, block_start);
+        fprintf(report, "  Instructions: %s %ld, %s %ld\n", a->name, sa.insns, b->name, sb.insns);
+    }
+    if (sa.stop != sb.stop || sa.exit_code != sb.exit_code || sa.fatal_cause != sb.fatal_cause)
+    {
+        difference(report, &differences, block_pc, block_start);
+        fprintf(report, "  Stop: %s %s (%d), %s %s (%d)\n", a->name, stop_name(sa.stop),
+                sa.stop == STOP_FAULT ? sa.fatal_cause : sa.exit_code, b->name, stop_name(sb.stop),
+                sb.stop == STOP_FAULT ? sb.fatal_cause : sb.exit_code);
+    }
+    int pa = *machine_pc(a->machine, 0), pb = *machine_pc(b->machine, 0);
+    if (pa != pb)
+    {
+        difference(report, &differences, block_pc, block_start);
+        fprintf(report, "  pc: %s %x, %s %x\n", a->name, pa, b->name, pb);
+    }
+    int *ra = machine_registers(a->machine, 0), *rb = machine_registers(b->machine, 0);
+    for (int reg = 1; reg < 32; ++reg)
+    {
+        if (ra[reg] != rb[reg])
+        {
+            difference(report, &differences, block_pc, block_start);
+            fprintf(report, "  x%d: %s %x, %s %x\n", reg, a->name, ra[reg], b->name, rb[reg]);
+        }
+    }
+    for (int i = 0; i < a->num_writes || i < b->num_writes; ++i)
+    {
+        if (i < a->num_writes && i < b->num_writes &&
+            !memcmp(&a->writes[i], &b->writes[i], sizeof(struct mem_write)))
+            continue;
+        difference(report, &differences, block_pc, block_start);
+        fprintf(report, "  Write %d of the block:\n", i + 1);
+        print_write(report, a, i);
+        print_write(report, b, i);
+        break; // the rest are likely off too
+    }
+    return differences;
+}
+
+static void print_window(FILE *report, struct executed *history, long int count, struct symbols *symbols)
+{
+    fprintf(report, "Last instructions on the reference:\n");
+    for (long int i = count > WINDOW ? count - WINDOW : 0; i < count; ++i)
+    {
+        struct executed *x = &history[i % WINDOW];
+        char disassembled[64];
+        disassemble(x->pc, x->raw, disassembled, sizeof(disassembled), symbols);
+        if (x->len == 2)
+            fprintf(report, "%10ld  %08x :     %04x  %s\n", x->insn, x->pc, x->raw, disassembled);
+        else
+            fprintf(report, "%10ld  %08x : %08x  %s\n", x->insn, x->pc, x->raw, disassembled);
+    }
+}
+
+// stdin if it isn't a terminal, *len is set to its length
+static char *read_input(size_t *len)
+{
+    size_t size = 0;
+    char *input = NULL;
+    *len = 0;
+    if (isatty(0))
+        return NULL;
+    for (;;)
+    {
+        if (*len == size)
+        {
+            size = size ? 2 * size : 0x10000;
+            input = realloc(input, size);
+        }
+        ssize_t n = read(0, input + *len, size - *len);
+        if (n <= 0)
+            return input;
+        *len += n;
+    }
+}
+
+int cosim_run(const char *elf_file, int num_args, char *args[], long int max_insns, FILE *report)
+{
+    struct program_image *image = image_load(elf_file, report);
+    if (image == NULL)
+        return -1;
+    size_t input_len;
+    char *input = read_input(&input_len);
+    struct engine reference, blocks;
+    engine_start(&reference, "reference", image, num_args, args, input, input_len);
+    engine_start(&blocks, "blocks", image, num_args, args, input, input_len);
+    free(input);
+
+    struct executed history[WINDOW];
+    long int count = 0, num_blocks = 0;
+    int diverged = 0;
+    while (!diverged && machine_running(reference.machine) && (!max_insns || count < max_insns))
+    {
+        reference.num_writes = blocks.num_writes = 0;
+        unsigned int block_pc = *machine_pc(reference.machine, 0);
+        long int block_start = count;
+        int cls;
+        do
+        {
+            unsigned int pc = *machine_pc(reference.machine, 0);
+            unsigned int instruction = memory_rd_h(reference.mem, pc);
+            if ((instruction & 0x3) == 0x3)
+                instruction |= (unsigned)memory_rd_h(reference.mem, pc + 2) << 16;
+            struct insn insn;
+            decode(instruction, &insn);
+            cls = insn_classes[insn.id];
+            history[count % WINDOW] = (struct executed){count, pc, insn.raw, insn.len};
+            count++;
+            machine_invalidate_code(reference.machine, pc, insn.len);
+            machine_run(reference.machine, 1);
+        } while (cls != CLASS_BRANCH && cls != CLASS_JUMP && cls != CLASS_SYSTEM &&
+                 machine_running(reference.machine) && (!max_insns || count < max_insns));
+
+        engine_run(&blocks, count - block_start - 1);
+        engine_run(&blocks, 1);
+        num_blocks++;
+        if (compare(&reference, &blocks, report, block_pc, block_start))
+        {
+            print_window(report, history, count, image->symbols);
+            diverged = 1;
+        }
+    }
+
+    long int len_ref, len_blocks;
+    char *out_ref = engine_output(&reference, &len_ref);
+    char *out_blocks = engine_output(&blocks, &len_blocks);
+    if (!diverged && (len_ref != len_blocks || memcmp(out_ref, out_blocks, len_ref)))
+    {
+        long int at = 0;
+        while (at < len_ref && at < len_blocks && out_ref[at] == out_blocks[at])
+            at++;
+        fprintf(report, "The engines' console output differs from byte %ld\n", at);
+        diverged = 1;
+    }
+    fflush(report);
+    fwrite(out_blocks, 1, len_blocks, stdout);
+    fflush(stdout);
+    free(out_ref);
+    free(out_blocks);
+    if (!diverged)
+    {
+        struct Stat stats = machine_stats(blocks.machine);
+        fprintf(report, "\nCo-simulated %ld instructions in %ld blocks, the engines agree (%s", count, num_blocks,
+                stop_name(stats.stop));
+        if (stats.stop == STOP_FAULT)
+            fprintf(report, ": %s at %x", exception_name(stats.fatal_cause), stats.fatal_pc);
+        fprintf(report, ")\n");
+    }
+    engine_stop(&reference);
+    engine_stop(&blocks);
+    image_delete(image);
+    return diverged;
+}
@@ -0,0 +1,26 @@
+#ifndef __COSIM_H__
+#define __COSIM_H__
+
+#include <stdio.h>
+
+// Co-simulation: runs a program on two engines in lockstep and checks that
+// they agree, block by block. The reference runs one instruction at a time
+// and decodes each one afresh. The engine under test runs each block in one
+// go from the decode cache, which is how the simulator normally runs. After
+// every block the pc, the x registers, the instruction count, the stop
+// reason and the memory writes of the block, in order, are compared.
+// The console output is compared at the end. The first difference is
+// reported with the instructions that led up to it, disassembled.
+//
+// Both engines run deterministically on one hart, with the same input. A
+// block's last instruction runs on its own on both sides, so a time CSR or
+// an interrupt sees the same virtual time. All pages are watched, so writes
+// take the slow path on both sides.
+
+// args[0] is skipped like the "--" on the command line, max_insns 0 means
+// no limit. The program's output goes to stdout and the report to report.
+// Returns 0 if the engines agree, 1 if they don't and -1 if the program
+// can't be loaded
+int cosim_run(const char *elf_file, int num_args, char *args[], long int max_insns, FILE *report);
+
+#endif
@@ -0,0 +1,58 @@
+#include "csr.h"
+#include <stddef.h>
+
+const char *csr_name(unsigned int csr)
+{
+    switch (csr)
+    {
+    case CSR_FFLAGS: return "fflags";
+    case CSR_FRM: return "frm";
+    case CSR_FCSR: return "fcsr";
+    case CSR_VSTART: return "vstart";
+    case CSR_VXSAT: return "vxsat";
+    case CSR_VXRM: return "vxrm";
+    case CSR_VCSR: return "vcsr";
+    case CSR_CYCLE: return "cycle";
+    case CSR_TIME: return "time";
+    case CSR_INSTRET: return "instret";
+    case CSR_VL: return "vl";
+    case CSR_VTYPE: return "vtype";
+    case CSR_VLENB: return "vlenb";
+    case CSR_CYCLEH: return "cycleh";
+    case CSR_TIMEH: return "timeh";
+    case CSR_INSTRETH: return "instreth";
+    case CSR_MSTATUS: return "mstatus";
+    case CSR_MISA: return "misa";
+    case CSR_MIE: return "mie";
+    case CSR_MTVEC: return "mtvec";
+    case CSR_MSCRATCH: return "mscratch";
+    case CSR_MEPC: return "mepc";
+    case CSR_MCAUSE: return "mcause";
+    case CSR_MTVAL: return "mtval";
+    case CSR_MIP: return "mip";
+    case CSR_MCYCLE: return "mcycle";
+    case CSR_MINSTRET: return "minstret";
+    case CSR_MCYCLEH: return "mcycleh";
+    case CSR_MINSTRETH: return "minstreth";
+    case CSR_MVENDORID: return "mvendorid";
+    case CSR_MARCHID: return "marchid";
+    case CSR_MIMPID: return "mimpid";
+    case CSR_MHARTID: return "mhartid";
+    }
+    return NULL;
+}
+
+const char *exception_name(int cause)
+{
+    switch (cause)
+    {
+    case CAUSE_ILLEGAL_INSTRUCTION: return "Illegal instruction";
+    case CAUSE_BREAKPOINT: return "Breakpoint";
+    case CAUSE_MISALIGNED_LOAD: return "Unaligned read";
+    case CAUSE_LOAD_FAULT: return "Read access fault";
+    case CAUSE_MISALIGNED_STORE: return "Unaligned write";
+    case CAUSE_STORE_FAULT: return "Write access fault";
+    case CAUSE_ECALL_M: return "Environment call";
+    }
+    return "Exception";
+}
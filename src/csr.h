@@ -0,0 +1,85 @@
+#ifndef __CSR_H__
+#define __CSR_H__
+
+// CSR numbers
+#define CSR_FFLAGS 0x001
+#define CSR_FRM 0x002
+#define CSR_FCSR 0x003
+#define CSR_VSTART 0x008
+#define CSR_VXSAT 0x009
+#define CSR_VXRM 0x00a
+#define CSR_VCSR 0x00f
+#define CSR_CYCLE 0xc00
+#define CSR_TIME 0xc01
+#define CSR_INSTRET 0xc02
+#define CSR_VL 0xc20
+#define CSR_VTYPE 0xc21
+#define CSR_VLENB 0xc22
+#define CSR_CYCLEH 0xc80
+#define CSR_TIMEH 0xc81
+#define CSR_INSTRETH 0xc82
+#define CSR_MSTATUS 0x300
+#define CSR_MISA 0x301
+#define CSR_MIE 0x304
+#define CSR_MTVEC 0x305
+#define CSR_MSCRATCH 0x340
+#define CSR_MEPC 0x341
+#define CSR_MCAUSE 0x342
+#define CSR_MTVAL 0x343
+#define CSR_MIP 0x344
+#define CSR_MCYCLE 0xb00
+#define CSR_MINSTRET 0xb02
+#define CSR_MCYCLEH 0xb80
+#define CSR_MINSTRETH 0xb82
+#define CSR_MVENDORID 0xf11
+#define CSR_MARCHID 0xf12
+#define CSR_MIMPID 0xf13
+#define CSR_MHARTID 0xf14
+
+// mstatus bits, only machine mode exists so MPP always reads as M
+#define MSTATUS_MIE 0x8
+#define MSTATUS_MPIE 0x80
+#define MSTATUS_MPP 0x1800
+
+// mie/mip bits
+#define MIP_MSIP 0x8
+#define MIP_MTIP 0x80
+#define MIP_MEIP 0x800
+
+// mcause values, interrupts have the top bit set
+#define CAUSE_MISALIGNED_FETCH 0
+#define CAUSE_ILLEGAL_INSTRUCTION 2
+#define CAUSE_BREAKPOINT 3
+#define CAUSE_MISALIGNED_LOAD 4
+#define CAUSE_LOAD_FAULT 5
+#define CAUSE_MISALIGNED_STORE 6
+#define CAUSE_STORE_FAULT 7
+#define CAUSE_ECALL_M 11
+#define CAUSE_INTERRUPT 0x80000000u
+
+// Machine mode trap state
+struct csr_state
+{
+    unsigned int mstatus;
+    unsigned int mie;
+    unsigned int mip; // only the software writable bits, the rest come from devices
+    unsigned int mtvec;
+    unsigned int mscratch;
+    unsigned int mepc;
+    unsigned int mcause;
+    unsigned int mtval;
+};
+
+// csr numbers with bits 11:10 set are read-only
+#define CSR_READ_ONLY(csr) (((csr) >> 10) == 0x3)
+
+// the time CSR counts in microseconds
+#define TIME_FREQ 1000000
+
+// name of a CSR for the disassembler, NULL if unknown
+const char *csr_name(unsigned int csr);
+
+// what to call an exception when the program dies of it
+const char *exception_name(int cause);
+
+#endif
@@ -0,0 +1,568 @@
+#include "decode.h"
+
+const char *insn_names[NUM_INSNS] = {
+#define X(id, name, cls, uses) name,
+    INSN_LIST(X)
+#undef X
+};
+
+const unsigned char insn_classes[NUM_INSNS] = {
+#define X(id, name, cls, uses) cls,
+    INSN_LIST(X)
+#undef X
+};
+
+const unsigned char insn_uses[NUM_INSNS] = {
+#define X(id, name, cls, uses) uses,
+    INSN_LIST(X)
+#undef X
+};
+
+// Encoders for the 32-bit formats, used when expanding compressed instructions
+static uint32_t enc_r(unsigned op, unsigned rd, unsigned f3, unsigned rs1, unsigned rs2, unsigned f7)
+{
+    return op | rd << 7 | f3 << 12 | rs1 << 15 | rs2 << 20 | f7 << 25;
+}
+
+static uint32_t enc_i(unsigned op, unsigned rd, unsigned f3, unsigned rs1, int imm)
+{
+    return op | rd << 7 | f3 << 12 | rs1 << 15 | (uint32_t)imm << 20;
+}
+
+static uint32_t enc_s(unsigned op, unsigned f3, unsigned rs1, unsigned rs2, int imm)
+{
+    return op | (imm & 0x1f) << 7 | f3 << 12 | rs1 << 15 | rs2 << 20 | ((uint32_t)imm >> 5) << 25;
+}
+
+static uint32_t enc_b(unsigned f3, unsigned rs1, unsigned rs2, int imm)
+{
+    return 0x63 | ((imm >> 11) & 1) << 7 | ((imm >> 1) & 0xf) << 8 | f3 << 12 | rs1 << 15 | rs2 << 20 |
+           ((imm >> 5) & 0x3f) << 25 | ((imm >> 12) & 1) << 31;
+}
+
+static uint32_t enc_j(unsigned rd, int imm)
+{
+    return 0x6f | rd << 7 | ((imm >> 12) & 0xff) << 12 | ((imm >> 11) & 1) << 20 |
+           ((imm >> 1) & 0x3ff) << 21 | ((imm >> 20) & 1) << 31;
+}
+
+// sign extend the low 'bits' bits of value
+static int sext(uint32_t value, int bits)
+{
+    return (int)(value << (32 - bits)) >> (32 - bits);
+}
+
+uint32_t expand_compressed(uint16_t c)
+{
+    unsigned int op = c & 0x3;
+    unsigned int funct3 = (c >> 13) & 0x7;
+    unsigned int rd = (c >> 7) & 0x1f; // also rs1
+    unsigned int rs2 = (c >> 2) & 0x1f;
+    unsigned int rd_p = 8 + ((c >> 2) & 0x7); // rd' / rs2'
+    unsigned int rs1_p = 8 + ((c >> 7) & 0x7);
+    int imm6 = sext(((c >> 7) & 0x20) | ((c >> 2) & 0x1f), 6);
+    unsigned int uimm_w = ((c >> 7) & 0x38) | ((c >> 4) & 0x4) | ((c << 1) & 0x40);   // C.LW/C.SW
+    unsigned int uimm_d = ((c >> 7) & 0x38) | ((c << 1) & 0xc0);                      // C.FLD/C.FSD
+    int imm_j = sext(((c >> 1) & 0x800) | ((c >> 7) & 0x10) | ((c >> 1) & 0x300) | ((c << 2) & 0x400) |
+                     ((c >> 1) & 0x40) | ((c << 1) & 0x80) | ((c >> 2) & 0xe) | ((c << 3) & 0x20), 12);
+    int imm_b = sext(((c >> 4) & 0x100) | ((c >> 7) & 0x18) | ((c << 1) & 0xc0) | ((c >> 2) & 0x6) |
+                     ((c << 3) & 0x20), 9);
+
+    if (c == 0)
+        return 0; // defined illegal
+
+    switch (op << 3 | funct3)
+    {
+    case 000: // C.ADDI4SPN
+    {
+        unsigned int imm = ((c >> 7) & 0x30) | ((c >> 1) & 0x3c0) | ((c >> 4) & 0x4) | ((c >> 2) & 0x8);
+        return imm ? enc_i(0x13, rd_p, 0, 2, imm) : 0;
+    }
+    case 001: // C.FLD
+        return enc_i(0x07, rd_p, 3, rs1_p, uimm_d);
+    case 002: // C.LW
+        return enc_i(0x03, rd_p, 2, rs1_p, uimm_w);
+    case 003: // C.FLW
+        return enc_i(0x07, rd_p, 2, rs1_p, uimm_w);
+    case 005: // C.FSD
+        return enc_s(0x27, 3, rs1_p, rd_p, uimm_d);
+    case 006: // C.SW
+        return enc_s(0x23, 2, rs1_p, rd_p, uimm_w);
+    case 007: // C.FSW
+        return enc_s(0x27, 2, rs1_p, rd_p, uimm_w);
+
+    case 010: // C.ADDI, C.NOP
+        return enc_i(0x13, rd, 0, rd, imm6);
+    case 011: // C.JAL
+        return enc_j(1, imm_j);
+    case 012: // C.LI
+        return enc_i(0x13, rd, 0, 0, imm6);
+    case 013:
+        if (rd == 2)
+        { // C.ADDI16SP
+            int imm = sext(((c >> 3) & 0x200) | ((c >> 2) & 0x10) | ((c << 1) & 0x40) |
+                           ((c << 4) & 0x180) | ((c << 3) & 0x20), 10);
+            return imm ? enc_i(0x13, 2, 0, 2, imm) : 0;
+        }
+        // C.LUI
+        return imm6 ? (0x37 | rd << 7 | (uint32_t)imm6 << 12) : 0;
+    case 014:
+        switch ((c >> 10) & 0x3)
+        {
+        case 0: // C.SRLI
+            return (c & 0x1000) ? 0 : enc_i(0x13, rs1_p, 5, rs1_p, rs2);
+        case 1: // C.SRAI
+            return (c & 0x1000) ? 0 : enc_i(0x13, rs1_p, 5, rs1_p, 0x400 | rs2);
+        case 2: // C.ANDI
+            return enc_i(0x13, rs1_p, 7, rs1_p, imm6);
+        default:
+        {
+            static const unsigned char f3[4] = {0, 4, 6, 7}; // C.SUB, C.XOR, C.OR, C.AND
+            unsigned int sel = (c >> 5) & 0x3;
+            if (c & 0x1000)
+                return 0;
+            return enc_r(0x33, rs1_p, f3[sel], rs1_p, rd_p, sel == 0 ? 0x20 : 0);
+        }
+        }
+    case 015: // C.J
+        return enc_j(0, imm_j);
+    case 016: // C.BEQZ
+        return enc_b(0, rs1_p, 0, imm_b);
+    case 017: // C.BNEZ
+        return enc_b(1, rs1_p, 0, imm_b);
+
+    case 020: // C.SLLI
+        return (c & 0x1000) ? 0 : enc_i(0x13, rd, 1, rd, rs2);
+    case 021: // C.FLDSP
+        return enc_i(0x07, rd, 3, 2, ((c >> 7) & 0x20) | ((c >> 2) & 0x18) | ((c << 4) & 0x1c0));
+    case 022: // C.LWSP
+        return rd ? enc_i(0x03, rd, 2, 2, ((c >> 7) & 0x20) | ((c >> 2) & 0x1c) | ((c << 4) & 0xc0)) : 0;
+    case 023: // C.FLWSP
+        return enc_i(0x07, rd, 2, 2, ((c >> 7) & 0x20) | ((c >> 2) & 0x1c) | ((c << 4) & 0xc0));
+    case 024:
+        if (!(c & 0x1000))
+        {
+            if (rs2 == 0) // C.JR
+                return rd ? enc_i(0x67, 0, 0, rd, 0) : 0;
+            return enc_r(0x33, rd, 0, 0, rs2, 0); // C.MV
+        }
+        if (rs2 == 0)
+        {
+            if (rd == 0) // C.EBREAK
+                return 0x00100073;
+            return enc_i(0x67, 1, 0, rd, 0); // C.JALR
+        }
+        return enc_r(0x33, rd, 0, rd, rs2, 0); // C.ADD
+    case 025: // C.FSDSP
+        return enc_s(0x27, 3, 2, rs2, ((c >> 7) & 0x38) | ((c >> 1) & 0x1c0));
+    case 026: // C.SWSP
+        return enc_s(0x23, 2, 2, rs2, ((c >> 7) & 0x3c) | ((c >> 1) & 0xc0));
+    case 027: // C.FSWSP
+        return enc_s(0x27, 2, 2, rs2, ((c >> 7) & 0x3c) | ((c >> 1) & 0xc0));
+    }
+    return 0;
+}
+
+// Vector unit-stride and strided loads/stores. Segment, indexed and the
+// special unit-stride variants (whole register, mask, fault-only-first)
+// are not supported.
+static void decode_vector_mem(uint32_t instruction, struct insn *insn, int unit, int strided)
+{
+    static const int widths[8] = {1, 0, 0, 0, 0, 2, 4, 8};
+    unsigned int funct3 = (instruction >> 12) & 0x7;
+    unsigned int mop = (instruction >> 26) & 0x3;
+    unsigned int nf_mew = instruction >> 28;
+    if (!widths[funct3] || nf_mew != 0)
+        return;
+    if (mop == 0 && insn->rs2 == 0)
+        insn->id = unit;
+    else if (mop == 2)
+        insn->id = strided;
+    insn->imm = widths[funct3];
+    insn->vflags = (instruction >> 25) & 1;
+}
+
+static void decode_vector(uint32_t instruction, struct insn *insn)
+{
+    // OPIVV/OPIVX/OPIVI by funct6, with the forms each one allows
+    static const struct
+    {
+        uint16_t id;
+        uint8_t forms; // bit per VF_ form
+    } opi[64] = {
+        [0x00] = {INSN_VADD, 1 << 0 | 1 << 1 | 1 << 2},
+        [0x02] = {INSN_VSUB, 1 << 0 | 1 << 1},
+        [0x03] = {INSN_VRSUB, 1 << 1 | 1 << 2},
+        [0x04] = {INSN_VMINU, 1 << 0 | 1 << 1},
+        [0x05] = {INSN_VMIN, 1 << 0 | 1 << 1},
+        [0x06] = {INSN_VMAXU, 1 << 0 | 1 << 1},
+        [0x07] = {INSN_VMAX, 1 << 0 | 1 << 1},
+        [0x09] = {INSN_VAND, 1 << 0 | 1 << 1 | 1 << 2},
+        [0x0a] = {INSN_VOR, 1 << 0 | 1 << 1 | 1 << 2},
+        [0x0b] = {INSN_VXOR, 1 << 0 | 1 << 1 | 1 << 2},
+        [0x17] = {INSN_VMERGE, 1 << 0 | 1 << 1 | 1 << 2},
+        [0x18] = {INSN_VMSEQ, 1 << 0 | 1 << 1 | 1 << 2},
+        [0x19] = {INSN_VMSNE, 1 << 0 | 1 << 1 | 1 << 2},
+        [0x1a] = {INSN_VMSLTU, 1 << 0 | 1 << 1},
+        [0x1b] = {INSN_VMSLT, 1 << 0 | 1 << 1},
+        [0x1c] = {INSN_VMSLEU, 1 << 0 | 1 << 1 | 1 << 2},
+        [0x1d] = {INSN_VMSLE, 1 << 0 | 1 << 1 | 1 << 2},
+        [0x1e] = {INSN_VMSGTU, 1 << 1 | 1 << 2},
+        [0x1f] = {INSN_VMSGT, 1 << 1 | 1 << 2},
+    };
+    static const uint16_t reductions[8] = {INSN_VREDSUM, INSN_VREDAND, INSN_VREDOR, INSN_VREDXOR,
+                                           INSN_VREDMINU, INSN_VREDMIN, INSN_VREDMAXU, INSN_VREDMAX};
+    unsigned int funct3 = (instruction >> 12) & 0x7;
+    unsigned int funct6 = instruction >> 26;
+    unsigned int vm = (instruction >> 25) & 1;
+
+    insn->vflags = vm;
+    switch (funct3)
+    {
+    case 0x0: // OPIVV
+    case 0x3: // OPIVI
+    case 0x4: // OPIVX
+    {
+        int form = funct3 == 0x0 ? 0 : funct3 == 0x4 ? 1 : 2;
+        if (opi[funct6].forms & (1 << form))
+            insn->id = opi[funct6].id;
+        // vmv.v.* is the unmasked vmerge, with vs2 unused
+        if (insn->id == INSN_VMERGE && vm && insn->rs2 != 0)
+            insn->id = INSN_ILLEGAL;
+        insn->vflags |= form << 1;
+        insn->imm = (int)(instruction << 12) >> 27;
+        break;
+    }
+    case 0x2: // OPMVV
+        if (funct6 < 8)
+            insn->id = reductions[funct6];
+        else if (funct6 == 0x25)
+            insn->id = INSN_VMUL;
+        else if (funct6 == 0x10 && insn->rs1 == 0 && vm)
+            insn->id = INSN_VMV_X_S;
+        break;
+    case 0x6: // OPMVX
+        insn->vflags |= VF_VX;
+        if (funct6 == 0x25)
+            insn->id = INSN_VMUL;
+        else if (funct6 == 0x10 && insn->rs2 == 0 && vm)
+            insn->id = INSN_VMV_S_X;
+        break;
+    case 0x7: // OPCFG
+        if (!(instruction >> 31))
+        {
+            insn->id = INSN_VSETVLI;
+            insn->imm = (instruction >> 20) & 0x7ff;
+        }
+        else if ((instruction >> 30) == 0x3)
+        {
+            insn->id = INSN_VSETIVLI;
+            insn->imm = (instruction >> 20) & 0x3ff;
+        }
+        else if (((instruction >> 25) & 0x7f) == 0x40)
+            insn->id = INSN_VSETVL;
+        break;
+    }
+}
+
+void decode(uint32_t instruction, struct insn *insn)
+{
+    unsigned int opcode = instruction & 0x7f;
+    unsigned int rd = (instruction >> 7) & 0x1f;
+    unsigned int funct3 = (instruction >> 12) & 0x7;
+    unsigned int rs1 = (instruction >> 15) & 0x1f;
+    unsigned int rs2 = (instruction >> 20) & 0x1f;
+    unsigned int funct7 = (instruction >> 25) & 0x7f;
+
+    int imm_i = ((int)instruction) >> 20;
+    int imm_s = (((int)instruction) >> 20 & ~0x1f) | ((instruction >> 7) & 0x1f);
+    int imm_b = ((int)instruction >> 31 << 12) | ((instruction >> 7) & 0x1e) |
+                ((instruction >> 20) & 0x7e0) | ((instruction << 4) & 0x800);
+    int imm_u = instruction & 0xfffff000;
+    int imm_j = ((int)instruction >> 31 << 20) | (instruction & 0xff000) |
+                ((instruction >> 9) & 0x800) | ((instruction >> 20) & 0x7fe);
+
+    static const uint16_t branches[8] = {INSN_BEQ, INSN_BNE, INSN_ILLEGAL, INSN_ILLEGAL,
+                                         INSN_BLT, INSN_BGE, INSN_BLTU, INSN_BGEU};
+    static const uint16_t loads[8] = {INSN_LB, INSN_LH, INSN_LW, INSN_ILLEGAL,
+                                      INSN_LBU, INSN_LHU, INSN_ILLEGAL, INSN_ILLEGAL};
+    static const uint16_t stores[8] = {INSN_SB, INSN_SH, INSN_SW, INSN_ILLEGAL,
+                                       INSN_ILLEGAL, INSN_ILLEGAL, INSN_ILLEGAL, INSN_ILLEGAL};
+    static const uint16_t alu_imm[8] = {INSN_ADDI, INSN_SLLI, INSN_SLTI, INSN_SLTIU,
+                                        INSN_XORI, INSN_SRLI, INSN_ORI, INSN_ANDI};
+    static const uint16_t alu[8] = {INSN_ADD, INSN_SLL, INSN_SLT, INSN_SLTU,
+                                    INSN_XOR, INSN_SRL, INSN_OR, INSN_AND};
+    static const uint16_t muldiv[8] = {INSN_MUL, INSN_MULH, INSN_MULHSU, INSN_MULHU,
+                                       INSN_DIV, INSN_DIVU, INSN_REM, INSN_REMU};
+
+    insn->id = INSN_ILLEGAL;
+    insn->len = 4;
+    insn->raw = instruction;
+    insn->rd = rd;
+    insn->rs1 = rs1;
+    insn->rs2 = rs2;
+    insn->rs3 = instruction >> 27;
+    insn->imm = 0;
+    insn->vflags = 0;
+
+    if ((instruction & 0x3) != 0x3)
+    {
+        uint32_t expanded = expand_compressed(instruction);
+        if (expanded)
+            decode(expanded, insn);
+        insn->len = 2;
+        insn->raw = instruction & 0xffff;
+        return;
+    }
+
+    switch (opcode)
+    {
+    case 0x33: // R-type ALU operations
+        switch (funct7)
+        {
+        case 0x00:
+            insn->id = alu[funct3];
+            break;
+        case 0x01: // M-extension
+            insn->id = muldiv[funct3];
+            break;
+        case 0x20:
+        {
+            static const uint16_t alt[8] = {INSN_SUB, INSN_ILLEGAL, INSN_ILLEGAL, INSN_ILLEGAL,
+                                            INSN_XNOR, INSN_SRA, INSN_ORN, INSN_ANDN};
+            insn->id = alt[funct3];
+            break;
+        }
+        case 0x10: // Zba
+        {
+            static const uint16_t shadd[8] = {INSN_ILLEGAL, INSN_ILLEGAL, INSN_SH1ADD, INSN_ILLEGAL,
+                                              INSN_SH2ADD, INSN_ILLEGAL, INSN_SH3ADD, INSN_ILLEGAL};
+            insn->id = shadd[funct3];
+            break;
+        }
+        case 0x05: // Zbb min/max
+        {
+            static const uint16_t minmax[8] = {INSN_ILLEGAL, INSN_ILLEGAL, INSN_ILLEGAL, INSN_ILLEGAL,
+                                               INSN_MIN, INSN_MINU, INSN_MAX, INSN_MAXU};
+            insn->id = minmax[funct3];
+            break;
+        }
+        case 0x30: // Zbb rotates
+            insn->id = funct3 == 0x1 ? INSN_ROL : funct3 == 0x5 ? INSN_ROR : INSN_ILLEGAL;
+            break;
+        case 0x04:
+            if (funct3 == 0x4 && rs2 == 0)
+                insn->id = INSN_ZEXT_H;
+            break;
+        case 0x24: // Zbs
+            insn->id = funct3 == 0x1 ? INSN_BCLR : funct3 == 0x5 ? INSN_BEXT : INSN_ILLEGAL;
+            break;
+        case 0x34:
+            insn->id = funct3 == 0x1 ? INSN_BINV : INSN_ILLEGAL;
+            break;
+        case 0x14:
+            insn->id = funct3 == 0x1 ? INSN_BSET : INSN_ILLEGAL;
+            break;
+        }
+        break;
+
+    case 0x13: // I-type immediate operations
+        insn->id = alu_imm[funct3];
+        insn->imm = imm_i;
+        if (funct3 == 0x1 || funct3 == 0x5)
+        {
+            // shifts by immediate, and the Zbb/Zbs instructions sharing their encoding
+            insn->imm = imm_i & 0x1f;
+            switch (funct7 << 3 | funct3)
+            {
+            case 0x00 << 3 | 0x1:
+            case 0x00 << 3 | 0x5:
+                break;
+            case 0x20 << 3 | 0x5:
+                insn->id = INSN_SRAI;
+                break;
+            case 0x30 << 3 | 0x1:
+            {
+                static const uint16_t unary[32] = {INSN_CLZ, INSN_CTZ, INSN_CPOP, INSN_ILLEGAL,
+                                                   INSN_SEXT_B, INSN_SEXT_H};
+                insn->id = unary[rs2];
+                break;
+            }
+            case 0x30 << 3 | 0x5:
+                insn->id = INSN_RORI;
+                break;
+            case 0x24 << 3 | 0x1:
+                insn->id = INSN_BCLRI;
+                break;
+            case 0x24 << 3 | 0x5:
+                insn->id = INSN_BEXTI;
+                break;
+            case 0x34 << 3 | 0x1:
+                insn->id = INSN_BINVI;
+                break;
+            case 0x14 << 3 | 0x1:
+                insn->id = INSN_BSETI;
+                break;
+            default:
+                if ((instruction >> 20) == 0x287 && funct3 == 0x5)
+                    insn->id = INSN_ORC_B;
+                else if ((instruction >> 20) == 0x698 && funct3 == 0x5)
+                    insn->id = INSN_REV8;
+                else
+                    insn->id = INSN_ILLEGAL;
+            }
+        }
+        break;
+
+    case 0x03: // Load instructions
+        insn->id = loads[funct3];
+        insn->imm = imm_i;
+        break;
+
+    case 0x23: // Store instructions
+        insn->id = stores[funct3];
+        insn->imm = imm_s;
+        insn->rd = 0;
+        break;
+
+    case 0x63: // Branch instructions
+        insn->id = branches[funct3];
+        insn->imm = imm_b;
+        insn->rd = 0;
+        break;
+
+    case 0x37: // LUI
+        insn->id = INSN_LUI;
+        insn->imm = imm_u;
+        break;
+    case 0x17: // AUIPC
+        insn->id = INSN_AUIPC;
+        insn->imm = imm_u;
+        break;
+
+    case 0x6F: // JAL
+        insn->id = INSN_JAL;
+        insn->imm = imm_j;
+        break;
+    case 0x67: // JALR
+        insn->id = INSN_JALR;
+        insn->imm = imm_i;
+        break;
+
+    case 0x2F: // A-extension, only word sized
+        if (funct3 == 0x2)
+        {
+            static const uint16_t amos[32] = {
+                [0x00] = INSN_AMOADD_W, [0x01] = INSN_AMOSWAP_W, [0x02] = INSN_LR_W, [0x03] = INSN_SC_W,
+                [0x04] = INSN_AMOXOR_W, [0x08] = INSN_AMOOR_W, [0x0c] = INSN_AMOAND_W,
+                [0x10] = INSN_AMOMIN_W, [0x14] = INSN_AMOMAX_W, [0x18] = INSN_AMOMINU_W,
+                [0x1c] = INSN_AMOMAXU_W};
+            insn->id = amos[funct7 >> 2];
+            if (insn->id == INSN_LR_W && rs2 != 0)
+                insn->id = INSN_ILLEGAL;
+        }
+        break;
+
+    case 0x07: // FP loads, and vector loads for the other widths
+        if (funct3 == 0x2 || funct3 == 0x3)
+        {
+            insn->id = funct3 == 0x2 ? INSN_FLW : INSN_FLD;
+            insn->imm = imm_i;
+        }
+        else
+            decode_vector_mem(instruction, insn, INSN_VLE, INSN_VLSE);
+        break;
+    case 0x27: // FP stores, and vector stores
+        if (funct3 == 0x2 || funct3 == 0x3)
+        {
+            insn->id = funct3 == 0x2 ? INSN_FSW : INSN_FSD;
+            insn->imm = imm_s;
+            insn->rd = 0;
+        }
+        else
+            decode_vector_mem(instruction, insn, INSN_VSE, INSN_VSSE);
+        break;
+
+    case 0x57: // OP-V
+        decode_vector(instruction, insn);
+        break;
+
+    case 0x43: // fused multiply-add, fmt in the low bits of funct7
+    case 0x47:
+    case 0x4B:
+    case 0x4F:
+    {
+        static const uint16_t fma[2][4] = {
+            {INSN_FMADD_S, INSN_FMSUB_S, INSN_FNMSUB_S, INSN_FNMADD_S},
+            {INSN_FMADD_D, INSN_FMSUB_D, INSN_FNMSUB_D, INSN_FNMADD_D}};
+        if ((funct7 & 0x3) < 2)
+            insn->id = fma[funct7 & 0x3][(opcode >> 2) & 0x3];
+        insn->imm = funct3;
+        break;
+    }
+
+    case 0x53: // OP-FP
+        insn->imm = funct3;
+        switch (funct7)
+        {
+        case 0x00: insn->id = INSN_FADD_S; break;
+        case 0x01: insn->id = INSN_FADD_D; break;
+        case 0x04: insn->id = INSN_FSUB_S; break;
+        case 0x05: insn->id = INSN_FSUB_D; break;
+        case 0x08: insn->id = INSN_FMUL_S; break;
+        case 0x09: insn->id = INSN_FMUL_D; break;
+        case 0x0C: insn->id = INSN_FDIV_S; break;
+        case 0x0D: insn->id = INSN_FDIV_D; break;
+        case 0x2C: insn->id = rs2 == 0 ? INSN_FSQRT_S : INSN_ILLEGAL; break;
+        case 0x2D: insn->id = rs2 == 0 ? INSN_FSQRT_D : INSN_ILLEGAL; break;
+        case 0x10:
+            insn->id = funct3 == 0 ? INSN_FSGNJ_S : funct3 == 1 ? INSN_FSGNJN_S : funct3 == 2 ? INSN_FSGNJX_S : INSN_ILLEGAL;
+            break;
+        case 0x11:
+            insn->id = funct3 == 0 ? INSN_FSGNJ_D : funct3 == 1 ? INSN_FSGNJN_D : funct3 == 2 ? INSN_FSGNJX_D : INSN_ILLEGAL;
+            break;
+        case 0x14: insn->id = funct3 == 0 ? INSN_FMIN_S : funct3 == 1 ? INSN_FMAX_S : INSN_ILLEGAL; break;
+        case 0x15: insn->id = funct3 == 0 ? INSN_FMIN_D : funct3 == 1 ? INSN_FMAX_D : INSN_ILLEGAL; break;
+        case 0x20: insn->id = rs2 == 1 ? INSN_FCVT_S_D : INSN_ILLEGAL; break;
+        case 0x21: insn->id = rs2 == 0 ? INSN_FCVT_D_S : INSN_ILLEGAL; break;
+        case 0x50:
+            insn->id = funct3 == 2 ? INSN_FEQ_S : funct3 == 1 ? INSN_FLT_S : funct3 == 0 ? INSN_FLE_S : INSN_ILLEGAL;
+            break;
+        case 0x51:
+            insn->id = funct3 == 2 ? INSN_FEQ_D : funct3 == 1 ? INSN_FLT_D : funct3 == 0 ? INSN_FLE_D : INSN_ILLEGAL;
+            break;
+        case 0x60: insn->id = rs2 == 0 ? INSN_FCVT_W_S : rs2 == 1 ? INSN_FCVT_WU_S : INSN_ILLEGAL; break;
+        case 0x61: insn->id = rs2 == 0 ? INSN_FCVT_W_D : rs2 == 1 ? INSN_FCVT_WU_D : INSN_ILLEGAL; break;
+        case 0x68: insn->id = rs2 == 0 ? INSN_FCVT_S_W : rs2 == 1 ? INSN_FCVT_S_WU : INSN_ILLEGAL; break;
+        case 0x69: insn->id = rs2 == 0 ? INSN_FCVT_D_W : rs2 == 1 ? INSN_FCVT_D_WU : INSN_ILLEGAL; break;
+        case 0x70:
+            insn->id = funct3 == 0 && rs2 == 0 ? INSN_FMV_X_W : funct3 == 1 && rs2 == 0 ? INSN_FCLASS_S : INSN_ILLEGAL;
+            break;
+        case 0x71: insn->id = funct3 == 1 && rs2 == 0 ? INSN_FCLASS_D : INSN_ILLEGAL; break;
+        case 0x78: insn->id = funct3 == 0 && rs2 == 0 ? INSN_FMV_W_X : INSN_ILLEGAL; break;
+        }
+        break;
+
+    case 0x0F: // FENCE has nothing to order, FENCE.I drops the decoded instructions
+        insn->id = funct3 == 1 ? INSN_FENCE_I : INSN_FENCE;
+        break;
+
+    case 0x73: // SYSTEM: ECALL, EBREAK and the Zicsr instructions
+    {
+        static const uint16_t csrs[8] = {INSN_ILLEGAL, INSN_CSRRW, INSN_CSRRS, INSN_CSRRC,
+                                         INSN_ILLEGAL, INSN_CSRRWI, INSN_CSRRSI, INSN_CSRRCI};
+        if (instruction == 0x00000073)
+            insn->id = INSN_ECALL;
+        else if (instruction == 0x00100073)
+            insn->id = INSN_EBREAK;
+        else if (instruction == 0x30200073)
+            insn->id = INSN_MRET;
+        else if (instruction == 0x10500073)
+            insn->id = INSN_WFI;
+        else
+            insn->id = csrs[funct3];
+        insn->imm = instruction >> 20;
+        break;
+    }
+    }
+}
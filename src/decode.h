@@ -0,0 +1,261 @@
+#ifndef __DECODE_H__
+#define __DECODE_H__
+
+#include <stdint.h>
+
+// Instruction classes, used for the instruction mix summary
+enum insn_class
+{
+    CLASS_ALU,
+    CLASS_LOAD,
+    CLASS_STORE,
+    CLASS_BRANCH,
+    CLASS_JUMP,
+    CLASS_MULDIV,
+    CLASS_ATOMIC,
+    CLASS_FP,
+    CLASS_VECTOR,
+    CLASS_SYSTEM,
+    CLASS_OTHER,
+    NUM_CLASSES
+};
+
+// Every instruction the simulator knows: id, mnemonic, class, and which source
+// integer registers it reads (bit 0: rs1, bit 1: rs2). BREAKPOINT is never
+// decoded, the simulator puts it over instructions with a breakpoint.
+#define INSN_LIST(X)                          \
+    X(ILLEGAL, "illegal", CLASS_OTHER, 0)     \
+    X(LUI, "lui", CLASS_ALU, 0)               \
+    X(AUIPC, "auipc", CLASS_ALU, 0)           \
+    X(JAL, "jal", CLASS_JUMP, 0)              \
+    X(JALR, "jalr", CLASS_JUMP, 1)            \
+    X(BEQ, "beq", CLASS_BRANCH, 3)            \
+    X(BNE, "bne", CLASS_BRANCH, 3)            \
+    X(BLT, "blt", CLASS_BRANCH, 3)            \
+    X(BGE, "bge", CLASS_BRANCH, 3)            \
+    X(BLTU, "bltu", CLASS_BRANCH, 3)          \
+    X(BGEU, "bgeu", CLASS_BRANCH, 3)          \
+    X(LB, "lb", CLASS_LOAD, 1)                \
+    X(LH, "lh", CLASS_LOAD, 1)                \
+    X(LW, "lw", CLASS_LOAD, 1)                \
+    X(LBU, "lbu", CLASS_LOAD, 1)              \
+    X(LHU, "lhu", CLASS_LOAD, 1)              \
+    X(SB, "sb", CLASS_STORE, 3)               \
+    X(SH, "sh", CLASS_STORE, 3)               \
+    X(SW, "sw", CLASS_STORE, 3)               \
+    X(ADDI, "addi", CLASS_ALU, 1)             \
+    X(SLTI, "slti", CLASS_ALU, 1)             \
+    X(SLTIU, "sltiu", CLASS_ALU, 1)           \
+    X(XORI, "xori", CLASS_ALU, 1)             \
+    X(ORI, "ori", CLASS_ALU, 1)               \
+    X(ANDI, "andi", CLASS_ALU, 1)             \
+    X(SLLI, "slli", CLASS_ALU, 1)             \
+    X(SRLI, "srli", CLASS_ALU, 1)             \
+    X(SRAI, "srai", CLASS_ALU, 1)             \
+    X(ADD, "add", CLASS_ALU, 3)               \
+    X(SUB, "sub", CLASS_ALU, 3)               \
+    X(SLL, "sll", CLASS_ALU, 3)               \
+    X(SLT, "slt", CLASS_ALU, 3)               \
+    X(SLTU, "sltu", CLASS_ALU, 3)             \
+    X(XOR, "xor", CLASS_ALU, 3)               \
+    X(SRL, "srl", CLASS_ALU, 3)               \
+    X(SRA, "sra", CLASS_ALU, 3)               \
+    X(OR, "or", CLASS_ALU, 3)                 \
+    X(AND, "and", CLASS_ALU, 3)               \
+    X(SH1ADD, "sh1add", CLASS_ALU, 3)         \
+    X(SH2ADD, "sh2add", CLASS_ALU, 3)         \
+    X(SH3ADD, "sh3add", CLASS_ALU, 3)         \
+    X(ANDN, "andn", CLASS_ALU, 3)             \
+    X(ORN, "orn", CLASS_ALU, 3)               \
+    X(XNOR, "xnor", CLASS_ALU, 3)             \
+    X(CLZ, "clz", CLASS_ALU, 1)               \
+    X(CTZ, "ctz", CLASS_ALU, 1)               \
+    X(CPOP, "cpop", CLASS_ALU, 1)             \
+    X(MIN, "min", CLASS_ALU, 3)               \
+    X(MINU, "minu", CLASS_ALU, 3)             \
+    X(MAX, "max", CLASS_ALU, 3)               \
+    X(MAXU, "maxu", CLASS_ALU, 3)             \
+    X(SEXT_B, "sext.b", CLASS_ALU, 1)         \
+    X(SEXT_H, "sext.h", CLASS_ALU, 1)         \
+    X(ZEXT_H, "zext.h", CLASS_ALU, 1)         \
+    X(ROL, "rol", CLASS_ALU, 3)               \
+    X(ROR, "ror", CLASS_ALU, 3)               \
+    X(RORI, "rori", CLASS_ALU, 1)             \
+    X(ORC_B, "orc.b", CLASS_ALU, 1)           \
+    X(REV8, "rev8", CLASS_ALU, 1)             \
+    X(BCLR, "bclr", CLASS_ALU, 3)             \
+    X(BCLRI, "bclri", CLASS_ALU, 1)           \
+    X(BEXT, "bext", CLASS_ALU, 3)             \
+    X(BEXTI, "bexti", CLASS_ALU, 1)           \
+    X(BINV, "binv", CLASS_ALU, 3)             \
+    X(BINVI, "binvi", CLASS_ALU, 1)           \
+    X(BSET, "bset", CLASS_ALU, 3)             \
+    X(BSETI, "bseti", CLASS_ALU, 1)           \
+    X(MUL, "mul", CLASS_MULDIV, 3)            \
+    X(MULH, "mulh", CLASS_MULDIV, 3)          \
+    X(MULHSU, "mulhsu", CLASS_MULDIV, 3)      \
+    X(MULHU, "mulhu", CLASS_MULDIV, 3)        \
+    X(DIV, "div", CLASS_MULDIV, 3)            \
+    X(DIVU, "divu", CLASS_MULDIV, 3)          \
+    X(REM, "rem", CLASS_MULDIV, 3)            \
+    X(REMU, "remu", CLASS_MULDIV, 3)          \
+    X(LR_W, "lr.w", CLASS_ATOMIC, 1)          \
+    X(SC_W, "sc.w", CLASS_ATOMIC, 3)          \
+    X(AMOSWAP_W, "amoswap.w", CLASS_ATOMIC, 3) \
+    X(AMOADD_W, "amoadd.w", CLASS_ATOMIC, 3)  \
+    X(AMOXOR_W, "amoxor.w", CLASS_ATOMIC, 3)  \
+    X(AMOAND_W, "amoand.w", CLASS_ATOMIC, 3)  \
+    X(AMOOR_W, "amoor.w", CLASS_ATOMIC, 3)    \
+    X(AMOMIN_W, "amomin.w", CLASS_ATOMIC, 3)  \
+    X(AMOMAX_W, "amomax.w", CLASS_ATOMIC, 3)  \
+    X(AMOMINU_W, "amominu.w", CLASS_ATOMIC, 3) \
+    X(AMOMAXU_W, "amomaxu.w", CLASS_ATOMIC, 3) \
+    X(FLW, "flw", CLASS_LOAD, 1)              \
+    X(FLD, "fld", CLASS_LOAD, 1)              \
+    X(FSW, "fsw", CLASS_STORE, 1)             \
+    X(FSD, "fsd", CLASS_STORE, 1)             \
+    X(FMADD_S, "fmadd.s", CLASS_FP, 0)        \
+    X(FMSUB_S, "fmsub.s", CLASS_FP, 0)        \
+    X(FNMSUB_S, "fnmsub.s", CLASS_FP, 0)      \
+    X(FNMADD_S, "fnmadd.s", CLASS_FP, 0)      \
+    X(FADD_S, "fadd.s", CLASS_FP, 0)          \
+    X(FSUB_S, "fsub.s", CLASS_FP, 0)          \
+    X(FMUL_S, "fmul.s", CLASS_FP, 0)          \
+    X(FDIV_S, "fdiv.s", CLASS_FP, 0)          \
+    X(FSQRT_S, "fsqrt.s", CLASS_FP, 0)        \
+    X(FSGNJ_S, "fsgnj.s", CLASS_FP, 0)        \
+    X(FSGNJN_S, "fsgnjn.s", CLASS_FP, 0)      \
+    X(FSGNJX_S, "fsgnjx.s", CLASS_FP, 0)      \
+    X(FMIN_S, "fmin.s", CLASS_FP, 0)          \
+    X(FMAX_S, "fmax.s", CLASS_FP, 0)          \
+    X(FCVT_W_S, "fcvt.w.s", CLASS_FP, 0)      \
+    X(FCVT_WU_S, "fcvt.wu.s", CLASS_FP, 0)    \
+    X(FMV_X_W, "fmv.x.w", CLASS_FP, 0)        \
+    X(FEQ_S, "feq.s", CLASS_FP, 0)            \
+    X(FLT_S, "flt.s", CLASS_FP, 0)            \
+    X(FLE_S, "fle.s", CLASS_FP, 0)            \
+    X(FCLASS_S, "fclass.s", CLASS_FP, 0)      \
+    X(FCVT_S_W, "fcvt.s.w", CLASS_FP, 1)      \
+    X(FCVT_S_WU, "fcvt.s.wu", CLASS_FP, 1)    \
+    X(FMV_W_X, "fmv.w.x", CLASS_FP, 1)        \
+    X(FMADD_D, "fmadd.d", CLASS_FP, 0)        \
+    X(FMSUB_D, "fmsub.d", CLASS_FP, 0)        \
+    X(FNMSUB_D, "fnmsub.d", CLASS_FP, 0)      \
+    X(FNMADD_D, "fnmadd.d", CLASS_FP, 0)      \
+    X(FADD_D, "fadd.d", CLASS_FP, 0)          \
+    X(FSUB_D, "fsub.d", CLASS_FP, 0)          \
+    X(FMUL_D, "fmul.d", CLASS_FP, 0)          \
+    X(FDIV_D, "fdiv.d", CLASS_FP, 0)          \
+    X(FSQRT_D, "fsqrt.d", CLASS_FP, 0)        \
+    X(FSGNJ_D, "fsgnj.d", CLASS_FP, 0)        \
+    X(FSGNJN_D, "fsgnjn.d", CLASS_FP, 0)      \
+    X(FSGNJX_D, "fsgnjx.d", CLASS_FP, 0)      \
+    X(FMIN_D, "fmin.d", CLASS_FP, 0)          \
+    X(FMAX_D, "fmax.d", CLASS_FP, 0)          \
+    X(FCVT_S_D, "fcvt.s.d", CLASS_FP, 0)      \
+    X(FCVT_D_S, "fcvt.d.s", CLASS_FP, 0)      \
+    X(FEQ_D, "feq.d", CLASS_FP, 0)            \
+    X(FLT_D, "flt.d", CLASS_FP, 0)            \
+    X(FLE_D, "fle.d", CLASS_FP, 0)            \
+    X(FCLASS_D, "fclass.d", CLASS_FP, 0)      \
+    X(FCVT_W_D, "fcvt.w.d", CLASS_FP, 0)      \
+    X(FCVT_WU_D, "fcvt.wu.d", CLASS_FP, 0)    \
+    X(FCVT_D_W, "fcvt.d.w", CLASS_FP, 1)      \
+    X(FCVT_D_WU, "fcvt.d.wu", CLASS_FP, 1)    \
+    X(VSETVLI, "vsetvli", CLASS_VECTOR, 1)    \
+    X(VSETIVLI, "vsetivli", CLASS_VECTOR, 0)  \
+    X(VSETVL, "vsetvl", CLASS_VECTOR, 3)      \
+    X(VLE, "vle", CLASS_VECTOR, 1)            \
+    X(VLSE, "vlse", CLASS_VECTOR, 3)          \
+    X(VSE, "vse", CLASS_VECTOR, 1)            \
+    X(VSSE, "vsse", CLASS_VECTOR, 3)          \
+    X(VADD, "vadd", CLASS_VECTOR, 0)          \
+    X(VSUB, "vsub", CLASS_VECTOR, 0)          \
+    X(VRSUB, "vrsub", CLASS_VECTOR, 0)        \
+    X(VMINU, "vminu", CLASS_VECTOR, 0)        \
+    X(VMIN, "vmin", CLASS_VECTOR, 0)          \
+    X(VMAXU, "vmaxu", CLASS_VECTOR, 0)        \
+    X(VMAX, "vmax", CLASS_VECTOR, 0)          \
+    X(VAND, "vand", CLASS_VECTOR, 0)          \
+    X(VOR, "vor", CLASS_VECTOR, 0)            \
+    X(VXOR, "vxor", CLASS_VECTOR, 0)          \
+    X(VMUL, "vmul", CLASS_VECTOR, 0)          \
+    X(VMERGE, "vmerge", CLASS_VECTOR, 0)      \
+    X(VMSEQ, "vmseq", CLASS_VECTOR, 0)        \
+    X(VMSNE, "vmsne", CLASS_VECTOR, 0)        \
+    X(VMSLTU, "vmsltu", CLASS_VECTOR, 0)      \
+    X(VMSLT, "vmslt", CLASS_VECTOR, 0)        \
+    X(VMSLEU, "vmsleu", CLASS_VECTOR, 0)      \
+    X(VMSLE, "vmsle", CLASS_VECTOR, 0)        \
+    X(VMSGTU, "vmsgtu", CLASS_VECTOR, 0)      \
+    X(VMSGT, "vmsgt", CLASS_VECTOR, 0)        \
+    X(VREDSUM, "vredsum", CLASS_VECTOR, 0)    \
+    X(VREDAND, "vredand", CLASS_VECTOR, 0)    \
+    X(VREDOR, "vredor", CLASS_VECTOR, 0)      \
+    X(VREDXOR, "vredxor", CLASS_VECTOR, 0)    \
+    X(VREDMINU, "vredminu", CLASS_VECTOR, 0)  \
+    X(VREDMIN, "vredmin", CLASS_VECTOR, 0)    \
+    X(VREDMAXU, "vredmaxu", CLASS_VECTOR, 0)  \
+    X(VREDMAX, "vredmax", CLASS_VECTOR, 0)    \
+    X(VMV_X_S, "vmv.x.s", CLASS_VECTOR, 0)    \
+    X(VMV_S_X, "vmv.s.x", CLASS_VECTOR, 1)    \
+    X(FENCE, "fence", CLASS_OTHER, 0)         \
+    X(FENCE_I, "fence.i", CLASS_SYSTEM, 0)    \
+    X(ECALL, "ecall", CLASS_SYSTEM, 0)        \
+    X(EBREAK, "ebreak", CLASS_SYSTEM, 0)      \
+    X(MRET, "mret", CLASS_SYSTEM, 0)          \
+    X(WFI, "wfi", CLASS_SYSTEM, 0)            \
+    X(CSRRW, "csrrw", CLASS_SYSTEM, 1)        \
+    X(CSRRS, "csrrs", CLASS_SYSTEM, 1)        \
+    X(CSRRC, "csrrc", CLASS_SYSTEM, 1)        \
+    X(CSRRWI, "csrrwi", CLASS_SYSTEM, 0)      \
+    X(CSRRSI, "csrrsi", CLASS_SYSTEM, 0)      \
+    X(CSRRCI, "csrrci", CLASS_SYSTEM, 0)      \
+    X(BREAKPOINT, "breakpoint", CLASS_OTHER, 0)
+
+enum insn_id
+{
+#define X(id, name, cls, uses) INSN_##id,
+    INSN_LIST(X)
+#undef X
+    NUM_INSNS
+};
+
+#define USES_RS1 1
+#define USES_RS2 2
+
+// vector operand forms, stored in insn.vflags together with the vm bit
+#define VF_VV 0x0 // vector-vector
+#define VF_VX 0x2 // vector-scalar register
+#define VF_VI 0x4 // vector-immediate
+#define VF_FORM 0x6
+#define VF_UNMASKED 0x1
+
+// A decoded instruction. Only the fields meaningful for the id are set, the
+// immediate is already sign extended and shifted into place. Compressed
+// instructions are decoded as their 32-bit equivalent with len 2. For
+// floating point instructions the register fields may name f registers,
+// and imm holds the rounding mode. Vector loads and stores keep the element
+// width in bytes in imm, vsetvli/vsetivli the new vtype. CSR instructions
+// have the CSR number in imm and the immediate forms their value in rs1.
+struct insn
+{
+    uint16_t id;
+    uint8_t rd, rs1, rs2, rs3;
+    uint8_t len;  // 2 or 4, 0 marks an empty decode cache entry
+    uint8_t vflags;
+    int32_t imm;
+    uint32_t raw; // instruction as fetched, for logging
+};
+
+// decode a 32-bit instruction, or a 16-bit one if the low two bits aren't 11
+void decode(uint32_t instruction, struct insn *insn);
+
+// expand a 16-bit RV32C instruction to its 32-bit equivalent, 0 if illegal
+uint32_t expand_compressed(uint16_t instruction);
+
+extern const char *insn_names[NUM_INSNS];
+extern const unsigned char insn_classes[NUM_INSNS];
+extern const unsigned char insn_uses[NUM_INSNS];
+
+#endif
@@ -1,9 +1,141 @@
 #include "disassemble.h"
+#include "decode.h"
+#include "csr.h"
 #include <stdio.h>
+#include <string.h>
 
 void disassemble(uint32_t addr, uint32_t instruction, char* result, size_t buf_size, struct symbols* symbols) {
     (void)addr;
     (void)symbols;
+    if ((instruction & 0x3) != 0x3) {
+        // compressed: print the 32-bit equivalent with a c. prefix
+        uint32_t expanded = expand_compressed(instruction);
+        if (expanded == 0 || buf_size < 3) {
+            snprintf(result, buf_size, "c.unknown");
+            return;
+        }
+        snprintf(result, buf_size, "c.");
+        disassemble(addr, expanded, result + 2, buf_size - 2, symbols);
+        return;
+    }
+    // M-extension and bit manipulation instructions (SH1ADD..REMU in the
+    // instruction list) are printed from their decoded form
+    struct insn insn;
+    decode(instruction, &insn);
+    if (insn.id >= INSN_SH1ADD && insn.id <= INSN_REMU) {
+        int imm_form = insn.id == INSN_RORI || insn.id == INSN_BCLRI || insn.id == INSN_BEXTI ||
+                       insn.id == INSN_BINVI || insn.id == INSN_BSETI;
+        if (imm_form)
+            snprintf(result, buf_size, "%s x%d, x%d, %d", insn_names[insn.id], insn.rd, insn.rs1, insn.imm);
+        else if (insn_uses[insn.id] & USES_RS2)
+            snprintf(result, buf_size, "%s x%d, x%d, x%d", insn_names[insn.id], insn.rd, insn.rs1, insn.rs2);
+        else
+            snprintf(result, buf_size, "%s x%d, x%d", insn_names[insn.id], insn.rd, insn.rs1);
+        return;
+    }
+
+    // floating point instructions, likewise from the decoded form
+    if (insn.id >= INSN_FLW && insn.id <= INSN_FCVT_D_WU) {
+        const char *name = insn_names[insn.id];
+        switch (insn.id) {
+            case INSN_FLW:
+            case INSN_FLD:
+                snprintf(result, buf_size, "%s f%d, %d(x%d)", name, insn.rd, insn.imm, insn.rs1);
+                break;
+            case INSN_FSW:
+            case INSN_FSD:
+                snprintf(result, buf_size, "%s f%d, %d(x%d)", name, insn.rs2, insn.imm, insn.rs1);
+                break;
+            case INSN_FMADD_S: case INSN_FMSUB_S: case INSN_FNMSUB_S: case INSN_FNMADD_S:
+            case INSN_FMADD_D: case INSN_FMSUB_D: case INSN_FNMSUB_D: case INSN_FNMADD_D:
+                snprintf(result, buf_size, "%s f%d, f%d, f%d, f%d", name, insn.rd, insn.rs1, insn.rs2, insn.rs3);
+                break;
+            case INSN_FSQRT_S: case INSN_FSQRT_D: case INSN_FCVT_S_D: case INSN_FCVT_D_S:
+                snprintf(result, buf_size, "%s f%d, f%d", name, insn.rd, insn.rs1);
+                break;
+            case INSN_FCVT_W_S: case INSN_FCVT_WU_S: case INSN_FMV_X_W: case INSN_FCLASS_S:
+            case INSN_FCVT_W_D: case INSN_FCVT_WU_D: case INSN_FCLASS_D:
+                snprintf(result, buf_size, "%s x%d, f%d", name, insn.rd, insn.rs1);
+                break;
+            case INSN_FEQ_S: case INSN_FLT_S: case INSN_FLE_S:
+            case INSN_FEQ_D: case INSN_FLT_D: case INSN_FLE_D:
+                snprintf(result, buf_size, "%s x%d, f%d, f%d", name, insn.rd, insn.rs1, insn.rs2);
+                break;
+            case INSN_FCVT_S_W: case INSN_FCVT_S_WU: case INSN_FMV_W_X:
+            case INSN_FCVT_D_W: case INSN_FCVT_D_WU:
+                snprintf(result, buf_size, "%s f%d, x%d", name, insn.rd, insn.rs1);
+                break;
+            default:
+                snprintf(result, buf_size, "%s f%d, f%d, f%d", name, insn.rd, insn.rs1, insn.rs2);
+                break;
+        }
+        return;
+    }
+
+    // vector instructions
+    if (insn.id >= INSN_VSETVLI && insn.id <= INSN_VMV_S_X) {
+        const char *name = insn_names[insn.id];
+        const char *masked = (insn.vflags & VF_UNMASKED) ? "" : ", v0.t";
+        static const char *forms[] = {"vv", "vx", "vi"};
+        static const char *lmuls[8] = {"m1", "m2", "m4", "m8", "m?", "mf8", "mf4", "mf2"};
+        int form = (insn.vflags & VF_FORM) >> 1;
+        switch (insn.id) {
+            case INSN_VSETVLI:
+            case INSN_VSETIVLI:
+            {
+                char avl[8];
+                snprintf(avl, sizeof(avl), insn.id == INSN_VSETVLI ? "x%d" : "%d", insn.rs1);
+                snprintf(result, buf_size, "%s x%d, %s, e%d, %s", name, insn.rd, avl,
+                         8 << ((insn.imm >> 3) & 0x7), lmuls[insn.imm & 0x7]);
+                break;
+            }
+            case INSN_VSETVL:
+                snprintf(result, buf_size, "%s x%d, x%d, x%d", name, insn.rd, insn.rs1, insn.rs2);
+                break;
+            case INSN_VLE:
+            case INSN_VSE:
+                snprintf(result, buf_size, "%s%d.v v%d, (x%d)%s", name, insn.imm * 8, insn.rd, insn.rs1, masked);
+                break;
+            case INSN_VLSE:
+            case INSN_VSSE:
+                snprintf(result, buf_size, "%s%d.v v%d, (x%d), x%d%s", name, insn.imm * 8, insn.rd, insn.rs1,
+                         insn.rs2, masked);
+                break;
+            case INSN_VMV_X_S:
+                snprintf(result, buf_size, "%s x%d, v%d", name, insn.rd, insn.rs2);
+                break;
+            case INSN_VMV_S_X:
+                snprintf(result, buf_size, "%s v%d, x%d", name, insn.rd, insn.rs1);
+                break;
+            case INSN_VREDSUM: case INSN_VREDAND: case INSN_VREDOR: case INSN_VREDXOR:
+            case INSN_VREDMINU: case INSN_VREDMIN: case INSN_VREDMAXU: case INSN_VREDMAX:
+                snprintf(result, buf_size, "%s.vs v%d, v%d, v%d%s", name, insn.rd, insn.rs2, insn.rs1, masked);
+                break;
+            default:
+                if (insn.id == INSN_VMERGE && !masked[0])
+                    snprintf(result, buf_size, "vmv.v.%c v%d, ", forms[form][1], insn.rd);
+                else if (insn.id == INSN_VMERGE)
+                    snprintf(result, buf_size, "vmerge.%sm v%d, v%d, ", forms[form], insn.rd, insn.rs2);
+                else
+                    snprintf(result, buf_size, "%s.%s v%d, v%d, ", name, forms[form], insn.rd, insn.rs2);
+                size_t len = strlen(result);
+                if (form == 0)
+                    snprintf(result + len, buf_size - len, "v%d", insn.rs1);
+                else if (form == 1)
+                    snprintf(result + len, buf_size - len, "x%d", insn.rs1);
+                else
+                    snprintf(result + len, buf_size - len, "%d", insn.imm);
+                len = strlen(result);
+                if (insn.id != INSN_VMERGE)
+                    snprintf(result + len, buf_size - len, "%s", masked);
+                else if (masked[0])
+                    snprintf(result + len, buf_size - len, ", v0");
+                break;
+        }
+        return;
+    }
+
+    snprintf(result, buf_size, "unknown");
     unsigned int opcode = instruction & 0x7f;
     unsigned int rd = (instruction >> 7) & 0x1f;
     unsigned int funct3 = (instruction >> 12) & 0x7;
@@ -152,9 +284,47 @@ void disassemble(uint32_t addr, uint32_t instruction, char* result, size_t buf_s
         case 0x67: // JALR
             snprintf(result, buf_size, "jalr x%d, %d(x%d)", rd, imm_i, rs1);
             break;
-        case 0x73: // ECALL
-            snprintf(result, buf_size, "ecall");
+        case 0x2F: // A-extension
+        {
+            static const char *amos[32] = {
+                [0x00] = "amoadd.w", [0x01] = "amoswap.w", [0x02] = "lr.w", [0x03] = "sc.w",
+                [0x04] = "amoxor.w", [0x08] = "amoor.w", [0x0c] = "amoand.w",
+                [0x10] = "amomin.w", [0x14] = "amomax.w", [0x18] = "amominu.w", [0x1c] = "amomaxu.w"};
+            const char *name = amos[funct7 >> 2];
+            if (funct3 != 0x2 || name == NULL)
+                break;
+            if ((funct7 >> 2) == 0x02)
+                snprintf(result, buf_size, "%s x%d, (x%d)", name, rd, rs1);
+            else
+                snprintf(result, buf_size, "%s x%d, x%d, (x%d)", name, rd, rs2, rs1);
+            break;
+        }
+        case 0x0F:
+            snprintf(result, buf_size, funct3 == 1 ? "fence.i" : "fence");
+            break;
+        case 0x73: // SYSTEM
+        {
+            static const char *csr_ops[8] = {NULL, "csrrw", "csrrs", "csrrc", NULL, "csrrwi", "csrrsi", "csrrci"};
+            char csr[16];
+            const char *name = csr_name(instruction >> 20);
+            if (name)
+                snprintf(csr, sizeof(csr), "%s", name);
+            else
+                snprintf(csr, sizeof(csr), "0x%x", instruction >> 20);
+            if (instruction == 0x00000073)
+                snprintf(result, buf_size, "ecall");
+            else if (instruction == 0x00100073)
+                snprintf(result, buf_size, "ebreak");
+            else if (instruction == 0x30200073)
+                snprintf(result, buf_size, "mret");
+            else if (instruction == 0x10500073)
+                snprintf(result, buf_size, "wfi");
+            else if (csr_ops[funct3] && funct3 < 4)
+                snprintf(result, buf_size, "%s x%d, %s, x%d", csr_ops[funct3], rd, csr, rs1);
+            else if (csr_ops[funct3])
+                snprintf(result, buf_size, "%s x%d, %s, %d", csr_ops[funct3], rd, csr, rs1);
             break;
+        }
         default:
             snprintf(result, buf_size, "unknown");
             break;
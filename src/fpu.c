@@ -0,0 +1,383 @@
+#include "fpu.h"
+#include <fenv.h>
+#include <math.h>
+#include <string.h>
+
+#define CANONICAL_NAN_S 0x7fc00000u
+#define CANONICAL_NAN_D 0x7ff8000000000000ull
+#define BOX 0xffffffff00000000ull
+
+// RISC-V rounding modes RNE, RTZ, RDN, RUP, RMM. The host has no
+// round-to-nearest-max-magnitude mode, RMM arithmetic rounds to nearest
+// even (conversions to integer do honour RMM). Reserved modes act as RNE.
+static const int host_modes[8] = {FE_TONEAREST, FE_TOWARDZERO, FE_DOWNWARD, FE_UPWARD,
+                                  FE_TONEAREST, FE_TONEAREST, FE_TONEAREST, FE_TONEAREST};
+
+// make rm (7 meaning the dynamic mode in frm) the host rounding mode
+static int rounding(struct fpu *fpu, int rm)
+{
+    if (rm == 7)
+        rm = fpu->frm & 7;
+    if (rm != fpu->host_rm)
+    {
+        fesetround(host_modes[rm]);
+        fpu->host_rm = rm;
+    }
+    return rm;
+}
+
+static uint32_t get_s_bits(struct fpu *fpu, int reg)
+{
+    uint64_t value = fpu->regs[reg];
+    return (value & BOX) == BOX ? (uint32_t)value : CANONICAL_NAN_S;
+}
+
+static float get_s(struct fpu *fpu, int reg)
+{
+    uint32_t bits = get_s_bits(fpu, reg);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static void set_s_bits(struct fpu *fpu, int reg, uint32_t bits)
+{
+    fpu->regs[reg] = BOX | bits;
+}
+
+// arithmetic results, NaNs are made canonical
+static void set_s(struct fpu *fpu, int reg, float f)
+{
+    uint32_t bits = CANONICAL_NAN_S;
+    if (!isnan(f))
+        memcpy(&bits, &f, sizeof(bits));
+    set_s_bits(fpu, reg, bits);
+}
+
+static double get_d(struct fpu *fpu, int reg)
+{
+    double d;
+    memcpy(&d, &fpu->regs[reg], sizeof(d));
+    return d;
+}
+
+static void set_d(struct fpu *fpu, int reg, double d)
+{
+    uint64_t bits = CANONICAL_NAN_D;
+    if (!isnan(d))
+        memcpy(&bits, &d, sizeof(bits));
+    fpu->regs[reg] = bits;
+}
+
+static int is_snan_s(uint32_t bits)
+{
+    return (bits & 0x7f800000) == 0x7f800000 && (bits & 0x007fffff) && !(bits & 0x00400000);
+}
+
+static int is_snan_d(uint64_t bits)
+{
+    return (bits & 0x7ff0000000000000ull) == 0x7ff0000000000000ull &&
+           (bits & 0x000fffffffffffffull) && !(bits & 0x0008000000000000ull);
+}
+
+// FCLASS result for a value with the given sign/exponent/mantissa properties
+static int classify(int negative, int exp_max, int exp_zero, int mant_zero, int quiet)
+{
+    if (exp_max)
+        return mant_zero ? (negative ? 1 << 0 : 1 << 7) : (quiet ? 1 << 9 : 1 << 8);
+    if (exp_zero)
+        return mant_zero ? (negative ? 1 << 3 : 1 << 4) : (negative ? 1 << 2 : 1 << 5);
+    return negative ? 1 << 1 : 1 << 6;
+}
+
+// FCVT to a 32-bit integer: round by rm and saturate, NaN converts to the
+// largest value. Singles are converted through double, which is exact.
+static int to_int(double value, int rm, int is_unsigned)
+{
+    if (isnan(value))
+    {
+        feraiseexcept(FE_INVALID);
+        return is_unsigned ? -1 : 0x7fffffff;
+    }
+    double r = rm == 4 ? round(value) : nearbyint(value);
+    if (is_unsigned ? r >= 4294967296.0 : r >= 2147483648.0)
+    {
+        feraiseexcept(FE_INVALID);
+        return is_unsigned ? -1 : 0x7fffffff;
+    }
+    if (is_unsigned ? r <= -1.0 : r < -2147483648.0)
+    {
+        feraiseexcept(FE_INVALID);
+        return is_unsigned ? 0 : (int)0x80000000;
+    }
+    if (r != value)
+        feraiseexcept(FE_INEXACT);
+    return is_unsigned ? (int)(unsigned)r : (int)r;
+}
+
+void fpu_init(struct fpu *fpu)
+{
+    memset(fpu, 0, sizeof(struct fpu));
+    fesetround(FE_TONEAREST);
+    feclearexcept(FE_ALL_EXCEPT);
+}
+
+void fpu_release(struct fpu *fpu)
+{
+    fpu_fflags(fpu);
+    fesetround(FE_TONEAREST);
+    fpu->host_rm = 0;
+}
+
+unsigned int fpu_fflags(struct fpu *fpu)
+{
+    int raised = fetestexcept(FE_ALL_EXCEPT);
+    if (raised)
+    {
+        fpu->fflags |= (raised & FE_INEXACT ? FFLAG_NX : 0) | (raised & FE_UNDERFLOW ? FFLAG_UF : 0) |
+                       (raised & FE_OVERFLOW ? FFLAG_OF : 0) | (raised & FE_DIVBYZERO ? FFLAG_DZ : 0) |
+                       (raised & FE_INVALID ? FFLAG_NV : 0);
+        feclearexcept(FE_ALL_EXCEPT);
+    }
+    return fpu->fflags;
+}
+
+void fpu_set_fflags(struct fpu *fpu, unsigned int fflags)
+{
+    feclearexcept(FE_ALL_EXCEPT);
+    fpu->fflags = fflags & 0x1f;
+}
+
+int fpu_execute(struct fpu *fpu, struct insn *insn, int rs1_val, int *result)
+{
+    int rd = insn->rd, rs1 = insn->rs1, rs2 = insn->rs2, rs3 = insn->rs3;
+    int rm = insn->imm;
+
+    switch (insn->id)
+    {
+    // single precision
+    case INSN_FMADD_S:
+        rounding(fpu, rm);
+        set_s(fpu, rd, fmaf(get_s(fpu, rs1), get_s(fpu, rs2), get_s(fpu, rs3)));
+        break;
+    case INSN_FMSUB_S:
+        rounding(fpu, rm);
+        set_s(fpu, rd, fmaf(get_s(fpu, rs1), get_s(fpu, rs2), -get_s(fpu, rs3)));
+        break;
+    case INSN_FNMSUB_S:
+        rounding(fpu, rm);
+        set_s(fpu, rd, fmaf(-get_s(fpu, rs1), get_s(fpu, rs2), get_s(fpu, rs3)));
+        break;
+    case INSN_FNMADD_S:
+        rounding(fpu, rm);
+        set_s(fpu, rd, fmaf(-get_s(fpu, rs1), get_s(fpu, rs2), -get_s(fpu, rs3)));
+        break;
+    case INSN_FADD_S:
+        rounding(fpu, rm);
+        set_s(fpu, rd, get_s(fpu, rs1) + get_s(fpu, rs2));
+        break;
+    case INSN_FSUB_S:
+        rounding(fpu, rm);
+        set_s(fpu, rd, get_s(fpu, rs1) - get_s(fpu, rs2));
+        break;
+    case INSN_FMUL_S:
+        rounding(fpu, rm);
+        set_s(fpu, rd, get_s(fpu, rs1) * get_s(fpu, rs2));
+        break;
+    case INSN_FDIV_S:
+        rounding(fpu, rm);
+        set_s(fpu, rd, get_s(fpu, rs1) / get_s(fpu, rs2));
+        break;
+    case INSN_FSQRT_S:
+        rounding(fpu, rm);
+        set_s(fpu, rd, sqrtf(get_s(fpu, rs1)));
+        break;
+    case INSN_FSGNJ_S:
+        set_s_bits(fpu, rd, (get_s_bits(fpu, rs1) & 0x7fffffff) | (get_s_bits(fpu, rs2) & 0x80000000));
+        break;
+    case INSN_FSGNJN_S:
+        set_s_bits(fpu, rd, (get_s_bits(fpu, rs1) & 0x7fffffff) | (~get_s_bits(fpu, rs2) & 0x80000000));
+        break;
+    case INSN_FSGNJX_S:
+        set_s_bits(fpu, rd, get_s_bits(fpu, rs1) ^ (get_s_bits(fpu, rs2) & 0x80000000));
+        break;
+    case INSN_FMIN_S:
+    case INSN_FMAX_S:
+    {
+        uint32_t a = get_s_bits(fpu, rs1), b = get_s_bits(fpu, rs2);
+        float fa = get_s(fpu, rs1), fb = get_s(fpu, rs2);
+        int is_max = insn->id == INSN_FMAX_S;
+        if (is_snan_s(a) || is_snan_s(b))
+            feraiseexcept(FE_INVALID);
+        if (isnan(fa) && isnan(fb))
+            set_s_bits(fpu, rd, CANONICAL_NAN_S);
+        else if (isnan(fa))
+            set_s_bits(fpu, rd, b);
+        else if (isnan(fb))
+            set_s_bits(fpu, rd, a);
+        else if (fa == fb) // -0.0 is below +0.0
+            set_s_bits(fpu, rd, is_max ? a & b : a | b);
+        else
+            set_s_bits(fpu, rd, (fa < fb) != is_max ? a : b);
+        break;
+    }
+    case INSN_FCVT_W_S:
+        *result = to_int(get_s(fpu, rs1), rounding(fpu, rm), 0);
+        return 1;
+    case INSN_FCVT_WU_S:
+        *result = to_int(get_s(fpu, rs1), rounding(fpu, rm), 1);
+        return 1;
+    case INSN_FMV_X_W:
+        *result = (uint32_t)fpu->regs[rs1];
+        return 1;
+    case INSN_FEQ_S:
+        if (is_snan_s(get_s_bits(fpu, rs1)) || is_snan_s(get_s_bits(fpu, rs2)))
+            feraiseexcept(FE_INVALID);
+        *result = get_s(fpu, rs1) == get_s(fpu, rs2);
+        return 1;
+    case INSN_FLT_S:
+    case INSN_FLE_S:
+    {
+        float fa = get_s(fpu, rs1), fb = get_s(fpu, rs2);
+        if (isnan(fa) || isnan(fb))
+        {
+            feraiseexcept(FE_INVALID);
+            *result = 0;
+        }
+        else
+            *result = insn->id == INSN_FLT_S ? fa < fb : fa <= fb;
+        return 1;
+    }
+    case INSN_FCLASS_S:
+    {
+        uint32_t bits = get_s_bits(fpu, rs1);
+        *result = classify(bits >> 31, (bits & 0x7f800000) == 0x7f800000, (bits & 0x7f800000) == 0,
+                           (bits & 0x007fffff) == 0, (bits & 0x00400000) != 0);
+        return 1;
+    }
+    case INSN_FCVT_S_W:
+        rounding(fpu, rm);
+        set_s(fpu, rd, (float)rs1_val);
+        break;
+    case INSN_FCVT_S_WU:
+        rounding(fpu, rm);
+        set_s(fpu, rd, (float)(unsigned)rs1_val);
+        break;
+    case INSN_FMV_W_X:
+        set_s_bits(fpu, rd, rs1_val);
+        break;
+
+    // double precision
+    case INSN_FMADD_D:
+        rounding(fpu, rm);
+        set_d(fpu, rd, fma(get_d(fpu, rs1), get_d(fpu, rs2), get_d(fpu, rs3)));
+        break;
+    case INSN_FMSUB_D:
+        rounding(fpu, rm);
+        set_d(fpu, rd, fma(get_d(fpu, rs1), get_d(fpu, rs2), -get_d(fpu, rs3)));
+        break;
+    case INSN_FNMSUB_D:
+        rounding(fpu, rm);
+        set_d(fpu, rd, fma(-get_d(fpu, rs1), get_d(fpu, rs2), get_d(fpu, rs3)));
+        break;
+    case INSN_FNMADD_D:
+        rounding(fpu, rm);
+        set_d(fpu, rd, fma(-get_d(fpu, rs1), get_d(fpu, rs2), -get_d(fpu, rs3)));
+        break;
+    case INSN_FADD_D:
+        rounding(fpu, rm);
+        set_d(fpu, rd, get_d(fpu, rs1) + get_d(fpu, rs2));
+        break;
+    case INSN_FSUB_D:
+        rounding(fpu, rm);
+        set_d(fpu, rd, get_d(fpu, rs1) - get_d(fpu, rs2));
+        break;
+    case INSN_FMUL_D:
+        rounding(fpu, rm);
+        set_d(fpu, rd, get_d(fpu, rs1) * get_d(fpu, rs2));
+        break;
+    case INSN_FDIV_D:
+        rounding(fpu, rm);
+        set_d(fpu, rd, get_d(fpu, rs1) / get_d(fpu, rs2));
+        break;
+    case INSN_FSQRT_D:
+        rounding(fpu, rm);
+        set_d(fpu, rd, sqrt(get_d(fpu, rs1)));
+        break;
+    case INSN_FSGNJ_D:
+        fpu->regs[rd] = (fpu->regs[rs1] & ~(1ull << 63)) | (fpu->regs[rs2] & (1ull << 63));
+        break;
+    case INSN_FSGNJN_D:
+        fpu->regs[rd] = (fpu->regs[rs1] & ~(1ull << 63)) | (~fpu->regs[rs2] & (1ull << 63));
+        break;
+    case INSN_FSGNJX_D:
+        fpu->regs[rd] = fpu->regs[rs1] ^ (fpu->regs[rs2] & (1ull << 63));
+        break;
+    case INSN_FMIN_D:
+    case INSN_FMAX_D:
+    {
+        uint64_t a = fpu->regs[rs1], b = fpu->regs[rs2];
+        double fa = get_d(fpu, rs1), fb = get_d(fpu, rs2);
+        int is_max = insn->id == INSN_FMAX_D;
+        if (is_snan_d(a) || is_snan_d(b))
+            feraiseexcept(FE_INVALID);
+        if (isnan(fa) && isnan(fb))
+            fpu->regs[rd] = CANONICAL_NAN_D;
+        else if (isnan(fa))
+            fpu->regs[rd] = b;
+        else if (isnan(fb))
+            fpu->regs[rd] = a;
+        else if (fa == fb)
+            fpu->regs[rd] = is_max ? a & b : a | b;
+        else
+            fpu->regs[rd] = (fa < fb) != is_max ? a : b;
+        break;
+    }
+    case INSN_FCVT_S_D:
+        rounding(fpu, rm);
+        set_s(fpu, rd, (float)get_d(fpu, rs1));
+        break;
+    case INSN_FCVT_D_S:
+        set_d(fpu, rd, get_s(fpu, rs1));
+        break;
+    case INSN_FEQ_D:
+        if (is_snan_d(fpu->regs[rs1]) || is_snan_d(fpu->regs[rs2]))
+            feraiseexcept(FE_INVALID);
+        *result = get_d(fpu, rs1) == get_d(fpu, rs2);
+        return 1;
+    case INSN_FLT_D:
+    case INSN_FLE_D:
+    {
+        double fa = get_d(fpu, rs1), fb = get_d(fpu, rs2);
+        if (isnan(fa) || isnan(fb))
+        {
+            feraiseexcept(FE_INVALID);
+            *result = 0;
+        }
+        else
+            *result = insn->id == INSN_FLT_D ? fa < fb : fa <= fb;
+        return 1;
+    }
+    case INSN_FCLASS_D:
+    {
+        uint64_t bits = fpu->regs[rs1];
+        uint64_t exp = bits & 0x7ff0000000000000ull;
+        *result = classify(bits >> 63, exp == 0x7ff0000000000000ull, exp == 0,
+                           (bits & 0x000fffffffffffffull) == 0, (bits & 0x0008000000000000ull) != 0);
+        return 1;
+    }
+    case INSN_FCVT_W_D:
+        *result = to_int(get_d(fpu, rs1), rounding(fpu, rm), 0);
+        return 1;
+    case INSN_FCVT_WU_D:
+        *result = to_int(get_d(fpu, rs1), rounding(fpu, rm), 1);
+        return 1;
+    case INSN_FCVT_D_W:
+        set_d(fpu, rd, rs1_val);
+        break;
+    case INSN_FCVT_D_WU:
+        set_d(fpu, rd, (unsigned)rs1_val);
+        break;
+    }
+    return 0;
+}
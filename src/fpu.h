@@ -0,0 +1,41 @@
+#ifndef __FPU_H__
+#define __FPU_H__
+
+#include "decode.h"
+#include <stdint.h>
+
+// F and D extension state. Single precision values are NaN-boxed in the
+// 64-bit registers. Arithmetic runs directly on the host FPU: the host
+// rounding mode is only changed when an instruction needs a different one,
+// and exception flags are left to accumulate in the host status register
+// until fflags is actually read.
+struct fpu
+{
+    uint64_t regs[32];
+    unsigned int frm;    // dynamic rounding mode
+    unsigned int fflags; // flags folded in from the host so far
+    int host_rm;         // RISC-V rounding mode currently set on the host
+};
+
+// fcsr bits
+#define FFLAG_NX 0x01
+#define FFLAG_UF 0x02
+#define FFLAG_OF 0x04
+#define FFLAG_DZ 0x08
+#define FFLAG_NV 0x10
+
+void fpu_init(struct fpu *fpu);
+
+// fold in the host flags and restore the host rounding mode, call when done
+// simulating or before another hart gets to use the host FPU
+void fpu_release(struct fpu *fpu);
+
+// execute a CLASS_FP instruction. Returns 1 if it produced a value for
+// integer register rd in *result.
+int fpu_execute(struct fpu *fpu, struct insn *insn, int rs1_val, int *result);
+
+// current fflags, including flags raised on the host since last time
+unsigned int fpu_fflags(struct fpu *fpu);
+void fpu_set_fflags(struct fpu *fpu, unsigned int fflags);
+
+#endif
@@ -0,0 +1,559 @@
+#include "fuzz.h"
+#include "memory.h"
+#include "console.h"
+#include "disassemble.h"
+#include "simulate.h"
+#include "syscall.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// where things are in the address space of a program
+#define CODE 0x10000
+#define SANDBOX 0x20000 // gp, loads and stores reach 2 KiB either side
+#define SANDBOX_LOW (SANDBOX - 0x800)
+#define SANDBOX_SIZE 0x1000
+#define RESULTS 0x30000 // the registers are stored here at the end
+
+// random instructions in the loop body, and times around the loop
+#define BODY_OPS 200
+#define LOOPS 128
+// furthest a branch or jump in the body goes forward, in instructions
+#define MAX_SKIP 12
+#define MAX_OPS (BODY_OPS + 120)
+
+// registers the body doesn't write: the sandbox pointer, the JALR base and
+// the loop counter, and from REG_CORNERS up values that often go wrong
+#define REG_GP 3
+#define REG_TMP 4
+#define REG_LOOP 5
+#define REG_CORNERS 28
+static const uint32_t corner_regs[] = {0x80000000, 0xffffffff, 0, 0x7fffffff};
+
+#define OP_LIST(X)                                                                                                     \
+    X(ADD, 'R', 0x33, 0, 0x00)                                                                                         \
+    X(SUB, 'R', 0x33, 0, 0x20)                                                                                         \
+    X(SLL, 'R', 0x33, 1, 0x00)                                                                                         \
+    X(SLT, 'R', 0x33, 2, 0x00)                                                                                         \
+    X(SLTU, 'R', 0x33, 3, 0x00)                                                                                        \
+    X(XOR, 'R', 0x33, 4, 0x00)                                                                                         \
+    X(SRL, 'R', 0x33, 5, 0x00)                                                                                         \
+    X(SRA, 'R', 0x33, 5, 0x20)                                                                                         \
+    X(OR, 'R', 0x33, 6, 0x00)                                                                                          \
+    X(AND, 'R', 0x33, 7, 0x00)                                                                                         \
+    X(MUL, 'R', 0x33, 0, 0x01)                                                                                         \
+    X(MULH, 'R', 0x33, 1, 0x01)                                                                                        \
+    X(MULHSU, 'R', 0x33, 2, 0x01)                                                                                      \
+    X(MULHU, 'R', 0x33, 3, 0x01)                                                                                       \
+    X(DIV, 'R', 0x33, 4, 0x01)                                                                                         \
+    X(DIVU, 'R', 0x33, 5, 0x01)                                                                                        \
+    X(REM, 'R', 0x33, 6, 0x01)                                                                                         \
+    X(REMU, 'R', 0x33, 7, 0x01)                                                                                        \
+    X(ADDI, 'I', 0x13, 0, 0)                                                                                           \
+    X(SLTI, 'I', 0x13, 2, 0)                                                                                           \
+    X(SLTIU, 'I', 0x13, 3, 0)                                                                                          \
+    X(XORI, 'I', 0x13, 4, 0)                                                                                           \
+    X(ORI, 'I', 0x13, 6, 0)                                                                                            \
+    X(ANDI, 'I', 0x13, 7, 0)                                                                                           \
+    X(SLLI, 'I', 0x13, 1, 0x00)                                                                                        \
+    X(SRLI, 'I', 0x13, 5, 0x00)                                                                                        \
+    X(SRAI, 'I', 0x13, 5, 0x20)                                                                                        \
+    X(LB, 'I', 0x03, 0, 0)                                                                                             \
+    X(LH, 'I', 0x03, 1, 0)                                                                                             \
+    X(LW, 'I', 0x03, 2, 0)                                                                                             \
+    X(LBU, 'I', 0x03, 4, 0)                                                                                            \
+    X(LHU, 'I', 0x03, 5, 0)                                                                                            \
+    X(SB, 'S', 0x23, 0, 0)                                                                                             \
+    X(SH, 'S', 0x23, 1, 0)                                                                                             \
+    X(SW, 'S', 0x23, 2, 0)                                                                                             \
+    X(BEQ, 'B', 0x63, 0, 0)                                                                                            \
+    X(BNE, 'B', 0x63, 1, 0)                                                                                            \
+    X(BLT, 'B', 0x63, 4, 0)                                                                                            \
+    X(BGE, 'B', 0x63, 5, 0)                                                                                            \
+    X(BLTU, 'B', 0x63, 6, 0)                                                                                           \
+    X(BGEU, 'B', 0x63, 7, 0)                                                                                           \
+    X(LUI, 'U', 0x37, 0, 0)                                                                                            \
+    X(AUIPC, 'U', 0x17, 0, 0)                                                                                          \
+    X(JAL, 'J', 0x6f, 0, 0)                                                                                            \
+    X(JALR, 'I', 0x67, 0, 0)                                                                                           \
+    X(ECALL, 'I', 0x73, 0, 0)
+
+enum op_id
+{
+#define X(id, format, opcode, funct3, funct7) OP_##id,
+    OP_LIST(X)
+#undef X
+        NUM_OPS
+};
+
+static const struct
+{
+    char format;
+    unsigned char opcode, funct3, funct7;
+} op_info[NUM_OPS] = {
+#define X(id, format, opcode, funct3, funct7) {format, opcode, funct3, funct7},
+    OP_LIST(X)
+#undef X
+};
+
+struct op
+{
+    enum op_id id;
+    int rd, rs1, rs2;
+    int imm;        // the shift amount for SLLI, SRLI and SRAI
+    int no_target;  // a branch mustn't land here, it needs the op before it
+};
+
+struct program
+{
+    struct op ops[MAX_OPS];
+    int num_ops;
+    uint32_t code[MAX_OPS];
+    unsigned char sandbox[SANDBOX_SIZE];
+};
+
+// xorshift64*
+static uint32_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (*state * 0x2545f4914f6cdd1dull) >> 32;
+}
+
+static uint32_t encode(struct op *op)
+{
+    uint32_t opcode = op_info[op->id].opcode, funct3 = op_info[op->id].funct3, funct7 = op_info[op->id].funct7;
+    uint32_t rd = op->rd, rs1 = op->rs1, rs2 = op->rs2, imm = op->imm;
+    switch (op_info[op->id].format)
+    {
+    case 'R': return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+    case 'I':
+        if (op->id == OP_SLLI || op->id == OP_SRLI || op->id == OP_SRAI)
+            imm = funct7 << 5 | (imm & 0x1f);
+        return imm << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+    case 'S': return (imm >> 5 & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | (imm & 0x1f) << 7 | opcode;
+    case 'B':
+        return (imm >> 12 & 1) << 31 | (imm >> 5 & 0x3f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 |
+               (imm >> 1 & 0xf) << 8 | (imm >> 11 & 1) << 7 | opcode;
+    case 'U': return (imm & 0xfffff000) | rd << 7 | opcode;
+    default: // J
+        return (imm >> 20 & 1) << 31 | (imm >> 1 & 0x3ff) << 21 | (imm >> 11 & 1) << 20 | (imm >> 12 & 0xff) << 12 |
+               rd << 7 | opcode;
+    }
+}
+
+static struct op *emit(struct program *p, enum op_id id, int rd, int rs1, int rs2, int imm)
+{
+    struct op *op = &p->ops[p->num_ops++];
+    *op = (struct op){id, rd, rs1, rs2, imm, 0};
+    return op;
+}
+
+// li reg, value as LUI and ADDI
+static void emit_li(struct program *p, int reg, uint32_t value)
+{
+    uint32_t upper = (value + 0x800) & 0xfffff000;
+    emit(p, OP_LUI, reg, 0, 0, upper);
+    emit(p, OP_ADDI, reg, reg, 0, (int)(value - upper));
+}
+
+// a value that is often one of the cases engines get wrong
+static uint32_t random_value(uint64_t *rng)
+{
+    static const uint32_t corners[] = {0, 1, 2, 0xffffffff, 0x80000000, 0x7fffffff, 0x80000001, 31, 32, 0xfffffffe};
+    if (next_random(rng) % 2)
+        return corners[next_random(rng) % (sizeof(corners) / sizeof(corners[0]))];
+    return next_random(rng);
+}
+
+static int random_imm(uint64_t *rng)
+{
+    static const int corners[] = {0, 1, -1, 2047, -2048};
+    if (next_random(rng) % 4 == 0)
+        return corners[next_random(rng) % 5];
+    return (int)(next_random(rng) % 4096) - 2048;
+}
+
+// any register the body may write, x0 included
+static int random_rd(uint64_t *rng)
+{
+    int reg;
+    do
+        reg = next_random(rng) % 32;
+    while (reg == REG_GP || reg == REG_TMP || reg == REG_LOOP || reg >= REG_CORNERS);
+    return reg;
+}
+
+// sources come mostly from a few registers, so results are used again, or
+// from the corner cases
+static int random_rs(uint64_t *rng)
+{
+    int pick = next_random(rng) % 8;
+    if (pick < 5)
+        return 6 + next_random(rng) % 8;
+    if (pick < 7)
+        return REG_CORNERS + next_random(rng) % 4;
+    return next_random(rng) % 32;
+}
+
+static void generate(struct program *p, uint64_t *rng)
+{
+    p->num_ops = 0;
+    for (int i = 0; i < SANDBOX_SIZE; ++i)
+        p->sandbox[i] = next_random(rng);
+    for (int reg = 1; reg < 32; ++reg)
+    {
+        uint32_t value = reg == REG_GP ? SANDBOX : reg == REG_LOOP ? LOOPS : random_value(rng);
+        emit_li(p, reg, reg >= REG_CORNERS ? corner_regs[reg - REG_CORNERS] : value);
+    }
+
+    int body = p->num_ops, end = body + BODY_OPS;
+    while (p->num_ops < end)
+    {
+        int i = p->num_ops;
+        int skip = 1 + next_random(rng) % MAX_SKIP;
+        if (skip > end - i)
+            skip = end - i;
+        int kind = next_random(rng) % 16;
+        if (kind < 5)
+        {
+            enum op_id id = OP_ADD + next_random(rng) % (OP_REMU - OP_ADD + 1);
+            emit(p, id, random_rd(rng), random_rs(rng), random_rs(rng), 0);
+        }
+        else if (kind < 9)
+        {
+            enum op_id id = OP_ADDI + next_random(rng) % (OP_SRAI - OP_ADDI + 1);
+            int imm = id >= OP_SLLI ? (int)(next_random(rng) % 32) : random_imm(rng);
+            emit(p, id, random_rd(rng), random_rs(rng), 0, imm);
+        }
+        else if (kind < 11)
+        {
+            enum op_id id = OP_LB + next_random(rng) % (OP_LHU - OP_LB + 1);
+            int size = id == OP_LW ? 4 : id == OP_LH || id == OP_LHU ? 2 : 1;
+            emit(p, id, random_rd(rng), REG_GP, 0, random_imm(rng) & -size);
+        }
+        else if (kind < 13)
+        {
+            enum op_id id = OP_SB + next_random(rng) % 3;
+            int size = 1 << (id - OP_SB);
+            emit(p, id, 0, REG_GP, random_rs(rng), random_imm(rng) & -size);
+        }
+        else if (kind < 15)
+        {
+            enum op_id id = OP_BEQ + next_random(rng) % (OP_BGEU - OP_BEQ + 1);
+            emit(p, id, 0, random_rs(rng), random_rs(rng), 4 * skip);
+        }
+        else if (next_random(rng) % 2 || i + 1 == end)
+        {
+            if (next_random(rng) % 2)
+                emit(p, OP_LUI, random_rd(rng), 0, 0, next_random(rng) & 0xfffff000);
+            else
+                emit(p, OP_JAL, random_rd(rng), 0, 0, 4 * skip);
+        }
+        else
+        {
+            // AUIPC and JALR forward, sometimes with bit 0 set for JALR to clear
+            if (skip < 2)
+                skip = 2;
+            if (next_random(rng) % 4 == 0)
+                emit(p, OP_AUIPC, random_rd(rng), 0, 0, next_random(rng) & 0xfffff000);
+            else
+            {
+                emit(p, OP_AUIPC, REG_TMP, 0, 0, 0);
+                emit(p, OP_JALR, random_rd(rng), REG_TMP, 0, 4 * skip + next_random(rng) % 2)->no_target = 1;
+            }
+        }
+    }
+
+    // the loop, then the registers are stored and the program exits
+    emit(p, OP_ADDI, REG_LOOP, REG_LOOP, 0, -1);
+    emit(p, OP_BNE, 0, REG_LOOP, 0, 4 * (body - p->num_ops));
+    emit(p, OP_LUI, REG_TMP, 0, 0, RESULTS);
+    for (int reg = 1; reg < 32; ++reg)
+        emit(p, OP_SW, 0, REG_TMP, reg, 4 * reg);
+    emit(p, OP_ADDI, 17, 0, 0, SYS_EXIT);
+    emit(p, OP_ADDI, 10, 0, 0, 0);
+    emit(p, OP_ECALL, 0, 0, 0, 0);
+
+    // a branch that would land on a JALR goes one further
+    for (int i = 0; i < p->num_ops; ++i)
+    {
+        struct op *op = &p->ops[i];
+        if (op_info[op->id].format == 'B' && op->imm > 0 && p->ops[i + op->imm / 4].no_target)
+            op->imm += 4;
+        if (op->id == OP_JAL && p->ops[i + op->imm / 4].no_target)
+            op->imm += 4;
+        if (op->id == OP_JALR && p->ops[i - 1 + op->imm / 4].no_target)
+            op->imm += 4;
+        p->code[i] = encode(op);
+    }
+}
+
+// The reference: the registers and the memory a program can reach
+struct reference
+{
+    uint32_t x[32];
+    unsigned char sandbox[SANDBOX_SIZE];
+    unsigned char results[128];
+    long int insns;
+};
+
+static unsigned char *ref_byte(struct reference *r, uint32_t addr)
+{
+    if (addr - SANDBOX_LOW < SANDBOX_SIZE)
+        return &r->sandbox[addr - SANDBOX_LOW];
+    if (addr - RESULTS < sizeof(r->results))
+        return &r->results[addr - RESULTS];
+    fprintf(stderr, "fuzz: the reference accessed %x outside the sandbox\n", addr);
+    abort();
+}
+
+static uint32_t ref_load(struct reference *r, uint32_t addr, int size)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < size; ++i)
+        value |= (uint32_t)*ref_byte(r, addr + i) << (8 * i);
+    return value;
+}
+
+static void ref_store(struct reference *r, uint32_t addr, int size, uint32_t value)
+{
+    for (int i = 0; i < size; ++i)
+        *ref_byte(r, addr + i) = value >> (8 * i);
+}
+
+static uint32_t sign_extend(uint32_t value, int bits)
+{
+    uint32_t sign = 1u << (bits - 1);
+    return value & sign ? value | ~(2 * sign - 1) : value;
+}
+
+static uint32_t shift_right_arithmetic(uint32_t value, int shift)
+{
+    uint32_t result = value >> shift;
+    if ((value & 0x80000000) && shift)
+        result |= 0xffffffff << (32 - shift);
+    return result;
+}
+
+static int less_than(uint32_t a, uint32_t b)
+{
+    return (int64_t)(int32_t)a < (int64_t)(int32_t)b;
+}
+
+// Runs the program to its ECALL, one op at a time
+static void reference_run(struct program *p, struct reference *r)
+{
+    memset(r, 0, sizeof(struct reference));
+    memcpy(r->sandbox, p->sandbox, SANDBOX_SIZE);
+    uint32_t pc = CODE;
+    for (;;)
+    {
+        struct op *op = &p->ops[(pc - CODE) / 4];
+        uint32_t a = r->x[op->rs1], b = r->x[op->rs2], imm = op->imm, result = 0;
+        uint32_t next_pc = pc + 4;
+        int64_t sa = (int32_t)a, sb = (int32_t)b;
+        r->insns++;
+        switch (op->id)
+        {
+        case OP_ADD: result = a + b; break;
+        case OP_SUB: result = a - b; break;
+        case OP_SLL: result = a << (b & 31); break;
+        case OP_SLT: result = less_than(a, b); break;
+        case OP_SLTU: result = a < b; break;
+        case OP_XOR: result = a ^ b; break;
+        case OP_SRL: result = a >> (b & 31); break;
+        case OP_SRA: result = shift_right_arithmetic(a, b & 31); break;
+        case OP_OR: result = a | b; break;
+        case OP_AND: result = a & b; break;
+        case OP_MUL: result = (uint32_t)((uint64_t)a * b); break;
+        case OP_MULH: result = (uint64_t)(sa * sb) >> 32; break;
+        case OP_MULHSU: result = (uint64_t)(sa * (int64_t)b) >> 32; break;
+        case OP_MULHU: result = ((uint64_t)a * b) >> 32; break;
+        case OP_DIV: result = b == 0 ? 0xffffffff : (uint32_t)(sa / sb); break;
+        case OP_DIVU: result = b == 0 ? 0xffffffff : a / b; break;
+        case OP_REM: result = b == 0 ? a : (uint32_t)(sa % sb); break;
+        case OP_REMU: result = b == 0 ? a : a % b; break;
+        case OP_ADDI: result = a + imm; break;
+        case OP_SLTI: result = less_than(a, imm); break;
+        case OP_SLTIU: result = a < imm; break;
+        case OP_XORI: result = a ^ imm; break;
+        case OP_ORI: result = a | imm; break;
+        case OP_ANDI: result = a & imm; break;
+        case OP_SLLI: result = a << imm; break;
+        case OP_SRLI: result = a >> imm; break;
+        case OP_SRAI: result = shift_right_arithmetic(a, imm); break;
+        case OP_LB: result = sign_extend(ref_load(r, a + imm, 1), 8); break;
+        case OP_LH: result = sign_extend(ref_load(r, a + imm, 2), 16); break;
+        case OP_LW: result = ref_load(r, a + imm, 4); break;
+        case OP_LBU: result = ref_load(r, a + imm, 1); break;
+        case OP_LHU: result = ref_load(r, a + imm, 2); break;
+        case OP_SB: ref_store(r, a + imm, 1, b); break;
+        case OP_SH: ref_store(r, a + imm, 2, b); break;
+        case OP_SW: ref_store(r, a + imm, 4, b); break;
+        case OP_BEQ: next_pc = a == b ? pc + imm : next_pc; break;
+        case OP_BNE: next_pc = a != b ? pc + imm : next_pc; break;
+        case OP_BLT: next_pc = less_than(a, b) ? pc + imm : next_pc; break;
+        case OP_BGE: next_pc = !less_than(a, b) ? pc + imm : next_pc; break;
+        case OP_BLTU: next_pc = a < b ? pc + imm : next_pc; break;
+        case OP_BGEU: next_pc = a >= b ? pc + imm : next_pc; break;
+        case OP_LUI: result = imm; break;
+        case OP_AUIPC: result = pc + imm; break;
+        case OP_JAL:
+            result = pc + 4;
+            next_pc = pc + imm;
+            break;
+        case OP_JALR:
+            result = pc + 4;
+            next_pc = (a + imm) & ~1u;
+            break;
+        case OP_ECALL: return;
+        default: break;
+        }
+        // the formats without rd have it 0
+        if (op->rd != 0)
+            r->x[op->rd] = result;
+        pc = next_pc;
+    }
+}
+
+static void print_program(FILE *report, struct program *p)
+{
+    for (int i = 0; i < p->num_ops; ++i)
+    {
+        char disassembled[64];
+        disassemble(CODE + 4 * i, p->code[i], disassembled, sizeof(disassembled), NULL);
+        fprintf(report, "  %08x : %08x  %s\n", CODE + 4 * i, p->code[i], disassembled);
+    }
+}
+
+// the first difference in a program is preceded by which one it is
+static void difference(FILE *report, int *differences, unsigned long number)
+{
+    if ((*differences)++ == 0)
+        fprintf(report, "Program %lu differs:\n", number);
+}
+
+// Runs the program with simulate() in mem and compares it with the
+// reference, returns the number of differences
+static int check(struct program *p, unsigned long number, struct memory *mem, struct syscalls *syscalls,
+                 long int *insns, FILE *report)
+{
+    memory_wr_bytes(mem, CODE, p->code, 4 * p->num_ops);
+    memory_wr_bytes(mem, SANDBOX_LOW, p->sandbox, SANDBOX_SIZE);
+    struct sim_options options = {0};
+    struct Stat stats = simulate(mem, syscalls, CODE, &options);
+    struct reference r;
+    reference_run(p, &r);
+    *insns += r.insns;
+
+    int differences = 0;
+    if (stats.stop != STOP_EXIT || stats.insns != r.insns)
+    {
+        difference(report, &differences, number);
+        fprintf(report, "  stopped: %s after %ld instructions, the reference exits after %ld\n",
+                stop_name(stats.stop), stats.insns, r.insns);
+    }
+    for (int reg = 1; reg < 32; ++reg)
+    {
+        uint32_t value = memory_rd_w(mem, RESULTS + 4 * reg), expected = ref_load(&r, RESULTS + 4 * reg, 4);
+        if (value != expected)
+        {
+            difference(report, &differences, number);
+            fprintf(report, "  x%d: %x, the reference has %x\n", reg, value, expected);
+        }
+    }
+    for (int i = 0; i < SANDBOX_SIZE; i += 4)
+    {
+        uint32_t value = memory_rd_w(mem, SANDBOX_LOW + i), expected = ref_load(&r, SANDBOX_LOW + i, 4);
+        if (value != expected)
+        {
+            difference(report, &differences, number);
+            fprintf(report, "  M[%x]: %x, the reference has %x\n", SANDBOX_LOW + i, value, expected);
+        }
+    }
+    return differences;
+}
+
+// Harts on their own threads incrementing bytes and halfwords next to each
+// other's, each in its own lane of the same words. A store that writes back
+// the whole word undoes the other harts' stores now and then
+#define HART_ROUNDS 1000
+#define HART_WORDS 1024
+#define HART_BYTES 0x20000
+#define HART_HALFWORDS 0x30000
+static const uint32_t harts_code[] = {
+    0x000205b7, // lui a1, 0x20
+    0x00a585b3, // add a1, a1, a0 (this hart's byte)
+    0x00030637, // lui a2, 0x30
+    0x00151293, // slli t0, a0, 1
+    0x00560633, // add a2, a2, t0 (this hart's halfword)
+    0x3e800493, // li s1, HART_ROUNDS
+    0x00058313, // round: mv t1, a1
+    0x00060393, // mv t2, a2
+    0x40000e13, // li t3, HART_WORDS
+    0x00034283, // word: lbu t0, 0(t1)
+    0x00128293, // addi t0, t0, 1
+    0x00530023, // sb t0, 0(t1)
+    0x0003d283, // lhu t0, 0(t2)
+    0x00128293, // addi t0, t0, 1
+    0x00539023, // sh t0, 0(t2)
+    0x00430313, // addi t1, t1, 4
+    0x00838393, // addi t2, t2, 8
+    0xfffe0e13, // addi t3, t3, -1
+    0xfc0e1ee3, // bnez t3, word
+    0xfff48493, // addi s1, s1, -1
+    0xfc0494e3, // bnez s1, round
+    0x00100073, // ebreak, this hart stops
+};
+
+// returns the number of bytes and halfwords with increments missing
+static int check_harts(struct syscalls *syscalls, FILE *report)
+{
+    struct memory *mem = memory_create();
+    memory_wr_bytes(mem, CODE, harts_code, sizeof(harts_code));
+    struct sim_options options = {.harts = 4};
+    simulate(mem, syscalls, CODE, &options);
+    int lost = 0;
+    for (int i = 0; i < 4 * HART_WORDS; ++i)
+        lost += memory_rd_b(mem, HART_BYTES + i) != (HART_ROUNDS & 0xff);
+    for (int i = 0; i < 2 * HART_WORDS; ++i)
+        lost += memory_rd_h(mem, HART_HALFWORDS + 2 * i) != HART_ROUNDS;
+    if (lost)
+        fprintf(report, "Byte and halfword stores of 4 harts: %d of %d locations lost increments\n", lost,
+                6 * HART_WORDS);
+    memory_delete(mem);
+    return lost;
+}
+
+int fuzz_run(long int programs, unsigned long seed, FILE *report)
+{
+    struct memory *mem = memory_create();
+    struct console *console = console_create(0, 1);
+    struct syscalls *syscalls = syscalls_create(console, RESULTS + 0x10000);
+    struct program *p = malloc(sizeof(struct program));
+    long int insns = 0, failed = check_harts(syscalls, report) != 0;
+    struct timespec before, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    for (long int i = 0; i < programs; ++i)
+    {
+        uint64_t rng = (seed + i) * 0x9e3779b97f4a7c15ull + 1;
+        generate(p, &rng);
+        if (check(p, seed + i, mem, syscalls, &insns, report))
+        {
+            print_program(report, p);
+            failed++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    double seconds = (after.tv_sec - before.tv_sec) + (after.tv_nsec - before.tv_nsec) / 1e9;
+    fprintf(report, "Fuzzed %ld programs from seed %lu, %ld instructions (%.1f million per second), %ld differ\n",
+            programs, seed, insns, insns / seconds / 1e6, failed);
+    free(p);
+    syscalls_delete(syscalls);
+    console_delete(console);
+    memory_delete(mem);
+    return failed != 0;
+}
@@ -0,0 +1,28 @@
+#ifndef __FUZZ_H__
+#define __FUZZ_H__
+
+#include <stdio.h>
+
+// Fuzzer for the execution engine. Generates random RV32IM programs, runs
+// each with simulate() and again on a slow reference interpreter of its
+// own, and compares the registers, the memory and the instruction count.
+// The reference works on the generated instructions, not on their encoding,
+// so it shares nothing with the decoder or the engine.
+//
+// A program sets all registers to random values, picked often from corner
+// cases like 0, -1 and INT_MIN, and runs a random body of ALU, M extension,
+// load, store, branch and jump instructions a number of times in a loop.
+// Branches and jumps in the body only go forward. Loads and stores are
+// relative to gp, which points at a sandbox of random data that nothing
+// else writes to. The program then stores the registers and exits.
+//
+// Before the programs, four harts on their own threads store to neighbouring
+// bytes and halfwords of the same words, and none of the stores may be lost.
+
+// Runs programs programs, the first one from seed, the next from seed + 1
+// and so on, so "sim -F 1 seed" runs a failing program again. Differences
+// are reported to report with a listing of the program. Returns 0 if there
+// were none
+int fuzz_run(long int programs, unsigned long seed, FILE *report);
+
+#endif
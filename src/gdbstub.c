@@ -0,0 +1,458 @@
+#include "gdbstub.h"
+#include "csr.h"
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define PACKET_SIZE 0x4000
+#define NUM_REGS 33 // x0..x31 and pc, what the 'g' packet holds
+
+// instructions between looking for a Ctrl-C from gdb while continuing
+#define RUN_CHUNK 0x100000
+
+// gdb's signal numbers in stop replies
+#define SIG_INT 2
+#define SIG_ILL 4
+#define SIG_TRAP 5
+#define SIG_BUS 10
+#define SIG_SEGV 11
+#define SIG_XCPU 24
+
+struct gdb
+{
+    int fd;
+    int no_ack;
+    char in[PACKET_SIZE];
+    int in_len, in_pos;
+    struct machine *m;
+    struct console *console;
+    int hart; // whose registers gdb sees
+};
+
+// next byte from gdb, -1 when it has gone
+static int get_byte(struct gdb *gdb)
+{
+    if (gdb->in_pos == gdb->in_len)
+    {
+        int n = read(gdb->fd, gdb->in, sizeof(gdb->in));
+        if (n <= 0)
+            return -1;
+        gdb->in_len = n;
+        gdb->in_pos = 0;
+    }
+    return (unsigned char)gdb->in[gdb->in_pos++];
+}
+
+// has gdb sent a Ctrl-C? Only looks at what has arrived
+static int interrupted(struct gdb *gdb)
+{
+    if (gdb->in_pos == gdb->in_len)
+    {
+        struct pollfd pfd = {gdb->fd, POLLIN, 0};
+        if (poll(&pfd, 1, 0) <= 0)
+            return 0;
+    }
+    int c = get_byte(gdb);
+    return c == 0x03 || c == -1;
+}
+
+static int hex_value(int c)
+{
+    return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+}
+
+// Reads the next packet into buf without the framing, acknowledging it.
+// Returns its length, -1 when gdb has gone.
+static int read_packet(struct gdb *gdb, char *buf)
+{
+    for (;;)
+    {
+        int c;
+        do
+        {
+            c = get_byte(gdb);
+            if (c < 0)
+                return -1;
+        } while (c != '$'); // acks, and Ctrl-C while stopped
+        int len = 0, sum = 0;
+        while ((c = get_byte(gdb)) != '#')
+        {
+            if (c < 0)
+                return -1;
+            if (len < PACKET_SIZE - 1)
+                buf[len++] = c;
+            sum += c;
+        }
+        int high = get_byte(gdb), low = get_byte(gdb);
+        buf[len] = 0;
+        if (gdb->no_ack)
+            return len;
+        if (hex_value(high) * 16 + hex_value(low) == (sum & 0xff))
+        {
+            if (write(gdb->fd, "+", 1) < 0)
+                return -1;
+            return len;
+        }
+        if (write(gdb->fd, "-", 1) < 0)
+            return -1;
+    }
+}
+
+static void send_packet(struct gdb *gdb, const char *data)
+{
+    static char packet[PACKET_SIZE + 4];
+    size_t len = strnlen(data, PACKET_SIZE);
+    int sum = 0;
+    packet[0] = '$';
+    for (size_t i = 0; i < len; ++i)
+        sum += (unsigned char)data[i];
+    memcpy(packet + 1, data, len);
+    snprintf(packet + 1 + len, 4, "#%02x", sum & 0xff);
+    int size = len + 4, sent = 0;
+    while (sent < size)
+    {
+        int n = write(gdb->fd, packet + sent, size - sent);
+        if (n <= 0)
+            return;
+        sent += n;
+    }
+}
+
+// registers are sent as little endian bytes in hex
+static void put_word(char *out, unsigned int value)
+{
+    for (int i = 0; i < 4; ++i)
+        sprintf(out + 2 * i, "%02x", (value >> (8 * i)) & 0xff);
+}
+
+static unsigned int get_word(const char *in)
+{
+    unsigned int value = 0;
+    for (int i = 0; i < 4; ++i)
+        value |= (unsigned)(hex_value(in[2 * i]) * 16 + hex_value(in[2 * i + 1])) << (8 * i);
+    return value;
+}
+
+static unsigned int read_reg(struct gdb *gdb, int reg)
+{
+    return reg == 32 ? *machine_pc(gdb->m, gdb->hart) : machine_registers(gdb->m, gdb->hart)[reg];
+}
+
+static void write_reg(struct gdb *gdb, int reg, unsigned int value)
+{
+    if (reg == 32)
+        *machine_pc(gdb->m, gdb->hart) = value;
+    else if (reg > 0)
+        machine_registers(gdb->m, gdb->hart)[reg] = value;
+}
+
+static int fault_signal(int cause)
+{
+    switch (cause)
+    {
+    case CAUSE_ILLEGAL_INSTRUCTION: return SIG_ILL;
+    case CAUSE_MISALIGNED_FETCH:
+    case CAUSE_MISALIGNED_LOAD:
+    case CAUSE_MISALIGNED_STORE: return SIG_BUS;
+    default: return SIG_SEGV;
+    }
+}
+
+// The reply to '?', and to continue and step once the machine stops. After
+// a fault gdb gets to look at the state first, the program is gone when it
+// tries to go on (final).
+static void report_stop(struct gdb *gdb, int signal, int final)
+{
+    struct Stat stats = machine_stats(gdb->m);
+    char reply[64];
+    gdb->hart = stats.stop_hart;
+    console_flush(gdb->console);
+    switch (stats.stop)
+    {
+    case STOP_EXIT: sprintf(reply, "W%02x", stats.exit_code & 0xff); break;
+    case STOP_FAULT: sprintf(reply, final ? "X%02x" : "T%02x", fault_signal(stats.fatal_cause)); break;
+    case STOP_WATCHPOINT: sprintf(reply, "T%02xwatch:%x;", SIG_TRAP, stats.watch_addr); break;
+    case STOP_BREAKPOINT: sprintf(reply, final ? "X%02x" : "T%02xswbreak:;", SIG_TRAP); break;
+    case STOP_BUDGET:
+    case STOP_TIMEOUT: sprintf(reply, "X%02x", SIG_XCPU); break;
+    default: sprintf(reply, "T%02x", signal); break;
+    }
+    send_packet(gdb, reply);
+}
+
+// runs on the normal engine, a chunk at a time to notice a Ctrl-C
+static void resume(struct gdb *gdb, int step)
+{
+    struct machine *m = gdb->m;
+    int signal = SIG_TRAP;
+    if (step)
+        machine_run(m, 1);
+    else
+    {
+        while (machine_running(m))
+        {
+            machine_run(m, RUN_CHUNK);
+            if (machine_stats(m).stop != STOP_NONE)
+                break;
+            if (interrupted(gdb))
+            {
+                signal = SIG_INT;
+                break;
+            }
+        }
+    }
+    report_stop(gdb, signal, 0);
+}
+
+// Z and z packets: type,addr,kind
+static void breakpoint_packet(struct gdb *gdb, const char *packet)
+{
+    unsigned int type, addr, kind;
+    if (sscanf(packet + 1, "%x,%x,%x", &type, &addr, &kind) != 3)
+    {
+        send_packet(gdb, "E01");
+        return;
+    }
+    int insert = packet[0] == 'Z';
+    if (type == 0 || type == 1)
+    {
+        if (insert)
+            machine_add_breakpoint(gdb->m, addr);
+        else
+            machine_remove_breakpoint(gdb->m, addr);
+    }
+    else if (type == 2)
+    {
+        if (insert)
+            machine_add_watchpoint(gdb->m, addr, kind);
+        else
+            machine_remove_watchpoint(gdb->m, addr, kind);
+    }
+    else
+    {
+        send_packet(gdb, ""); // read and access watchpoints
+        return;
+    }
+    send_packet(gdb, "OK");
+}
+
+static void read_memory(struct gdb *gdb, const char *packet)
+{
+    unsigned int addr, len;
+    static unsigned char data[PACKET_SIZE / 2];
+    static char reply[PACKET_SIZE];
+    if (sscanf(packet + 1, "%x,%x", &addr, &len) != 2)
+    {
+        send_packet(gdb, "E01");
+        return;
+    }
+    if (len > sizeof(data) - 1)
+        len = sizeof(data) - 1;
+    // RAM only, a device read could change the device (like taking a byte of
+    // input from the UART). Pages are read as they are, never allocated
+    unsigned int done = 0;
+    while (done < len)
+    {
+        int room;
+        const void *page = memory_page_read_ptr(machine_memory(gdb->m), addr + done, &room);
+        if (page == NULL)
+            break;
+        unsigned int chunk = (unsigned)room < len - done ? (unsigned)room : len - done;
+        memcpy(data + done, page, chunk);
+        done += chunk;
+    }
+    if (done == 0 && len > 0)
+    {
+        send_packet(gdb, "E01");
+        return;
+    }
+    len = done; // gdb takes a shorter reply for the part that can be read
+    for (unsigned int i = 0; i < len; ++i)
+        sprintf(reply + 2 * i, "%02x", data[i]);
+    reply[2 * len] = 0;
+    send_packet(gdb, reply);
+}
+
+static void write_memory(struct gdb *gdb, const char *packet)
+{
+    unsigned int addr, len;
+    static unsigned char data[PACKET_SIZE / 2];
+    const char *hex = strchr(packet, ':');
+    if (sscanf(packet + 1, "%x,%x", &addr, &len) != 2 || hex == NULL || strlen(hex + 1) < 2 * len ||
+        len > sizeof(data))
+    {
+        send_packet(gdb, "E01");
+        return;
+    }
+    for (unsigned int i = 0; i < len; ++i)
+        data[i] = hex_value(hex[1 + 2 * i]) * 16 + hex_value(hex[2 + 2 * i]);
+    machine_write_memory(gdb->m, addr, data, len);
+    send_packet(gdb, "OK");
+}
+
+static void query(struct gdb *gdb, const char *packet)
+{
+    if (!strncmp(packet, "qSupported", 10))
+    {
+        char reply[64];
+        sprintf(reply, "PacketSize=%x;swbreak+;hwbreak+;QStartNoAckMode+", PACKET_SIZE);
+        send_packet(gdb, reply);
+    }
+    else if (!strcmp(packet, "QStartNoAckMode"))
+    {
+        send_packet(gdb, "OK");
+        gdb->no_ack = 1;
+    }
+    else if (!strcmp(packet, "qAttached"))
+        send_packet(gdb, "1");
+    else if (!strcmp(packet, "qC"))
+        send_packet(gdb, "QC1");
+    else if (!strcmp(packet, "qfThreadInfo"))
+        send_packet(gdb, "m1");
+    else if (!strcmp(packet, "qsThreadInfo"))
+        send_packet(gdb, "l");
+    else
+        send_packet(gdb, "");
+}
+
+// serves one connection, returns 1 if gdb detached
+static int serve(struct gdb *gdb)
+{
+    static char packet[PACKET_SIZE];
+    static char reply[PACKET_SIZE];
+    for (;;)
+    {
+        if (read_packet(gdb, packet) < 0)
+            return 0;
+        unsigned int reg, value;
+        switch (packet[0])
+        {
+        case '?': report_stop(gdb, SIG_TRAP, 0); break;
+        case 'g':
+            for (int i = 0; i < NUM_REGS; ++i)
+                put_word(reply + 8 * i, read_reg(gdb, i));
+            send_packet(gdb, reply);
+            break;
+        case 'G':
+            if (strlen(packet + 1) < 8 * NUM_REGS)
+            {
+                send_packet(gdb, "E01");
+                break;
+            }
+            for (int i = 0; i < NUM_REGS; ++i)
+                write_reg(gdb, i, get_word(packet + 1 + 8 * i));
+            send_packet(gdb, "OK");
+            break;
+        case 'p':
+            reg = strtoul(packet + 1, NULL, 16);
+            if (reg < NUM_REGS)
+                put_word(reply, read_reg(gdb, reg));
+            else
+                strcpy(reply, "xxxxxxxx"); // FP registers and CSRs are not shown
+            send_packet(gdb, reply);
+            break;
+        case 'P':
+            if (sscanf(packet + 1, "%x=", &reg) != 1 || strchr(packet, '=') == NULL)
+            {
+                send_packet(gdb, "E01");
+                break;
+            }
+            value = get_word(strchr(packet, '=') + 1);
+            if (reg < NUM_REGS)
+                write_reg(gdb, reg, value);
+            send_packet(gdb, "OK");
+            break;
+        case 'm': read_memory(gdb, packet); break;
+        case 'M': write_memory(gdb, packet); break;
+        case 'c':
+        case 's':
+            if (packet[1])
+                write_reg(gdb, 32, strtoul(packet + 1, NULL, 16));
+            if (machine_running(gdb->m))
+                resume(gdb, packet[0] == 's');
+            else
+                report_stop(gdb, SIG_TRAP, 1);
+            break;
+        case 'Z':
+        case 'z': breakpoint_packet(gdb, packet); break;
+        case 'H': send_packet(gdb, "OK"); break;
+        case 'T': send_packet(gdb, "OK"); break;
+        case 'q':
+        case 'Q': query(gdb, packet); break;
+        case 'D': send_packet(gdb, "OK"); return 1;
+        case 'k': return 0;
+        default: send_packet(gdb, ""); break;
+        }
+    }
+}
+
+// the connection from gdb, -1 if there is none
+static int wait_for_gdb(const char *address)
+{
+    char *end;
+    long port = strtol(address, &end, 10);
+    int listen_fd;
+    if (*end == 0)
+    {
+        struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port),
+                                   .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror(address);
+            return -1;
+        }
+    }
+    else
+    {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        if (strlen(address) >= sizeof(addr.sun_path))
+        {
+            fprintf(stderr, "Socket name too long: %s\n", address);
+            return -1;
+        }
+        strcpy(addr.sun_path, address);
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(address);
+        if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror(address);
+            return -1;
+        }
+    }
+    if (listen(listen_fd, 1) < 0)
+    {
+        perror(address);
+        close(listen_fd);
+        return -1;
+    }
+    fprintf(stderr, "Waiting for gdb on %s\n", address);
+    int fd = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    if (*end != 0)
+        unlink(address);
+    return fd;
+}
+
+int gdb_serve(struct machine *m, struct console *console, const char *address)
+{
+    struct gdb gdb = {0};
+    gdb.fd = wait_for_gdb(address);
+    if (gdb.fd < 0)
+        return 1;
+    gdb.m = m;
+    gdb.console = console;
+    int detached = serve(&gdb);
+    close(gdb.fd);
+    // breakpoints left in place just pause the run
+    while (detached && machine_running(m))
+        machine_run(m, 0);
+    return 0;
+}
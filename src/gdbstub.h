@@ -0,0 +1,20 @@
+#ifndef __GDBSTUB_H__
+#define __GDBSTUB_H__
+
+#include "simulate.h"
+#include "console.h"
+
+// A GDB remote serial protocol stub, so riscv32 gdb can debug the simulated
+// program: "target remote :1234" or "target remote /path/to/socket". It
+// reads and writes registers and memory, sets breakpoints (Z0/Z1) and write
+// watchpoints (Z2), steps, and continues on the normal engine until a
+// breakpoint, watchpoint, exit, fault or Ctrl-C. With several harts, the
+// registers are those of the hart that stopped last.
+
+// address is a TCP port on localhost, or the name of a Unix domain socket.
+// Waits for gdb to connect and serves it until it detaches or kills the
+// program; after a detach the program runs on to the end. Returns 0, or 1
+// if there is no connection.
+int gdb_serve(struct machine *m, struct console *console, const char *address);
+
+#endif
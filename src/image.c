@@ -0,0 +1,52 @@
+#include "image.h"
+#include "console.h"
+#include "syscall.h"
+#include "uart.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct program_image *image_load(const char *file_name, FILE *log_file)
+{
+    struct program_image *image = malloc(sizeof(struct program_image));
+    image->mem = memory_create();
+    if (read_elf(image->mem, &image->info, file_name, log_file) ||
+        (image->symbols = symbols_read_from_elf(file_name)) == NULL)
+    {
+        memory_delete(image->mem);
+        free(image);
+        return NULL;
+    }
+    image->file_name = strdup(file_name);
+    return image;
+}
+
+void image_delete(struct program_image *image)
+{
+    symbols_delete(image->symbols);
+    memory_delete(image->mem);
+    free(image->file_name);
+    free(image);
+}
+
+struct memory *image_instantiate(struct program_image *image)
+{
+    return memory_clone(image->mem);
+}
+
+struct Stat image_run(struct program_image *image, int num_args, char *args[], int in_fd, int out_fd,
+                      long int max_insns, double max_seconds)
+{
+    struct memory *mem = image_instantiate(image);
+    write_program_args(mem, num_args, args);
+    struct console *console = console_create(in_fd, out_fd);
+    struct uart *uart = uart_create(console);
+    memory_map_device(mem, UART_BASE, UART_SIZE, uart, uart_read, uart_write);
+    struct syscalls *syscalls = syscalls_create(console, image->info.data_end);
+    struct sim_options options = {.max_insns = max_insns, .max_seconds = max_seconds, .symbols = image->symbols};
+    struct Stat stats = simulate(mem, syscalls, image->info.start, &options);
+    syscalls_delete(syscalls);
+    uart_delete(uart);
+    console_delete(console);
+    memory_delete(mem);
+    return stats;
+}
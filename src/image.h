@@ -0,0 +1,35 @@
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include "memory.h"
+#include "read_elf.h"
+#include "simulate.h"
+#include <stdio.h>
+
+// An ELF file loaded once. Its memory is never written; each run of the
+// program gets a memory that shares the image's pages until it writes to
+// them, so starting a run costs a copy of the page table.
+struct program_image
+{
+    char *file_name;
+    struct memory *mem;
+    struct program_info info;
+    struct symbols *symbols;
+};
+
+// NULL if the file can't be loaded, errors are reported to log_file
+struct program_image *image_load(const char *file_name, FILE *log_file);
+
+// only when every memory made from it has been deleted
+void image_delete(struct program_image *image);
+
+// memory for a new run of the program
+struct memory *image_instantiate(struct program_image *image);
+
+// Runs the program on one hart with its console reading in_fd and writing
+// out_fd. args[0] is skipped like the "--" on the command line. max_insns
+// and max_seconds 0 mean no limit.
+struct Stat image_run(struct program_image *image, int num_args, char *args[], int in_fd, int out_fd,
+                      long int max_insns, double max_seconds);
+
+#endif
@@ -0,0 +1,168 @@
+#include "libsim.h"
+#include "image.h"
+#include "console.h"
+#include "simulate.h"
+#include "syscall.h"
+#include "uart.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+struct sim_ctx
+{
+    struct program_image *own_image; // loaded by sim_create, NULL if shared
+    struct memory *mem;
+    struct console *console;
+    struct uart *uart;
+    struct syscalls *syscalls;
+    struct machine *machine;
+    sim_syscall_hook hook;
+    void *hook_arg;
+};
+
+struct sim_ctx *sim_create(const char *elf_file, int num_args, char *args[], int in_fd, int out_fd)
+{
+    struct program_image *image = image_load(elf_file, stderr);
+    if (image == NULL)
+        return NULL;
+    struct sim_ctx *ctx = sim_create_from_image(image, num_args, args, in_fd, out_fd);
+    ctx->own_image = image;
+    return ctx;
+}
+
+struct sim_ctx *sim_create_from_image(struct program_image *image, int num_args, char *args[], int in_fd, int out_fd)
+{
+    struct sim_ctx *ctx = calloc(1, sizeof(struct sim_ctx));
+    ctx->mem = image_instantiate(image);
+    write_program_args(ctx->mem, num_args, args);
+    ctx->console = console_create(in_fd, out_fd);
+    ctx->uart = uart_create(ctx->console);
+    memory_map_device(ctx->mem, UART_BASE, UART_SIZE, ctx->uart, uart_read, uart_write);
+    ctx->syscalls = syscalls_create(ctx->console, image->info.data_end);
+    struct sim_options options = {.deterministic = 1, .symbols = image->symbols};
+    ctx->machine = machine_create(ctx->mem, ctx->syscalls, image->info.start, &options);
+    return ctx;
+}
+
+void sim_delete(struct sim_ctx *ctx)
+{
+    machine_delete(ctx->machine);
+    syscalls_delete(ctx->syscalls);
+    uart_delete(ctx->uart);
+    console_delete(ctx->console);
+    memory_delete(ctx->mem);
+    if (ctx->own_image)
+        image_delete(ctx->own_image);
+    free(ctx);
+}
+
+enum sim_event sim_step(struct sim_ctx *ctx, long int insns)
+{
+    if (machine_running(ctx->machine))
+        machine_run(ctx->machine, insns);
+    // the caller may look at the output before the program is done
+    console_flush(ctx->console);
+    switch (machine_stats(ctx->machine).stop)
+    {
+    case STOP_NONE: return SIM_STEPS;
+    case STOP_EXIT: return SIM_EXIT;
+    case STOP_FAULT: return SIM_FAULT;
+    case STOP_WATCHPOINT: return SIM_WATCHPOINT;
+    default: return SIM_BREAKPOINT;
+    }
+}
+
+enum sim_event sim_run(struct sim_ctx *ctx)
+{
+    return sim_step(ctx, 0);
+}
+
+unsigned int sim_read_reg(struct sim_ctx *ctx, int reg)
+{
+    if (reg == SIM_REG_PC)
+        return *machine_pc(ctx->machine, 0);
+    return machine_registers(ctx->machine, 0)[reg & 31];
+}
+
+void sim_write_reg(struct sim_ctx *ctx, int reg, unsigned int value)
+{
+    if (reg == SIM_REG_PC)
+        *machine_pc(ctx->machine, 0) = value;
+    else if (reg > 0 && reg < 32)
+        machine_registers(ctx->machine, 0)[reg] = value;
+}
+
+void sim_read_memory(struct sim_ctx *ctx, unsigned int addr, void *buf, int len)
+{
+    memory_rd_bytes(ctx->mem, addr, buf, len);
+}
+
+void sim_write_memory(struct sim_ctx *ctx, unsigned int addr, const void *buf, int len)
+{
+    machine_write_memory(ctx->machine, addr, buf, len);
+}
+
+long int sim_insns(struct sim_ctx *ctx)
+{
+    return machine_stats(ctx->machine).insns;
+}
+
+int sim_exit_code(struct sim_ctx *ctx)
+{
+    return machine_stats(ctx->machine).exit_code;
+}
+
+int sim_fault(struct sim_ctx *ctx, unsigned int *pc, unsigned int *tval)
+{
+    struct Stat stats = machine_stats(ctx->machine);
+    if (pc)
+        *pc = stats.fatal_pc;
+    if (tval)
+        *tval = stats.fatal_tval;
+    return stats.fatal_cause;
+}
+
+void sim_add_breakpoint(struct sim_ctx *ctx, unsigned int addr)
+{
+    machine_add_breakpoint(ctx->machine, addr);
+}
+
+int sim_remove_breakpoint(struct sim_ctx *ctx, unsigned int addr)
+{
+    return machine_remove_breakpoint(ctx->machine, addr);
+}
+
+void sim_add_watchpoint(struct sim_ctx *ctx, unsigned int addr, unsigned int len)
+{
+    machine_add_watchpoint(ctx->machine, addr, len);
+}
+
+int sim_remove_watchpoint(struct sim_ctx *ctx, unsigned int addr, unsigned int len)
+{
+    return machine_remove_watchpoint(ctx->machine, addr, len);
+}
+
+unsigned int sim_watch_addr(struct sim_ctx *ctx)
+{
+    return machine_stats(ctx->machine).watch_addr;
+}
+
+static int call_hook(void *arg, struct memory *mem, int *registers)
+{
+    (void)mem;
+    (void)registers;
+    struct sim_ctx *ctx = arg;
+    return ctx->hook(ctx->hook_arg, ctx);
+}
+
+void sim_set_syscall_hook(struct sim_ctx *ctx, sim_syscall_hook hook, void *arg)
+{
+    ctx->hook = hook;
+    ctx->hook_arg = arg;
+    machine_set_syscall_hook(ctx->machine, hook ? call_hook : NULL, ctx);
+}
+
+int sim_map_device(struct sim_ctx *ctx, unsigned int base, unsigned int size, void *dev, device_read_fn read,
+                   device_write_fn write)
+{
+    return memory_map_device(ctx->mem, base, size, dev, read, write);
+}
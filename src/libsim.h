@@ -0,0 +1,71 @@
+#ifndef __LIBSIM_H__
+#define __LIBSIM_H__
+
+#include "memory.h"
+
+// The simulator as a library, built by "make lib" as libsim.a and libsim.so.
+// A sim_ctx is one run of a program on one hart, with its console on given
+// file descriptors. The run is deterministic: the timer follows the
+// instruction count, so stepping the same program the same way gives the
+// same result every time.
+struct sim_ctx;
+struct program_image; // image.h
+
+// why sim_step or sim_run returned
+enum sim_event
+{
+    SIM_STEPS,      // ran the instructions asked for, the program can go on
+    SIM_EXIT,       // the program called exit, see sim_exit_code
+    SIM_FAULT,      // an exception without a trap handler, see sim_fault
+    SIM_BREAKPOINT, // a breakpoint, or EBREAK without a trap handler
+    SIM_WATCHPOINT  // after a write to a watched address, see sim_watch_addr
+};
+
+// args are the program's argv, sim puts "--" in argv[0]. NULL if the file
+// can't be loaded, the reason goes to stderr
+struct sim_ctx *sim_create(const char *elf_file, int num_args, char *args[], int in_fd, int out_fd);
+// the image can be shared by any number of contexts, and must be deleted
+// after them
+struct sim_ctx *sim_create_from_image(struct program_image *image, int num_args, char *args[], int in_fd, int out_fd);
+void sim_delete(struct sim_ctx *ctx);
+
+// run up to insns instructions, or until the program stops
+enum sim_event sim_step(struct sim_ctx *ctx, long int insns);
+enum sim_event sim_run(struct sim_ctx *ctx);
+
+// x0..x31, 32 is the pc. Writes to x0 are ignored
+#define SIM_REG_PC 32
+unsigned int sim_read_reg(struct sim_ctx *ctx, int reg);
+void sim_write_reg(struct sim_ctx *ctx, int reg, unsigned int value);
+
+// code can be written too, the decoded instructions are dropped
+void sim_read_memory(struct sim_ctx *ctx, unsigned int addr, void *buf, int len);
+void sim_write_memory(struct sim_ctx *ctx, unsigned int addr, const void *buf, int len);
+
+long int sim_insns(struct sim_ctx *ctx);
+int sim_exit_code(struct sim_ctx *ctx);
+// the exception cause after SIM_FAULT, -1 before, pc and tval may be NULL
+int sim_fault(struct sim_ctx *ctx, unsigned int *pc, unsigned int *tval);
+
+// Breakpoints stop before the instruction at addr, the next step runs it.
+// Watchpoints stop after a write to addr..addr+len-1. The remove functions
+// return 0 if there was no such point. Code without either runs at full speed.
+void sim_add_breakpoint(struct sim_ctx *ctx, unsigned int addr);
+int sim_remove_breakpoint(struct sim_ctx *ctx, unsigned int addr);
+void sim_add_watchpoint(struct sim_ctx *ctx, unsigned int addr, unsigned int len);
+int sim_remove_watchpoint(struct sim_ctx *ctx, unsigned int addr, unsigned int len);
+unsigned int sim_watch_addr(struct sim_ctx *ctx);
+
+// Hooks. A system call hook sees every ECALL before the simulator handles
+// it, with the call number in a7 (x17). It can read and write registers,
+// but not the pc, and memory, and returns -1 to leave the call to the
+// simulator, 0 to end the program or 1 to go on.
+typedef int (*sim_syscall_hook)(void *arg, struct sim_ctx *ctx);
+void sim_set_syscall_hook(struct sim_ctx *ctx, sim_syscall_hook hook, void *arg);
+
+// A device of the caller's in the address space, like the UART, see
+// memory_map_device. Returns 0 if the pages are taken.
+int sim_map_device(struct sim_ctx *ctx, unsigned int base, unsigned int size, void *dev, device_read_fn read,
+                   device_write_fn write);
+
+#endif
@@ -0,0 +1,252 @@
+#include "locality.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Reuse distances are computed with the classic tree based stack distance
+// algorithm: every line remembers the time of its last access, and a Fenwick
+// tree over time holds a 1 at the last access time of each line. The number
+// of distinct lines touched since the previous access to a line is then the
+// sum of the tree between the two times, which takes O(log n).
+
+#define NUM_BUCKETS 34 // 0, then one bucket per power of two
+
+struct line_entry
+{
+    uint32_t line;   // line number + 1, 0 marks an empty slot
+    uint32_t time;   // time of last access
+    uint32_t window; // last working set window the line was touched in
+};
+
+struct locality
+{
+    struct line_entry *table;
+    uint32_t table_size; // power of two
+    uint32_t num_lines;
+
+    int *tree; // Fenwick tree indexed by time, 1-based
+    uint32_t tree_size;
+    uint32_t now;
+
+    long int accesses;
+    long int cold;
+    long int reuse[NUM_BUCKETS];
+
+    uint32_t window;
+    uint32_t window_lines;
+    uint32_t *working_set;
+    size_t ws_len, ws_cap;
+
+    long int page_reads[0x10000];
+    long int page_writes[0x10000];
+};
+
+struct locality *locality_create()
+{
+    struct locality *loc = calloc(1, sizeof(struct locality));
+    loc->table_size = 1 << 16;
+    loc->table = calloc(loc->table_size, sizeof(struct line_entry));
+    loc->tree_size = 1 << 20;
+    loc->tree = calloc(loc->tree_size + 1, sizeof(int));
+    return loc;
+}
+
+void locality_delete(struct locality *loc)
+{
+    free(loc->table);
+    free(loc->tree);
+    free(loc->working_set);
+    free(loc);
+}
+
+static void tree_add(struct locality *loc, uint32_t pos, int delta)
+{
+    for (; pos <= loc->tree_size; pos += pos & -pos)
+        loc->tree[pos] += delta;
+}
+
+static long int tree_sum(struct locality *loc, uint32_t pos)
+{
+    long int sum = 0;
+    for (; pos > 0; pos -= pos & -pos)
+        sum += loc->tree[pos];
+    return sum;
+}
+
+static struct line_entry *lookup(struct locality *loc, uint32_t line)
+{
+    uint32_t mask = loc->table_size - 1;
+    uint32_t slot = (line * 2654435761u) & mask;
+    while (loc->table[slot].line && loc->table[slot].line != line + 1)
+        slot = (slot + 1) & mask;
+    return &loc->table[slot];
+}
+
+static void grow_table(struct locality *loc)
+{
+    struct line_entry *old = loc->table;
+    uint32_t old_size = loc->table_size;
+    loc->table_size *= 2;
+    loc->table = calloc(loc->table_size, sizeof(struct line_entry));
+    for (uint32_t i = 0; i < old_size; ++i)
+    {
+        if (old[i].line)
+            *lookup(loc, old[i].line - 1) = old[i];
+    }
+    free(old);
+}
+
+static int by_time(const void *a, const void *b)
+{
+    uint32_t ta = (*(struct line_entry *const *)a)->time;
+    uint32_t tb = (*(struct line_entry *const *)b)->time;
+    return (ta > tb) - (ta < tb);
+}
+
+// Time has run past the end of the tree. Only the last access of each line
+// matters, so renumber those 1..num_lines keeping their order and start over.
+static void compact(struct locality *loc)
+{
+    struct line_entry **live = malloc(loc->num_lines * sizeof(struct line_entry *));
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < loc->table_size; ++i)
+    {
+        if (loc->table[i].line)
+            live[n++] = &loc->table[i];
+    }
+    qsort(live, n, sizeof(struct line_entry *), by_time);
+    if (loc->tree_size < 2 * n)
+    {
+        loc->tree_size = 2 * n;
+        free(loc->tree);
+        loc->tree = malloc((loc->tree_size + 1) * sizeof(int));
+    }
+    memset(loc->tree, 0, (loc->tree_size + 1) * sizeof(int));
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        live[i]->time = i + 1;
+        tree_add(loc, i + 1, 1);
+    }
+    loc->now = n;
+    free(live);
+}
+
+static int bucket(long int distance)
+{
+    int b = 0;
+    while (distance)
+    {
+        distance >>= 1;
+        b++;
+    }
+    return b;
+}
+
+void locality_access(struct locality *loc, unsigned int addr, int is_write)
+{
+    if (is_write)
+        loc->page_writes[addr >> 16]++;
+    else
+        loc->page_reads[addr >> 16]++;
+
+    if (loc->now == loc->tree_size)
+        compact(loc);
+    uint32_t now = ++loc->now;
+    uint32_t line = addr >> LOCALITY_LINE_BITS;
+
+    struct line_entry *entry = lookup(loc, line);
+    if (entry->line)
+    {
+        long int distance = tree_sum(loc, now - 1) - tree_sum(loc, entry->time);
+        loc->reuse[bucket(distance)]++;
+        tree_add(loc, entry->time, -1);
+    }
+    else
+    {
+        loc->cold++;
+        entry->line = line + 1;
+        entry->window = loc->window - 1;
+        loc->num_lines++;
+    }
+    entry->time = now;
+    tree_add(loc, now, 1);
+
+    if (entry->window != loc->window)
+    {
+        entry->window = loc->window;
+        loc->window_lines++;
+    }
+    if (++loc->accesses % LOCALITY_WINDOW == 0)
+    {
+        if (loc->ws_len == loc->ws_cap)
+        {
+            loc->ws_cap = loc->ws_cap ? 2 * loc->ws_cap : 1024;
+            loc->working_set = realloc(loc->working_set, loc->ws_cap * sizeof(uint32_t));
+        }
+        loc->working_set[loc->ws_len++] = loc->window_lines;
+        loc->window++;
+        loc->window_lines = 0;
+    }
+
+    if (2 * loc->num_lines > loc->table_size)
+        grow_table(loc);
+}
+
+void locality_report(struct locality *loc, FILE *out)
+{
+    double total = loc->accesses ? loc->accesses : 1;
+    fprintf(out, "Data accesses: %ld, distinct %d byte lines: %u (%u KiB footprint)\n",
+            loc->accesses, LOCALITY_LINE_SIZE, loc->num_lines,
+            (unsigned)((loc->num_lines * (long)LOCALITY_LINE_SIZE) >> 10));
+
+    fprintf(out, "\nWorking set per %d accesses (lines, KiB):\n", LOCALITY_WINDOW);
+    for (size_t i = 0; i < loc->ws_len; ++i)
+        fprintf(out, "  %8zu %8u %8u\n", i, loc->working_set[i],
+                (unsigned)((loc->working_set[i] * (long)LOCALITY_LINE_SIZE) >> 10));
+
+    fprintf(out, "\nReuse distance (distinct lines between accesses to the same line):\n");
+    fprintf(out, "  cold         %12ld  %6.2f%%\n", loc->cold, 100.0 * loc->cold / total);
+    for (int b = 0; b < NUM_BUCKETS; ++b)
+    {
+        if (!loc->reuse[b])
+            continue;
+        if (b == 0)
+            fprintf(out, "  0            %12ld  %6.2f%%\n", loc->reuse[b], 100.0 * loc->reuse[b] / total);
+        else
+            fprintf(out, "  %-5ld-%6ld %12ld  %6.2f%%\n", 1L << (b - 1), (1L << b) - 1,
+                    loc->reuse[b], 100.0 * loc->reuse[b] / total);
+    }
+
+    // a fully associative LRU cache of 2^k lines hits exactly the accesses
+    // with a reuse distance below 2^k
+    fprintf(out, "\nHit rate of a fully associative LRU cache:\n");
+    long int hits = 0;
+    for (int b = 0; b < NUM_BUCKETS - 1; ++b)
+    {
+        hits += loc->reuse[b];
+        long int bytes = (1L << b) * LOCALITY_LINE_SIZE;
+        if (bytes >= 1024)
+            fprintf(out, "  %8ld KiB  %6.2f%%\n", bytes >> 10, 100.0 * hits / total);
+        if (hits + loc->cold == loc->accesses)
+            break;
+    }
+
+    fprintf(out, "\nAccesses per 64 KiB page (reads, writes):\n");
+    long int max = 1;
+    for (int page = 0; page < 0x10000; ++page)
+    {
+        if (loc->page_reads[page] + loc->page_writes[page] > max)
+            max = loc->page_reads[page] + loc->page_writes[page];
+    }
+    for (int page = 0; page < 0x10000; ++page)
+    {
+        long int count = loc->page_reads[page] + loc->page_writes[page];
+        if (!count)
+            continue;
+        char bar[41];
+        int len = (int)(40 * count / max);
+        memset(bar, '#', len);
+        bar[len] = 0;
+        fprintf(out, "  %08x %12ld %12ld  %s\n", page << 16, loc->page_reads[page], loc->page_writes[page], bar);
+    }
+}
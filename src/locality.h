@@ -0,0 +1,26 @@
+#ifndef __LOCALITY_H__
+#define __LOCALITY_H__
+
+#include <stdio.h>
+
+// Analysis of the guest data accesses: working set over time, LRU stack
+// (reuse) distances and per page access counts. Distances are measured in
+// cache lines of LOCALITY_LINE_SIZE bytes.
+#define LOCALITY_LINE_BITS 6
+#define LOCALITY_LINE_SIZE (1 << LOCALITY_LINE_BITS)
+
+// Number of accesses per working set sample
+#define LOCALITY_WINDOW 65536
+
+struct locality;
+
+struct locality *locality_create();
+void locality_delete(struct locality *loc);
+
+// record one guest load or store
+void locality_access(struct locality *loc, unsigned int addr, int is_write);
+
+// print working set, reuse distance histogram, hit rates and page heatmap
+void locality_report(struct locality *loc, FILE *out);
+
+#endif
@@ -2,10 +2,23 @@
 #include "read_elf.h"
 #include "disassemble.h"
 #include "simulate.h"
+#include "locality.h"
+#include "uart.h"
+#include "blockdev.h"
+#include "clint.h"
+#include "csr.h"
+#include "batch.h"
+#include "server.h"
+#include "gdbstub.h"
+#include "cosim.h"
+#include "fuzz.h"
+#include "bench.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 void terminate(const char *error)
 {
@@ -16,9 +29,38 @@ void terminate(const char *error)
   printf("      sim riscv-elf -d         // disassemble text segment of riscv-elf file to stdout\n");
   printf("      sim riscv-elf -l log     // simulate and log each instruction to file 'log'\n");
   printf("      sim riscv-elf -s log     // simulate and log only summary to file 'log'\n");
+  printf("                               // (-l and -s include instruction mix and register statistics)\n");
+  printf("      sim riscv-elf -m file    // simulate and write memory locality analysis to 'file'\n");
+  printf("      sim riscv-elf -b disk    // attach host file 'disk' as a block device\n");
+  printf("      sim riscv-elf -o file    // write the program's console output to 'file'\n");
+  printf("      sim riscv-elf -n harts   // simulate 'harts' cores sharing memory (default 1)\n");
+  printf("                               // each on a host thread\n");
+  printf("      sim riscv-elf -i insns   // stop when a hart has run 'insns' instructions\n");
+  printf("      sim riscv-elf -t seconds // watchdog: stop after 'seconds' of host time\n");
+  printf("      sim riscv-elf -g port    // wait for gdb on localhost:port (or a Unix socket\n");
+  printf("                               // if not a number) and let it debug the program\n");
+  printf("      sim riscv-elf -r         // deterministic: harts take turns on one thread, the timer\n");
+  printf("                               // follows the instruction count so runs can be replayed\n");
+  printf("                               // options can be combined, e.g. -b disk -s log\n");
   printf("    prog-args: arguments to the simulated program\n");
   printf("               these arguments are provided through argv. Puts '--' in argv[0]\n");
   printf("      sim riscv-elf -- gylletank   // run riscv-elf with 'gylletank' in argv[1]\n");
+  printf("  sim -B manifest [-j threads] [-i insns] [-t seconds]\n");
+  printf("    run the jobs in 'manifest' on a pool of threads, one line per job:\n");
+  printf("      riscv-elf stdin-file expected-output-file prog-args   // '-' for no file\n");
+  printf("    -i and -t limit every job as for a single run, a job stopped by them fails\n");
+  printf("  sim -S socket [-j workers] [riscv-elf...]\n");
+  printf("    serve jobs sent to the Unix domain socket 'socket', keeping the given\n");
+  printf("    programs (and any others it is asked to run) loaded, see server.h\n");
+  printf("  sim -C riscv-elf [-i insns] -- prog-args\n");
+  printf("    run riscv-elf on the reference and the block engine in lockstep and report\n");
+  printf("    the first place they differ, see cosim.h\n");
+  printf("  sim -F programs [seed]\n");
+  printf("    run 'programs' random RV32IM programs and compare each with a reference\n");
+  printf("    interpreter, see fuzz.h\n");
+  printf("  sim -M runs json-file [baseline-json-file]\n");
+  printf("    run the benchmark kernels 'runs' times each, print their MIPS and write them to\n");
+  printf("    'json-file', compared with an earlier run if given, see bench.h\n");
   exit(-1);
 }
 
@@ -33,21 +75,7 @@ int pass_args_to_program(struct memory* mem, int argc, char* argv[]) {
   }
   if (seperator_found) { // we've got args for the program!!
     // the seperator is the first arg.
-    int first_arg = seperator_position;
-    int num_args = argc - first_arg;
-    unsigned count_addr = 0x1000000;
-    unsigned argv_addr = 0x1000004;
-    unsigned str_addr = argv_addr + 4 * num_args;
-    memory_wr_w(mem, count_addr, num_args);
-    for (int index = 0; index < num_args; ++index) {
-      memory_wr_w(mem, argv_addr + 4 * index, str_addr);
-      char* cp = argv[first_arg + index];
-      int c;
-      do {
-        c = *cp++;
-        memory_wr_b(mem, str_addr++, c);
-      } while (c);
-    }
+    write_program_args(mem, argc - seperator_position, argv + seperator_position);
   }
   // leave it to main to handle args before the seperator
   return seperator_position;
@@ -58,77 +86,302 @@ void disassemble_to_stdout(struct memory* mem, struct program_info* prog_info, s
 {
   const int buf_size = 100;
   char disassembly[buf_size];
-  for (unsigned int addr = prog_info->text_start; addr < prog_info->text_end; addr += 4) {
-    unsigned int instruction = memory_rd_w(mem, addr);
+  unsigned int addr = prog_info->text_start;
+  while (addr < prog_info->text_end) {
+    unsigned int instruction = memory_rd_h(mem, addr);
+    if ((instruction & 0x3) != 0x3) {
+      // compressed, 16 bits
+      disassemble(addr, instruction, disassembly, buf_size, symbols);
+      printf("%8x : %04X           %s\n", addr, instruction, disassembly);
+      addr += 2;
+      continue;
+    }
+    instruction |= (unsigned)memory_rd_h(mem, addr + 2) << 16;
     disassemble(addr, instruction, disassembly, buf_size, symbols);
     printf("%8x : %08X       %s\n", addr, instruction, disassembly);
+    addr += 4;
+  }
+}
+
+// Helper function, prints instruction mix and register usage next to the MIPS line
+void print_stats(FILE *out, struct Stat *stats)
+{
+  static const char *class_names[NUM_CLASSES] = {
+      "alu", "loads", "stores", "branches", "jumps", "mul/div", "atomics", "fp", "vector", "system", "other"};
+  long int classes[NUM_CLASSES] = {0};
+  for (int id = 0; id < NUM_INSNS; ++id)
+    classes[insn_classes[id]] += stats->mix[id];
+  double total = stats->insns ? stats->insns : 1;
+
+  fprintf(out, "\nInstruction mix:\n");
+  for (int c = 0; c < NUM_CLASSES; ++c)
+  {
+    if (classes[c])
+      fprintf(out, "  %-10s %12ld  %6.2f%%\n", class_names[c], classes[c], 100.0 * classes[c] / total);
+    if (c == CLASS_BRANCH && classes[c])
+      fprintf(out, "    taken    %12ld\n    not taken%12ld\n",
+              stats->taken_branches, classes[c] - stats->taken_branches);
+  }
+  if (stats->compressed)
+    fprintf(out, "  compressed %12ld  %6.2f%%\n", stats->compressed, 100.0 * stats->compressed / total);
+  if (stats->fflags)
+    fprintf(out, "  fp flags   %s%s%s%s%s\n", stats->fflags & 0x10 ? " NV" : "", stats->fflags & 0x08 ? " DZ" : "",
+            stats->fflags & 0x04 ? " OF" : "", stats->fflags & 0x02 ? " UF" : "", stats->fflags & 0x01 ? " NX" : "");
+  if (stats->exceptions || stats->interrupts)
+    fprintf(out, "  exceptions %12ld\n  interrupts %12ld\n", stats->exceptions, stats->interrupts);
+  fprintf(out, "\nPer instruction:\n");
+  for (int id = 0; id < NUM_INSNS; ++id)
+  {
+    if (stats->mix[id])
+      fprintf(out, "  %-10s %12ld  %6.2f%%\n", insn_names[id], stats->mix[id], 100.0 * stats->mix[id] / total);
+  }
+  fprintf(out, "\nRegister reads / writes:\n");
+  for (int reg = 1; reg < 32; ++reg)
+  {
+    if (stats->reg_reads[reg] || stats->reg_writes[reg])
+      fprintf(out, "  x%-2d %12ld %12ld\n", reg, stats->reg_reads[reg], stats->reg_writes[reg]);
+  }
+  fprintf(out, "\nDependency distance (instructions from write to read):\n");
+  for (int dist = 1; dist <= DEP_DIST_MAX; ++dist)
+  {
+    if (stats->dep_dist[dist])
+      fprintf(out, "  %s%-3d %12ld\n", dist == DEP_DIST_MAX ? ">=" : "  ", dist, stats->dep_dist[dist]);
+  }
+}
+
+// Helper function, opens a file named by an option or terminates
+FILE *open_option_file(const char *file_name, const char *error)
+{
+  FILE *file = fopen(file_name, "w");
+  if (file == NULL)
+  {
+    terminate(error);
   }
+  return file;
 }
 
 int main(int argc, char *argv[])
 {
+  if (argc >= 3 && !strcmp(argv[1], "-B"))
+  {
+    int threads = 0;
+    long int max_insns = 0;
+    double max_seconds = 0;
+    for (int arg = 3; arg < argc; arg += 2)
+    {
+      if (arg + 1 == argc)
+        terminate("Missing operands");
+      if (!strcmp(argv[arg], "-j"))
+        threads = atoi(argv[arg + 1]);
+      else if (!strcmp(argv[arg], "-i"))
+        max_insns = atol(argv[arg + 1]);
+      else if (!strcmp(argv[arg], "-t"))
+        max_seconds = atof(argv[arg + 1]);
+      else
+        terminate("Unknown option");
+    }
+    return batch_run(argv[2], threads, max_insns, max_seconds);
+  }
+  if (argc >= 3 && !strcmp(argv[1], "-S"))
+  {
+    int workers = 0;
+    int first = 3;
+    if (argc >= 5 && !strcmp(argv[3], "-j"))
+    {
+      workers = atoi(argv[4]);
+      first = 5;
+    }
+    return server_run(argv[2], workers, argc - first, argv + first);
+  }
+  if (argc >= 3 && !strcmp(argv[1], "-C"))
+  {
+    long int max_insns = 0;
+    int first = 3;
+    if (argc >= 5 && !strcmp(argv[3], "-i"))
+    {
+      max_insns = atol(argv[4]);
+      first = 5;
+    }
+    if (first < argc && strcmp(argv[first], "--"))
+      terminate("Unknown option");
+    return cosim_run(argv[2], argc - first, argv + first, max_insns, stderr) ? 1 : 0;
+  }
+  if (argc >= 3 && !strcmp(argv[1], "-F"))
+  {
+    if (argc > 4)
+      terminate("Unknown option");
+    return fuzz_run(atol(argv[2]), argc == 4 ? strtoul(argv[3], NULL, 0) : 1, stdout);
+  }
+  if (argc >= 4 && !strcmp(argv[1], "-M"))
+  {
+    if (argc > 5)
+      terminate("Unknown option");
+    return bench_run(atoi(argv[2]), argv[3], argc == 5 ? argv[4] : NULL);
+  }
   struct memory *mem = memory_create();
   argc = pass_args_to_program(mem, argc, argv);
-  if (argc == 2 || argc == 3 || argc == 4)
+  if (argc < 2)
+  {
+    terminate("Missing operands");
+  }
+  FILE *log_file = NULL;
+  FILE *prof_file = NULL;
+  FILE *locality_file = NULL;
+  struct locality *locality = NULL;
+  const char *summary_name = NULL;
+  const char *disk_name = NULL;
+  const char *output_name = NULL;
+  const char *gdb_address = NULL;
+  int disassemble_only = 0;
+  int harts = 1;
+  int deterministic = 0;
+  long int max_insns = 0;
+  double max_seconds = 0;
+  for (int arg = 2; arg < argc; ++arg)
   {
-    FILE *log_file = NULL;
-    FILE *prof_file = NULL;
-    if (argc == 4 && !strcmp(argv[2], "-l"))
+    if (!strcmp(argv[arg], "-d"))
     {
-      log_file = fopen(argv[3], "w");
-      if (log_file == NULL)
-      {
-        terminate("Could not open logfile, terminating.");
-      }
+      disassemble_only = 1;
+      continue;
     }
-    if (argc == 4 && !strcmp(argv[2], "-p"))
+    if (!strcmp(argv[arg], "-r"))
     {
-      prof_file = fopen(argv[3], "w");
-      if (prof_file == NULL)
-      {
-        terminate("Could not open file for exec profile, terminating.");
-      }
+      deterministic = 1;
+      continue;
     }
-    struct program_info prog_info;
-    int status = read_elf(mem, &prog_info, argv[1], log_file);
-    if (status) exit(status);
-    struct symbols* symbols = symbols_read_from_elf(argv[1]);
-    if (symbols == NULL) {
-      exit(-1);
-    }
-    if (argc == 3 && !strcmp(argv[2], "-d")) {
-      // disassemble text segment to stdout
-      disassemble_to_stdout(mem, &prog_info, symbols);
-      exit(0);
+    if (arg + 1 == argc)
+    {
+      terminate("Missing operands");
     }
-    int start_addr = prog_info.start;
-    clock_t before = clock();
-    struct Stat stats = simulate(mem, start_addr, log_file, symbols);
-    long int num_insns = stats.insns;
-    clock_t after = clock();
-    int ticks = after - before;
-    double mips = (1.0 * num_insns * CLOCKS_PER_SEC) / ticks / 1000000;
-    if (argc == 4 && !strcmp(argv[2], "-s"))
+    if (!strcmp(argv[arg], "-l"))
+      log_file = open_option_file(argv[arg + 1], "Could not open logfile, terminating.");
+    else if (!strcmp(argv[arg], "-s"))
+      summary_name = argv[arg + 1];
+    else if (!strcmp(argv[arg], "-p"))
+      prof_file = open_option_file(argv[arg + 1], "Could not open file for exec profile, terminating.");
+    else if (!strcmp(argv[arg], "-m"))
     {
-      log_file = fopen(argv[3], "w");
-      if (log_file == NULL)
-      {
-        terminate("Could not open logfile, terminating.");
-      }
+      locality_file = open_option_file(argv[arg + 1], "Could not open file for locality analysis, terminating.");
+      locality = locality_create();
     }
-    if (log_file)
+    else if (!strcmp(argv[arg], "-b"))
+      disk_name = argv[arg + 1];
+    else if (!strcmp(argv[arg], "-o"))
+      output_name = argv[arg + 1];
+    else if (!strcmp(argv[arg], "-n"))
     {
-      fprintf(log_file, "\nSimulated %ld instructions in %d host ticks (%f MIPS)\n", num_insns, ticks, mips);
-      fclose(log_file);
+      harts = atoi(argv[arg + 1]);
+      if (harts < 1 || harts > MAX_HARTS)
+        terminate("Number of harts out of range");
     }
+    else if (!strcmp(argv[arg], "-g"))
+      gdb_address = argv[arg + 1];
+    else if (!strcmp(argv[arg], "-i"))
+      max_insns = atol(argv[arg + 1]);
+    else if (!strcmp(argv[arg], "-t"))
+      max_seconds = atof(argv[arg + 1]);
     else
+      terminate("Unknown option");
+    ++arg;
+  }
+  struct program_info prog_info;
+  int status = read_elf(mem, &prog_info, argv[1], log_file);
+  if (status) exit(status);
+  struct symbols* symbols = symbols_read_from_elf(argv[1]);
+  if (symbols == NULL) {
+    exit(-1);
+  }
+  if (disassemble_only) {
+    // disassemble text segment to stdout
+    disassemble_to_stdout(mem, &prog_info, symbols);
+    exit(0);
+  }
+
+  // console and devices
+  int output_fd = 1;
+  if (output_name)
+  {
+    output_fd = open(output_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (output_fd < 0)
     {
-      printf("\nSimulated %ld instructions in %d host ticks (%f MIPS)\n", num_insns, ticks, mips);
+      terminate("Could not open output file, terminating.");
     }
-    memory_delete(mem);
   }
-  else {
-    terminate("Missing operands");
-    memory_delete(mem);
+  fflush(stdout);
+  struct console *console = console_create(0, output_fd);
+  struct uart *uart = uart_create(console);
+  memory_map_device(mem, UART_BASE, UART_SIZE, uart, uart_read, uart_write);
+  struct blockdev *disk = NULL;
+  if (disk_name)
+  {
+    disk = blockdev_open(disk_name, mem);
+    if (disk == NULL)
+    {
+      terminate("Could not open disk image, terminating.");
+    }
+    memory_map_device(mem, BLOCKDEV_BASE, BLOCKDEV_SIZE, disk, blockdev_read, blockdev_write);
+  }
+
+  int start_addr = prog_info.start;
+  int profile = log_file != NULL || summary_name != NULL;
+  // wall time, clock() would add up the CPU time of all the harts' threads
+  struct timespec before, after;
+  clock_gettime(CLOCK_MONOTONIC, &before);
+  struct syscalls *syscalls = syscalls_create(console, prog_info.data_end);
+  struct sim_options options = {.harts = harts, .deterministic = deterministic, .max_insns = max_insns,
+                                .max_seconds = max_seconds, .log_file = log_file, .symbols = symbols,
+                                .profile = profile, .locality = locality};
+  struct Stat stats;
+  if (gdb_address)
+  {
+    struct machine *machine = machine_create(mem, syscalls, start_addr, &options);
+    if (gdb_serve(machine, console, gdb_address))
+      terminate("Could not wait for gdb, terminating.");
+    stats = machine_stats(machine);
+    machine_delete(machine);
+  }
+  else
+    stats = simulate(mem, syscalls, start_addr, &options);
+  long int num_insns = stats.insns;
+  clock_gettime(CLOCK_MONOTONIC, &after);
+  long int micros = (after.tv_sec - before.tv_sec) * 1000000 + (after.tv_nsec - before.tv_nsec) / 1000;
+  double mips = 1.0 * num_insns / micros;
+  syscalls_delete(syscalls);
+  uart_delete(uart);
+  console_delete(console);
+  if (output_fd != 1)
+    close(output_fd);
+  if (stats.fatal_cause >= 0)
+    printf("%s at %x (mtval %x)\n", exception_name(stats.fatal_cause), stats.fatal_pc, stats.fatal_tval);
+  else if (stats.stop == STOP_BUDGET)
+    printf("Stopped: instruction budget used up\n");
+  else if (stats.stop == STOP_TIMEOUT)
+    printf("Stopped by the watchdog after %g s\n", max_seconds);
+  if (disk)
+    blockdev_close(disk);
+  if (prof_file)
+    fclose(prof_file);
+  if (summary_name)
+  {
+    if (log_file)
+      fclose(log_file);
+    log_file = open_option_file(summary_name, "Could not open logfile, terminating.");
+  }
+  if (log_file)
+  {
+    fprintf(log_file, "\nSimulated %ld instructions in %ld host microseconds (%f MIPS)\n", num_insns, micros, mips);
+    print_stats(log_file, &stats);
+    fclose(log_file);
+  }
+  else
+  {
+    printf("\nSimulated %ld instructions in %ld host microseconds (%f MIPS)\n", num_insns, micros, mips);
+  }
+  if (locality)
+  {
+    locality_report(locality, locality_file);
+    fclose(locality_file);
+    locality_delete(locality);
   }
+  memory_delete(mem);
 }
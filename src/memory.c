@@ -1,104 +1,268 @@
 #include "memory.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+// Devices claim whole 64 KiB pages. Their pages are never allocated, so
+// the NULL check every access already does for unallocated pages is also
+// what sends device accesses down the slow path.
+#define MAX_DEVICES 16
+
+// Watched pages are like shared pages, their write_pages entry is NULL, so
+// writes to them take the slow path where the watch function is called.
+
+// A clone shares the pages of the memory it was made from until it writes
+// to them. Reads go through pages and writes through write_pages, which is
+// NULL for pages that are shared, so the first write takes the slow path
+// and copies the page, the same way unallocated pages are handled.
+
+struct device
+{
+  unsigned int base, size;
+  void *dev;
+  device_read_fn read;
+  device_write_fn write;
+};
 
 struct memory
 {
   int *pages[0x10000];
+  int *write_pages[0x10000];
+  const struct memory *image; // pages equal to image->pages are shared
+  // numbers of the pages in use, so cloning and deleting don't have to look
+  // at all of the page tables, which are mostly never touched
+  unsigned short used[0x10000];
+  int num_used;
+  unsigned char device_of_page[0x10000]; // index + 1 in devices, 0 for RAM
+  unsigned char watched[0x10000];        // times each page is watched
+  memory_watch_fn watch;
+  void *watch_arg;
+  memory_invalidate_fn invalidate;
+  void *invalidate_arg;
+  struct device devices[MAX_DEVICES];
+  // device callbacks are not thread safe, and may access memory themselves
+  pthread_mutex_t device_lock;
 };
 
 struct memory *memory_create()
 {
-  return calloc(sizeof(struct memory), 1);
+  struct memory *mem = calloc(sizeof(struct memory), 1);
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&mem->device_lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+  return mem;
 }
 
 void memory_delete(struct memory *mem)
 {
-  for (int j = 0; j < 0x10000; ++j)
+  for (int i = 0; i < mem->num_used; ++i)
   {
-    if (mem->pages[j])
+    int j = mem->used[i];
+    if (!(mem->image && mem->pages[j] == mem->image->pages[j]))
       free(mem->pages[j]);
   }
+  pthread_mutex_destroy(&mem->device_lock);
   free(mem);
 }
 
+struct memory *memory_clone(struct memory *mem)
+{
+  struct memory *copy = memory_create();
+  copy->image = mem;
+  for (int i = 0; i < mem->num_used; ++i)
+    copy->pages[mem->used[i]] = mem->pages[mem->used[i]];
+  memcpy(copy->used, mem->used, mem->num_used * sizeof(mem->used[0]));
+  copy->num_used = mem->num_used;
+  return copy;
+}
+
+int memory_map_device(struct memory *mem, unsigned int base, unsigned int size, void *dev,
+                      device_read_fn read, device_write_fn write)
+{
+  int slot = 0;
+  while (slot < MAX_DEVICES && mem->devices[slot].size)
+    slot++;
+  if (slot == MAX_DEVICES || (base & 0xffff) || (size & 0xffff) || size == 0)
+    return 0;
+  for (unsigned int a = base; a - base < size; a += 0x10000)
+  {
+    if (mem->device_of_page[a >> 16] || mem->pages[a >> 16])
+      return 0;
+  }
+  mem->devices[slot] = (struct device){base, size, dev, read, write};
+  for (unsigned int a = base; a - base < size; a += 0x10000)
+    mem->device_of_page[a >> 16] = slot + 1;
+  return 1;
+}
+
+void memory_unmap_device(struct memory *mem, unsigned int base)
+{
+  int slot = mem->device_of_page[base >> 16];
+  if (slot == 0)
+    return;
+  struct device *device = &mem->devices[slot - 1];
+  for (unsigned int a = device->base; a - device->base < device->size; a += 0x10000)
+    mem->device_of_page[a >> 16] = 0;
+  device->size = 0;
+}
+
+// The page at addr, ready to be written: allocated if it wasn't, copied if
+// it is shared with the image. Harts on other threads may do this at the
+// same time, the first page to be installed wins. The page is filled in
+// before it is published, so the plain reads of the page tables elsewhere
+// never see garbage.
 int *get_page(struct memory *mem, int addr)
 {
   int page_number = (addr >> 16) & 0x0ffff;
-  if (mem->pages[page_number] == NULL)
+  int *page = __atomic_load_n(&mem->pages[page_number], __ATOMIC_ACQUIRE);
+  if (page == NULL || (mem->image && page == mem->image->pages[page_number]))
   {
-    mem->pages[page_number] = calloc(65536, 1);
+    int *new_page;
+    if (page)
+    {
+      new_page = malloc(65536);
+      memcpy(new_page, page, 65536);
+    }
+    else
+      new_page = calloc(65536, 1);
+    int *old_page = page;
+    if (__atomic_compare_exchange_n(&mem->pages[page_number], &page, new_page, 0, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE))
+    {
+      page = new_page;
+      if (old_page == NULL)
+        mem->used[__atomic_fetch_add(&mem->num_used, 1, __ATOMIC_RELAXED)] = page_number;
+    }
+    else
+      free(new_page);
   }
-  return mem->pages[page_number];
+  if (!mem->watched[page_number])
+    __atomic_store_n(&mem->write_pages[page_number], page, __ATOMIC_RELEASE);
+  return page;
 }
 
-void memory_wr_w(struct memory *mem, int addr, int data)
+// what pages that were never written hold
+static const int zero_page[0x4000];
+
+// the page at addr for reading, neither allocated nor copied
+static const int *read_page(struct memory *mem, int addr)
+{
+  const int *page = mem->pages[(addr >> 16) & 0xffff];
+  return page ? page : zero_page;
+}
+
+// the device at addr, NULL if it is RAM
+static struct device *device_at(struct memory *mem, int addr)
 {
-  if (addr & 0x3)
+  int slot = mem->device_of_page[(addr >> 16) & 0xffff];
+  return slot ? &mem->devices[slot - 1] : NULL;
+}
+
+int memory_unclaimed(struct memory *mem, int addr)
+{
+  return (unsigned)addr - IO_BASE < IO_SIZE && !mem->device_of_page[(addr >> 16) & 0xffff];
+}
+
+// Accesses to pages that aren't allocated: either a device, an unclaimed
+// device address, or RAM touched for the first time. Writes also come here
+// for shared and watched pages
+static int slow_read(struct memory *mem, int addr, int size)
+{
+  struct device *device = device_at(mem, addr);
+  if (device)
+  {
+    pthread_mutex_lock(&mem->device_lock);
+    int data = device->read(device->dev, (unsigned)addr - device->base, size);
+    pthread_mutex_unlock(&mem->device_lock);
+    return size == 4 ? data : data & ((1 << (8 * size)) - 1);
+  }
+  if (memory_unclaimed(mem, addr))
+    return 0;
+  get_page(mem, addr);
+  return size == 4 ? memory_rd_w(mem, addr) : size == 2 ? memory_rd_h(mem, addr) : memory_rd_b(mem, addr);
+}
+
+static void slow_write(struct memory *mem, int addr, int size, int data)
+{
+  struct device *device = device_at(mem, addr);
+  if (device)
   {
-    printf("Unaligned word write to %x\n", addr);
-    exit(-1);
+    pthread_mutex_lock(&mem->device_lock);
+    device->write(device->dev, (unsigned)addr - device->base, size, data);
+    pthread_mutex_unlock(&mem->device_lock);
+    return;
   }
+  if (memory_unclaimed(mem, addr))
+    return;
   int *page = get_page(mem, addr);
+  if (mem->watched[(addr >> 16) & 0xffff])
+  {
+    // the host is little endian like the guest
+    memcpy((char *)page + (addr & 0xffff), &data, size);
+    if (mem->watch)
+      mem->watch(mem->watch_arg, addr, size);
+    return;
+  }
+  if (size == 4)
+    memory_wr_w(mem, addr, data);
+  else if (size == 2)
+    memory_wr_h(mem, addr, data);
+  else
+    memory_wr_b(mem, addr, data);
+}
+
+void memory_wr_w(struct memory *mem, int addr, int data)
+{
+  int *page = mem->write_pages[(addr >> 16) & 0xffff];
+  if (page == NULL)
+  {
+    slow_write(mem, addr, 4, data);
+    return;
+  }
   page[(addr >> 2) & 0x3fff] = data;
 }
 
 void memory_wr_h(struct memory *mem, int addr, int data)
 {
-  if (addr & 0x1)
+  int *page = mem->write_pages[(addr >> 16) & 0xffff];
+  if (page == NULL)
   {
-    printf("Unaligned halfword write to %x\n", addr);
-    exit(-1);
+    slow_write(mem, addr, 2, data);
+    return;
   }
-  int *page = get_page(mem, addr);
-  int index = (addr >> 2) & 0x3fff;
-  if ((addr & 2) == 0)
-    page[index] = (page[index] & 0xffff0000) | (data & 0x0000ffff);
-  else
-    page[index] = (page[index] & 0x0000ffff) | ((unsigned)data << 16);
+  // only the halfword itself is written, a hart on another thread may be
+  // storing to the rest of the word. The host is little endian like the guest
+  memcpy((char *)page + (addr & 0xfffe), &data, 2);
 }
 
 void memory_wr_b(struct memory *mem, int addr, int data)
 {
-  int *page = get_page(mem, addr);
-  int index = (addr >> 2) & 0x3fff;
-  switch (addr & 0x3)
+  int *page = mem->write_pages[(addr >> 16) & 0xffff];
+  if (page == NULL)
   {
-  case 0:
-    page[index] = (page[index] & 0xffffff00) | (data & 0xff);
-    break;
-  case 1:
-    page[index] = (page[index] & 0xffff00ff) | ((data & 0xff) << 8);
-    break;
-  case 2:
-    page[index] = (page[index] & 0xff00ffff) | ((data & 0xff) << 16);
-    break;
-  case 3:
-    page[index] = (page[index] & 0x00ffffff) | (((unsigned)(data & 0xff)) << 24);
-    break;
+    slow_write(mem, addr, 1, data);
+    return;
   }
+  ((char *)page)[addr & 0xffff] = data;
 }
 
 int memory_rd_w(struct memory *mem, int addr)
 {
-  int *page = get_page(mem, addr);
-  if (addr & 0x3)
-  {
-    printf("Unaligned word read from %x\n", addr);
-    exit(-1);
-  }
+  int *page = mem->pages[(addr >> 16) & 0xffff];
+  if (page == NULL)
+    return slow_read(mem, addr, 4);
   return page[(addr >> 2) & 0x3fff];
 }
 
 int memory_rd_h(struct memory *mem, int addr)
 {
-  int *page = get_page(mem, addr);
+  int *page = mem->pages[(addr >> 16) & 0xffff];
+  if (page == NULL)
+    return slow_read(mem, addr, 2);
   int index = (addr >> 2) & 0x3fff;
-  if (addr & 0x1)
-  {
-    printf("Unaligned halfword read from %x\n", addr);
-    exit(-1);
-  }
   if ((addr & 2) == 0)
     return page[index] & 0xffff;
   else
@@ -107,7 +271,9 @@ int memory_rd_h(struct memory *mem, int addr)
 
 int memory_rd_b(struct memory *mem, int addr)
 {
-  int *page = get_page(mem, addr);
+  int *page = mem->pages[(addr >> 16) & 0xffff];
+  if (page == NULL)
+    return slow_read(mem, addr, 1);
   int index = (addr >> 2) & 0x3fff;
   switch (addr & 0x3)
   {
@@ -126,3 +292,93 @@ int memory_rd_b(struct memory *mem, int addr)
   }
   return 0; // silence a warning
 }
+
+// Pages hold the guest bytes in guest order (words are stored in host order
+// and the host is little endian like the guest), so ranges can be copied
+// with memcpy a page at a time. Device pages are accessed a byte at a time.
+void memory_rd_bytes(struct memory *mem, int addr, void *buf, int len)
+{
+  char *dst = buf;
+  while (len > 0)
+  {
+    int offset = addr & 0xffff;
+    int chunk = 0x10000 - offset < len ? 0x10000 - offset : len;
+    if (device_at(mem, addr) || memory_unclaimed(mem, addr))
+    {
+      for (int i = 0; i < chunk; ++i)
+        dst[i] = memory_rd_b(mem, addr + i);
+    }
+    else
+      memcpy(dst, (const char *)read_page(mem, addr) + offset, chunk);
+    dst += chunk;
+    addr += chunk;
+    len -= chunk;
+  }
+}
+
+void memory_wr_bytes(struct memory *mem, int addr, const void *buf, int len)
+{
+  const char *src = buf;
+  memory_invalidate(mem, addr, len);
+  while (len > 0)
+  {
+    int offset = addr & 0xffff;
+    int chunk = 0x10000 - offset < len ? 0x10000 - offset : len;
+    if (device_at(mem, addr) || memory_unclaimed(mem, addr) || mem->watched[(addr >> 16) & 0xffff])
+    {
+      for (int i = 0; i < chunk; ++i)
+        memory_wr_b(mem, addr + i, src[i]);
+    }
+    else
+      memcpy((char *)get_page(mem, addr) + offset, src, chunk);
+    src += chunk;
+    addr += chunk;
+    len -= chunk;
+  }
+}
+
+void *memory_page_ptr(struct memory *mem, int addr, int *len)
+{
+  if (device_at(mem, addr) || memory_unclaimed(mem, addr) || mem->watched[(addr >> 16) & 0xffff])
+    return NULL;
+  *len = 0x10000 - (addr & 0xffff);
+  return (char *)get_page(mem, addr) + (addr & 0xffff);
+}
+
+const void *memory_page_read_ptr(struct memory *mem, int addr, int *len)
+{
+  if (device_at(mem, addr) || memory_unclaimed(mem, addr))
+    return NULL;
+  *len = 0x10000 - (addr & 0xffff);
+  return (const char *)read_page(mem, addr) + (addr & 0xffff);
+}
+
+void memory_set_invalidate(struct memory *mem, memory_invalidate_fn invalidate, void *arg)
+{
+  mem->invalidate = invalidate;
+  mem->invalidate_arg = arg;
+}
+
+void memory_invalidate(struct memory *mem, int addr, int len)
+{
+  if (mem->invalidate && len > 0)
+    mem->invalidate(mem->invalidate_arg, addr, len);
+}
+
+void memory_set_watch(struct memory *mem, memory_watch_fn watch, void *arg)
+{
+  mem->watch = watch;
+  mem->watch_arg = arg;
+}
+
+void memory_watch_page(struct memory *mem, int addr, int watch)
+{
+  int page_number = (addr >> 16) & 0xffff;
+  if (watch)
+  {
+    mem->watched[page_number]++;
+    mem->write_pages[page_number] = NULL;
+  }
+  else if (mem->watched[page_number])
+    mem->watched[page_number]--; // the next write puts the page back
+}
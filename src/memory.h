@@ -3,11 +3,34 @@
 
 struct memory;
 
+// læs/skriv size (1, 2 eller 4) bytes ved offset i en enhed
+typedef int (*device_read_fn)(void *dev, unsigned int offset, int size);
+typedef void (*device_write_fn)(void *dev, unsigned int offset, int size, int data);
+
 // opret/nedlæg lager
 struct memory *memory_create();
 void memory_delete(struct memory *);
 
+// nyt lager med samme indhold, men uden enheder. Siderne deles med mem indtil
+// de skrives, så mem må ikke ændres bagefter og skal nedlægges efter kopien
+struct memory *memory_clone(struct memory *mem);
+
+// placer en enhed i adresserummet, base og size skal være hele 64 KiB sider
+// som ikke er brugt endnu. Returnerer 0 hvis det ikke kan lade sig gøre
+int memory_map_device(struct memory *mem, unsigned int base, unsigned int size, void *dev,
+                      device_read_fn read, device_write_fn write);
+void memory_unmap_device(struct memory *mem, unsigned int base);
+
+// Adresserne IO_BASE til IO_BASE + IO_SIZE er forbeholdt enheder. En adresse
+// her som ingen enhed har er hverken RAM eller andet: læsning giver 0 og
+// skrivning ignoreres, og simulatoren giver en access fault i stedet
+#define IO_BASE 0xc0000000u
+#define IO_SIZE 0x04000000u
+// 1 hvis addr er i området og ingen enhed har den
+int memory_unclaimed(struct memory *mem, int addr);
+
 // skriv word/halfword/byte til lager
+// adresser skal være justerede, simulatoren giver en exception ellers
 void memory_wr_w(struct memory *mem, int addr, int data);
 void memory_wr_h(struct memory *mem, int addr, int data);
 void memory_wr_b(struct memory *mem, int addr, int data);
@@ -16,4 +39,32 @@ void memory_wr_b(struct memory *mem, int addr, int data);
 int memory_rd_w(struct memory *mem, int addr);
 int memory_rd_h(struct memory *mem, int addr);
 int memory_rd_b(struct memory *mem, int addr);
+
+// kopier len bytes mellem lager og en buffer i værten
+void memory_rd_bytes(struct memory *mem, int addr, void *buf, int len);
+void memory_wr_bytes(struct memory *mem, int addr, const void *buf, int len);
+
+// pointer direkte ind i siden med addr, *len sættes til antal bytes til
+// sidens slutning. Siden kan skrives, en delt side kopieres først.
+// NULL hvis addr hører til en enhed eller IO-området, eller siden er overvåget
+void *memory_page_ptr(struct memory *mem, int addr, int *len);
+// det samme til læsning, uden at siden kopieres eller allokeres. En side som
+// aldrig er skrevet læses som nuller
+const void *memory_page_read_ptr(struct memory *mem, int addr, int *len);
+
+// Overvågede sider: skrivninger til dem går den langsomme vej, og watch
+// kaldes efter hver af dem. Andre sider koster ikke noget ekstra
+typedef void (*memory_watch_fn)(void *arg, int addr, int size);
+void memory_set_watch(struct memory *mem, memory_watch_fn watch, void *arg);
+// overvåg siden med addr, eller hold op igen (det tælles, så en side kan
+// overvåges flere gange)
+void memory_watch_page(struct memory *mem, int addr, int watch);
+
+// Skrivninger uden om CPU'ens store-instruktioner, fra systemkald, enheder
+// og debuggeren: invalidate kaldes med det skrevne område, så den som har
+// afkodet instruktioner derfra kan glemme dem. memory_wr_bytes kalder den
+// selv, den som skriver gennem memory_page_ptr kalder memory_invalidate
+typedef void (*memory_invalidate_fn)(void *arg, int addr, int len);
+void memory_set_invalidate(struct memory *mem, memory_invalidate_fn invalidate, void *arg);
+void memory_invalidate(struct memory *mem, int addr, int len);
 #endif
@@ -37,6 +37,7 @@ int read_elf(struct memory *mem, struct program_info *info, const char *filename
     info->text_start = 0;
     info->text_end = 0;
     info->start = elf_header.e_entry;
+    info->data_end = 0;
     // printf("Program headers starting at offset %d\n", elf_header.e_phoff);
     // printf("Program entry point address: 0x%x\n", info->start);
     // printf("Text offset 0x%x\n\n", info->text_start);
@@ -55,6 +56,8 @@ int read_elf(struct memory *mem, struct program_info *info, const char *filename
         // Check for loadable segments (PT_LOAD)
         if (program_header.p_type == PT_LOAD)
         {
+            if (program_header.p_vaddr + program_header.p_memsz > info->data_end)
+                info->data_end = program_header.p_vaddr + program_header.p_memsz;
             // const char *segment_type = NULL;
 
             // Identify segment type
@@ -96,11 +99,7 @@ int read_elf(struct memory *mem, struct program_info *info, const char *filename
 
             // Process the segment data (e.g., print or analyze)
             // printf("All bytes of %s segment:\n", segment_type);
-            for (unsigned int j = 0; j < program_header.p_filesz; j++)
-            {
-                // printf("%02x ", segment_data[j]);
-                memory_wr_b(mem, program_header.p_vaddr + j, segment_data[j]);
-            }
+            memory_wr_bytes(mem, program_header.p_vaddr, segment_data, program_header.p_filesz);
             /*
             printf("\n\nDisassembly\n");
             for (unsigned int j = info->text_start; j < program_header.p_filesz; j += 4) {
@@ -121,6 +120,25 @@ int read_elf(struct memory *mem, struct program_info *info, const char *filename
     return 0;
 }
 
+void write_program_args(struct memory *mem, int num_args, char *args[])
+{
+    unsigned count_addr = 0x1000000;
+    unsigned argv_addr = 0x1000004;
+    unsigned str_addr = argv_addr + 4 * num_args;
+    memory_wr_w(mem, count_addr, num_args);
+    for (int index = 0; index < num_args; ++index)
+    {
+        memory_wr_w(mem, argv_addr + 4 * index, str_addr);
+        char *cp = args[index];
+        int c;
+        do
+        {
+            c = *cp++;
+            memory_wr_b(mem, str_addr++, c);
+        } while (c);
+    }
+}
+
 struct symbols
 {
     char *strtab;
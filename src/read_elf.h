@@ -9,11 +9,16 @@ struct program_info {
     unsigned int text_start;
     unsigned int text_end;
     unsigned int start;
+    unsigned int data_end; // end of the highest loaded segment, where brk starts
 };
 
 // read file into simulated memory, fill in program info
 int read_elf(struct memory* mem, struct program_info* info, const char* file_name, FILE *log_file);
 
+// place program arguments in simulated memory: argc at 0x1000000, followed
+// by argv and the strings. args[0] is '--' by convention
+void write_program_args(struct memory *mem, int num_args, char *args[]);
+
 struct symbols;
 
 // read symbol table from elf file
@@ -0,0 +1,494 @@
+#define _GNU_SOURCE // accept4
+#include "server.h"
+#include "image.h"
+#include "csr.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 64
+#define MAX_LINE 4096 // of a request
+#define MAX_WORDS 68  // "run", program, budget, stdin length and the args
+#define READ_SIZE 0x10000
+
+struct buffer
+{
+    char *data;
+    size_t len, size;
+};
+
+// The event loop owns a connection, except for request and response while
+// busy, which belong to the worker running the request.
+struct connection
+{
+    int fd;
+    struct buffer in;  // received but not yet taken as a request
+    struct buffer out; // response being sent
+    size_t sent;
+    int busy;    // a worker has its request
+    int eof;     // the client has sent everything, close when it is answered
+    int watched; // the fd is in the epoll set
+    int closed;  // the fd is closed, the connection is deleted once nothing uses it
+    struct buffer request;  // the request line, NUL terminated, then the input
+    size_t line_len;        // of the request line including the NUL
+    struct buffer response; // filled by the worker
+    struct connection *next; // in the job queue, the done list or the closed list
+};
+
+struct server
+{
+    pthread_mutex_t images_lock;
+    struct program_image **images; // index is the id
+    int num_images;
+
+    // requests for the workers and their finished responses, the workers
+    // wake the event loop through done_fd
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    struct connection *queue, *queue_tail;
+    struct connection *done;
+    int done_fd;
+
+    int listen_fd;
+    int epoll_fd;
+    // closed connections, deleted after the events of the current batch as
+    // later events may still point to them
+    struct connection *closed;
+};
+
+static void buffer_add(struct buffer *b, const void *data, size_t len)
+{
+    if (b->len + len > b->size)
+    {
+        b->size = b->len + len > 2 * b->size ? b->len + len : 2 * b->size;
+        b->data = realloc(b->data, b->size);
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void buffer_printf(struct buffer *b, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void buffer_printf(struct buffer *b, const char *format, ...)
+{
+    char text[MAX_LINE];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    buffer_add(b, text, len < (int)sizeof(text) ? len : (int)sizeof(text) - 1);
+}
+
+static void buffer_consume(struct buffer *b, size_t len)
+{
+    memmove(b->data, b->data + len, b->len - len);
+    b->len -= len;
+}
+
+// image by "#id" or by file name, loading the file the first time. Returns
+// NULL if there is no such image
+static struct program_image *find_image(struct server *server, const char *name, int *id)
+{
+    struct program_image *image = NULL;
+    pthread_mutex_lock(&server->images_lock);
+    if (name[0] == '#')
+    {
+        *id = atoi(name + 1);
+        if (*id >= 0 && *id < server->num_images)
+            image = server->images[*id];
+    }
+    else
+    {
+        for (int i = 0; i < server->num_images && image == NULL; ++i)
+        {
+            if (!strcmp(server->images[i]->file_name, name))
+            {
+                image = server->images[i];
+                *id = i;
+            }
+        }
+        if (image == NULL && (image = image_load(name, stderr)) != NULL)
+        {
+            server->images = realloc(server->images, (server->num_images + 1) * sizeof(struct program_image *));
+            *id = server->num_images;
+            server->images[server->num_images++] = image;
+        }
+    }
+    pthread_mutex_unlock(&server->images_lock);
+    return image;
+}
+
+static void run_request(struct server *server, char *words[], int num_words, char *input, size_t input_len,
+                        struct buffer *response)
+{
+    int id;
+    struct program_image *image = find_image(server, words[1], &id);
+    if (image == NULL)
+    {
+        buffer_printf(response, "error could not load %s\n", words[1]);
+        return;
+    }
+    FILE *in = tmpfile();
+    FILE *out = tmpfile();
+    if (in == NULL || out == NULL || fwrite(input, 1, input_len, in) != input_len || fflush(in))
+    {
+        if (in)
+            fclose(in);
+        if (out)
+            fclose(out);
+        buffer_printf(response, "error no room for input and output\n");
+        return;
+    }
+    rewind(in);
+
+    // words[3] becomes the "--" in argv[0]
+    words[3] = "--";
+    struct timespec before, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    // the budget is max-insns[:max-seconds]
+    char *seconds;
+    long int max_insns = strtol(words[2], &seconds, 10);
+    double max_seconds = *seconds == ':' ? atof(seconds + 1) : 0;
+    struct Stat stats = image_run(image, num_words - 3, words + 3, fileno(in), fileno(out), max_insns, max_seconds);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    fclose(in);
+
+    int code = 0;
+    if (stats.stop == STOP_EXIT)
+        code = stats.exit_code;
+    else if (stats.stop == STOP_FAULT)
+    {
+        code = stats.fatal_cause;
+        fprintf(out, "%s at %x (mtval %x)\n", exception_name(stats.fatal_cause), stats.fatal_pc, stats.fatal_tval);
+    }
+    fflush(out);
+    long int out_len = ftell(out);
+    long int usec = (after.tv_sec - before.tv_sec) * 1000000 + (after.tv_nsec - before.tv_nsec) / 1000;
+    buffer_printf(response, "%s %d %ld %ld %ld\n", stop_name(stats.stop), code, stats.insns, usec, out_len);
+    rewind(out);
+    char chunk[READ_SIZE];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), out)) > 0)
+        buffer_add(response, chunk, n);
+    fclose(out);
+}
+
+static void handle_request(struct server *server, struct connection *conn)
+{
+    char *words[MAX_WORDS];
+    int num_words = 0;
+    char *save;
+    char *word = strtok_r(conn->request.data, " \t", &save);
+    while (word && num_words < MAX_WORDS)
+    {
+        words[num_words++] = word;
+        word = strtok_r(NULL, " \t", &save);
+    }
+    struct buffer *response = &conn->response;
+    int id;
+    if (num_words == 2 && !strcmp(words[0], "load"))
+    {
+        if (find_image(server, words[1], &id))
+            buffer_printf(response, "image %d\n", id);
+        else
+            buffer_printf(response, "error could not load %s\n", words[1]);
+    }
+    else if (num_words >= 4 && !strcmp(words[0], "run"))
+        run_request(server, words, num_words, conn->request.data + conn->line_len, conn->request.len - conn->line_len,
+                    response);
+    else
+        buffer_printf(response, "error expected 'load elf-file' or 'run elf-file max-insns stdin-length args...'\n");
+}
+
+static void *worker_thread(void *arg)
+{
+    struct server *server = arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&server->lock);
+        while (server->queue == NULL)
+            pthread_cond_wait(&server->work, &server->lock);
+        struct connection *conn = server->queue;
+        server->queue = conn->next;
+        pthread_mutex_unlock(&server->lock);
+
+        handle_request(server, conn);
+
+        pthread_mutex_lock(&server->lock);
+        conn->next = server->done;
+        server->done = conn;
+        pthread_mutex_unlock(&server->lock);
+        uint64_t one = 1;
+        if (write(server->done_fd, &one, sizeof(one)) < 0)
+            perror("server");
+    }
+    return NULL;
+}
+
+static void delete_connection(struct connection *conn)
+{
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn->request.data);
+    free(conn->response.data);
+    free(conn);
+}
+
+// the connection goes on the closed list, now or when its worker is done
+static void release_connection(struct server *server, struct connection *conn)
+{
+    conn->next = server->closed;
+    server->closed = conn;
+}
+
+// stops watching the connection, it is deleted when nothing uses it any more
+static void close_connection(struct server *server, struct connection *conn)
+{
+    if (conn->closed)
+        return;
+    if (conn->watched)
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->closed = 1;
+    if (!conn->busy)
+        release_connection(server, conn);
+}
+
+// Watches for what the connection waits for: room to send the response,
+// the next request, or nothing while a worker has a request and the client
+// has sent everything. epoll reports a hangup even with no events asked
+// for, so then the fd is taken out of the set
+static void watch(struct server *server, struct connection *conn)
+{
+    struct epoll_event event = {conn->out.len > conn->sent ? EPOLLOUT : conn->eof ? 0 : EPOLLIN, {.ptr = conn}};
+    if (event.events == 0)
+    {
+        if (conn->watched)
+            epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        conn->watched = 0;
+    }
+    else
+    {
+        epoll_ctl(server->epoll_fd, conn->watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, conn->fd, &event);
+        conn->watched = 1;
+    }
+}
+
+// Hands the next complete request in the input to the workers. Returns 0 if
+// the request line is too long, and the connection should be closed.
+static int dispatch(struct server *server, struct connection *conn)
+{
+    if (conn->busy || conn->out.len > conn->sent || conn->in.len == 0)
+        return 1;
+    char *newline = memchr(conn->in.data, '\n', conn->in.len);
+    if (newline == NULL)
+        return conn->in.len < MAX_LINE;
+    size_t line_len = newline - conn->in.data + 1;
+    if (line_len > MAX_LINE)
+        return 0;
+
+    // only a run has input, its length is the fourth word
+    char line[MAX_LINE];
+    memcpy(line, conn->in.data, line_len - 1);
+    line[line_len - 1] = 0;
+    size_t input_len = 0;
+    char *save;
+    char *word = strtok_r(line, " \t\r", &save);
+    if (word && !strcmp(word, "run"))
+    {
+        for (int i = 1; i < 4 && word; ++i)
+            word = strtok_r(NULL, " \t\r", &save);
+        if (word)
+            input_len = strtoul(word, NULL, 10);
+    }
+    if (conn->in.len < line_len + input_len)
+        return 1;
+
+    conn->request.len = 0;
+    buffer_add(&conn->request, conn->in.data, line_len + input_len);
+    conn->request.data[line_len - 1] = 0;
+    if (line_len >= 2 && conn->request.data[line_len - 2] == '\r')
+        conn->request.data[line_len - 2] = 0;
+    conn->line_len = line_len;
+    buffer_consume(&conn->in, line_len + input_len);
+    conn->response.len = 0;
+    conn->busy = 1;
+    conn->next = NULL;
+
+    pthread_mutex_lock(&server->lock);
+    if (server->queue)
+        server->queue_tail->next = conn;
+    else
+        server->queue = conn;
+    server->queue_tail = conn;
+    pthread_cond_signal(&server->work);
+    pthread_mutex_unlock(&server->lock);
+    return 1;
+}
+
+static void accept_connections(struct server *server)
+{
+    int fd;
+    while ((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        struct connection *conn = calloc(1, sizeof(struct connection));
+        conn->fd = fd;
+        watch(server, conn);
+    }
+}
+
+static void receive(struct server *server, struct connection *conn)
+{
+    char chunk[READ_SIZE];
+    ssize_t n;
+    while ((n = recv(conn->fd, chunk, sizeof(chunk), 0)) > 0)
+        buffer_add(&conn->in, chunk, n);
+    if (n == 0)
+        conn->eof = 1;
+    else if (errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+        close_connection(server, conn);
+        return;
+    }
+    if (!dispatch(server, conn) || (conn->eof && !conn->busy))
+        close_connection(server, conn);
+    else if (conn->eof)
+        watch(server, conn);
+}
+
+static void send_response(struct server *server, struct connection *conn)
+{
+    while (conn->sent < conn->out.len)
+    {
+        ssize_t n = send(conn->fd, conn->out.data + conn->sent, conn->out.len - conn->sent, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                close_connection(server, conn);
+            return;
+        }
+        conn->sent += n;
+    }
+    conn->out.len = conn->sent = 0;
+    if (!dispatch(server, conn) || (conn->eof && !conn->busy))
+        close_connection(server, conn);
+    else
+        watch(server, conn);
+}
+
+static void finish_requests(struct server *server)
+{
+    uint64_t count;
+    if (read(server->done_fd, &count, sizeof(count)) < 0)
+        return;
+    pthread_mutex_lock(&server->lock);
+    struct connection *done = server->done;
+    server->done = NULL;
+    pthread_mutex_unlock(&server->lock);
+    while (done)
+    {
+        struct connection *conn = done;
+        done = conn->next;
+        conn->busy = 0;
+        if (conn->closed)
+        {
+            release_connection(server, conn);
+            continue;
+        }
+        struct buffer swap = conn->out;
+        conn->out = conn->response;
+        conn->response = swap;
+        conn->sent = 0;
+        send_response(server, conn);
+    }
+}
+
+int server_run(const char *socket_name, int workers, int num_preload, char *preload[])
+{
+    struct server server = {0};
+    pthread_mutex_init(&server.images_lock, NULL);
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.work, NULL);
+    for (int i = 0; i < num_preload; ++i)
+    {
+        int id;
+        if (find_image(&server, preload[i], &id) == NULL)
+        {
+            fprintf(stderr, "Could not load %s\n", preload[i]);
+            return 1;
+        }
+        printf("image %d: %s\n", id, preload[i]);
+    }
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_name) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Socket name too long: %s\n", socket_name);
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_name);
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(socket_name);
+    if (server.listen_fd < 0 || bind(server.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(server.listen_fd, SOMAXCONN) < 0)
+    {
+        perror(socket_name);
+        return 1;
+    }
+    server.done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = {EPOLLIN, {.ptr = &server.listen_fd}};
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &event);
+    event.data.ptr = &server.done_fd;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.done_fd, &event);
+
+    if (workers <= 0)
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < workers; ++i)
+    {
+        pthread_t thread;
+        pthread_create(&thread, NULL, worker_thread, &server);
+        pthread_detach(thread);
+    }
+    printf("Serving on %s with %d workers\n", socket_name, workers);
+    fflush(stdout);
+
+    for (;;)
+    {
+        struct epoll_event events[MAX_EVENTS];
+        int count = epoll_wait(server.epoll_fd, events, MAX_EVENTS, -1);
+        for (int i = 0; i < count; ++i)
+        {
+            void *ptr = events[i].data.ptr;
+            struct connection *conn = ptr;
+            if (ptr == &server.listen_fd)
+                accept_connections(&server);
+            else if (ptr == &server.done_fd)
+                finish_requests(&server);
+            else if (conn->closed)
+                continue; // by an earlier event of this batch
+            else if (events[i].events & EPOLLOUT)
+                send_response(&server, conn);
+            else if (events[i].events & EPOLLIN)
+                receive(&server, conn);
+            else if (events[i].events & (EPOLLHUP | EPOLLERR))
+                close_connection(&server, conn); // nowhere to send a response
+        }
+        while (server.closed)
+        {
+            struct connection *conn = server.closed;
+            server.closed = conn->next;
+            delete_connection(conn);
+        }
+    }
+}
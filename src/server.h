@@ -0,0 +1,27 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+// Server mode: a process that keeps program images loaded and runs jobs sent
+// over a Unix domain socket, so a client doesn't pay for starting the
+// simulator and reading the ELF file on every run. A connection sends
+// requests one at a time, each a line of words separated by spaces:
+//
+//   load elf-file
+//     -> image <id>
+//   run elf-file|#id max-insns[:max-seconds] stdin-length prog-args...
+//   <stdin-length bytes of input>
+//     -> <status> <exit-code> <instructions> <microseconds> <output-length>
+//        <output-length bytes of output>
+//
+// status is exit, fault (exit-code is the exception cause, the output ends
+// with its message), breakpoint (EBREAK without a trap handler), budget
+// (max-insns ran out, 0 means no limit), timeout (max-seconds of host time
+// went by, none if left out) or error (the output is the reason). Any
+// request can fail with "error <reason>".
+// An ELF file named in a run is loaded the first time and kept.
+
+// workers 0 means one per host core, preload are ELF files to load before
+// accepting connections. Returns only if the server can't start.
+int server_run(const char *socket_name, int workers, int num_preload, char *preload[]);
+
+#endif
@@ -2,286 +2,1402 @@
 #include "memory.h"
 #include "read_elf.h"
 #include "disassemble.h"
+#include "decode.h"
+#include "locality.h"
+#include "fpu.h"
+#include "vector.h"
+#include "csr.h"
+#include "clint.h"
+#include "syscall.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 
-struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file, struct symbols *symbols)
+// Register usage and dependency distance bookkeeping, only done when profiling
+static void profile_insn(struct Stat *stats, struct insn *insn, long int *last_write)
 {
-    struct Stat stats = {0};
-    int pc = start_addr;
-    int registers[32] = {0};
-    int running = 1;
+    unsigned int uses = insn_uses[insn->id];
+    unsigned int srcs[2] = {insn->rs1, insn->rs2};
+    for (int i = 0; i < 2; ++i)
+    {
+        unsigned int reg = srcs[i];
+        if (!(uses & (1 << i)) || reg == 0)
+            continue;
+        stats->reg_reads[reg]++;
+        if (last_write[reg])
+        {
+            long int dist = stats->insns + 1 - last_write[reg];
+            stats->dep_dist[dist < DEP_DIST_MAX ? dist : DEP_DIST_MAX]++;
+        }
+    }
+}
+
+// Decoded instructions are cached per 64 KiB page, one entry per halfword, so
+// each instruction is fetched, expanded and decoded only once. Stores into a
+// page with cached instructions drop the affected entries.
+#define DCACHE_ENTRIES 0x8000
+
+// blocks between looking for pending interrupts, when they are enabled
+#define IRQ_POLL_BLOCKS 32
+
+// instructions a hart runs before the next one gets its turn
+#define HART_QUANTUM 10000
+
+// blocks between looking at the host clock, when there is a watchdog
+#define WATCHDOG_BLOCKS 4096
+
+// Everything that belongs to one hart. The harts share memory, devices and
+// the decode cache.
+struct hart
+{
+    int pc;
+    int registers[32];
+    int running;
+    int hartid;
+    // LR/SC reservation. SC succeeds if the word still holds the value LR
+    // read, checked with a CAS, which is what other harts can observe.
+    int reservation_valid, reservation_addr, reservation_value;
+    int irq_poll;
+    int watchdog_poll;
+    struct machine *machine;
+    pthread_t thread;
+    struct fpu fpu;
+    struct vector_unit vec;
+    struct csr_state csrs;
+    struct Stat stats;
+    long int end;     // stop at this instruction count, where the current run ends
+    long int stop_at; // where run_hart stops, a watchpoint hit sets it to 0
+    int watch_hit;
+    long int last_write[32]; // instruction number + 1 of the last write to each register
+};
+
+struct watchpoint
+{
+    unsigned int addr, len;
+};
+
+struct machine
+{
+    struct memory *mem;
+    struct syscalls *syscalls;
+    struct clint clint;
+    struct insn **dcache;
+    struct hart *hart;
+    int harts;
+    int deterministic;
+    long int max_insns;
+    double max_seconds;
+    uint64_t deadline; // host_time when the watchdog stops the simulation, 0 for never
+    int exited;        // by an exit call, an exception without a handler, the budget or the watchdog
+    int paused;        // exited by a breakpoint or watchpoint, the next run goes on
+    unsigned int *breakpoints;
+    int num_breakpoints;
+    int step_over; // the breakpoint at a hart's pc is being run, leave it out when decoding
+    struct watchpoint *watchpoints;
+    int num_watchpoints;
+    pthread_mutex_t syscall_lock; // serializes the syscall hook between harts
+    syscall_hook syscall_hook;
+    void *hook_arg;
+    FILE *log_file;
+    struct symbols *symbols;
+    int profile;
+    struct locality *locality;
+};
+
+static int is_breakpoint(struct machine *m, unsigned int addr);
+
+// With harts on several threads the cache is shared: pages are installed
+// with a CAS, and an entry's len is written last so nobody sees it half done.
+// Breakpoints are put in when an instruction is decoded.
+static struct insn *fetch(struct machine *m, int pc)
+{
+    struct memory *mem = m->mem;
+    struct insn **dcache = m->dcache;
+    struct insn *page = __atomic_load_n(&dcache[(unsigned)pc >> 16], __ATOMIC_ACQUIRE);
+    if (page == NULL)
+    {
+        struct insn *new_page = calloc(DCACHE_ENTRIES, sizeof(struct insn));
+        if (__atomic_compare_exchange_n(&dcache[(unsigned)pc >> 16], &page, new_page, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+            page = new_page;
+        else
+            free(new_page);
+    }
+    struct insn *insn = &page[(pc & 0xffff) >> 1];
+    if (__atomic_load_n(&insn->len, __ATOMIC_ACQUIRE) == 0)
+    {
+        unsigned int instruction = memory_rd_h(mem, pc);
+        if ((instruction & 0x3) == 0x3)
+            instruction |= (unsigned)memory_rd_h(mem, pc + 2) << 16;
+        struct insn decoded;
+        decode(instruction, &decoded);
+        if (m->num_breakpoints && !m->step_over && is_breakpoint(m, pc))
+            decoded.id = INSN_BREAKPOINT;
+        int len = decoded.len;
+        decoded.len = 0;
+        *insn = decoded;
+        __atomic_store_n(&insn->len, len, __ATOMIC_RELEASE);
+    }
+    return insn;
+}
+
+// An instruction starting up to 2 bytes before addr may overlap the store.
+// Harts on other threads may be fetching from the same entries
+static void invalidate_code(struct insn **dcache, int addr, int size)
+{
+    for (int a = (addr & ~1) - 2; a < addr + size; a += 2)
+    {
+        struct insn *page = __atomic_load_n(&dcache[(unsigned)a >> 16], __ATOMIC_ACQUIRE);
+        if (page)
+            __atomic_store_n(&page[(a & 0xffff) >> 1].len, 0, __ATOMIC_RELEASE);
+    }
+}
+
+// FENCE.I: every decoded instruction is dropped, for all harts as they
+// share the cache
+static void invalidate_all_code(struct insn **dcache)
+{
+    for (int i = 0; i < 0x10000; ++i)
+    {
+        struct insn *page = __atomic_load_n(&dcache[i], __ATOMIC_ACQUIRE);
+        if (page)
+            for (int j = 0; j < DCACHE_ENTRIES; ++j)
+                __atomic_store_n(&page[j].len, 0, __ATOMIC_RELEASE);
+    }
+}
+
+// memory's invalidate function, for writes that don't come from the harts
+static void invalidate_written(void *arg, int addr, int len)
+{
+    struct machine *m = arg;
+    invalidate_code(m->dcache, addr, len);
+}
+
+// value stored by an AMO instruction given the old memory value and rs2
+static int amo_result(int id, int old, int val)
+{
+    switch (id)
+    {
+    case INSN_AMOSWAP_W:
+        return val;
+    case INSN_AMOADD_W:
+        return (unsigned)old + (unsigned)val;
+    case INSN_AMOXOR_W:
+        return old ^ val;
+    case INSN_AMOAND_W:
+        return old & val;
+    case INSN_AMOOR_W:
+        return old | val;
+    case INSN_AMOMIN_W:
+        return old < val ? old : val;
+    case INSN_AMOMAX_W:
+        return old > val ? old : val;
+    case INSN_AMOMINU_W:
+        return (unsigned)old < (unsigned)val ? old : val;
+    default: // INSN_AMOMAXU_W
+        return (unsigned)old > (unsigned)val ? old : val;
+    }
+}
+
+// AMO on the host word behind a RAM address, returns the old value
+static int amo_atomic(int id, int *word, int val)
+{
+    switch (id)
+    {
+    case INSN_AMOSWAP_W:
+        return __atomic_exchange_n(word, val, __ATOMIC_SEQ_CST);
+    case INSN_AMOADD_W:
+        return __atomic_fetch_add(word, val, __ATOMIC_SEQ_CST);
+    case INSN_AMOXOR_W:
+        return __atomic_fetch_xor(word, val, __ATOMIC_SEQ_CST);
+    case INSN_AMOAND_W:
+        return __atomic_fetch_and(word, val, __ATOMIC_SEQ_CST);
+    case INSN_AMOOR_W:
+        return __atomic_fetch_or(word, val, __ATOMIC_SEQ_CST);
+    default: // min and max have no host instruction
+    {
+        int old = __atomic_load_n(word, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(word, &old, amo_result(id, old, val), 1, __ATOMIC_SEQ_CST,
+                                            __ATOMIC_RELAXED))
+            ;
+        return old;
+    }
+    }
+}
+
+// A synchronous exception raised by the current instruction, cause -1 if none.
+// TRAP_BREAKPOINT stops the simulation at the instruction instead.
+#define TRAP_BREAKPOINT 0x1000
+struct trap
+{
+    int cause;
+    unsigned int tval;
+};
 
-    while (running)
+// an address in the device window that no device claims, checked in line
+// so RAM accesses don't pay for a call
+static inline int access_fault(struct memory *mem, int addr)
+{
+    return (unsigned)addr - IO_BASE < IO_SIZE && memory_unclaimed(mem, addr);
+}
+
+// Misaligned loads and stores raise an exception, and so do addresses in the
+// device window without a device. Everything else is up to memory, including
+// device accesses
+static inline int load(struct memory *mem, int addr, int size, struct trap *trap)
+{
+    if (addr & (size - 1) || access_fault(mem, addr))
     {
-        unsigned int instruction = memory_rd_w(mem, pc);
-        int next_pc = pc + 4;
+        trap->cause = addr & (size - 1) ? CAUSE_MISALIGNED_LOAD : CAUSE_LOAD_FAULT;
+        trap->tval = addr;
+        return 0;
+    }
+    return size == 4 ? memory_rd_w(mem, addr) : size == 2 ? memory_rd_h(mem, addr) : memory_rd_b(mem, addr);
+}
 
-        char disassembled[64];
-        disassemble(pc, instruction, disassembled, sizeof(disassembled), symbols);
+// sets trap and returns 1 if a store to addr would fault
+static inline int store_fault(struct memory *mem, int addr, int size, struct trap *trap)
+{
+    if (addr & (size - 1) || access_fault(mem, addr))
+    {
+        trap->cause = addr & (size - 1) ? CAUSE_MISALIGNED_STORE : CAUSE_STORE_FAULT;
+        trap->tval = addr;
+        return 1;
+    }
+    return 0;
+}
+
+static inline void store(struct memory *mem, int addr, int size, int value, struct trap *trap)
+{
+    if (store_fault(mem, addr, size, trap))
+        return;
+    if (size == 4)
+        memory_wr_w(mem, addr, value);
+    else if (size == 2)
+        memory_wr_h(mem, addr, value);
+    else
+        memory_wr_b(mem, addr, value);
+}
+
+// interrupts raised by devices for a hart, as mip bits
+static unsigned int device_interrupts(struct clint *clint, int hartid)
+{
+    unsigned int pending = clint->msip[hartid] ? MIP_MSIP : 0;
+    if (clint->mtimecmp[hartid] != ~0ull && clint_mtime(clint) >= clint->mtimecmp[hartid])
+        pending |= MIP_MTIP;
+    return pending;
+}
+
+// Enter the trap handler, returns its address
+static int take_trap(struct csr_state *csrs, unsigned int cause, unsigned int tval, int pc)
+{
+    csrs->mepc = pc;
+    csrs->mcause = cause;
+    csrs->mtval = tval;
+    // MPIE <- MIE, MIE <- 0
+    csrs->mstatus = (csrs->mstatus & ~(MSTATUS_MIE | MSTATUS_MPIE)) | ((csrs->mstatus & MSTATUS_MIE) << 4);
+    unsigned int base = csrs->mtvec & ~3u;
+    if ((csrs->mtvec & 1) && (cause & CAUSE_INTERRUPT))
+        return base + 4 * (cause & ~CAUSE_INTERRUPT);
+    return base;
+}
+
+const char *stop_name(enum stop_reason stop)
+{
+    static const char *names[] = {"running", "exit", "fault", "breakpoint", "watchpoint", "budget", "timeout"};
+    return names[stop];
+}
+
+// Read a CSR, returns 0 if there is no such CSR. Every instruction takes
+// one cycle, so cycle and instret are both the instruction count.
+static int csr_read(unsigned int csr, unsigned int *value, struct hart *hart, struct clint *clint)
+{
+    struct fpu *fpu = &hart->fpu;
+    struct csr_state *csrs = &hart->csrs;
+    switch (csr)
+    {
+    case CSR_FFLAGS: *value = fpu_fflags(fpu); break;
+    case CSR_FRM: *value = fpu->frm; break;
+    case CSR_FCSR: *value = fpu->frm << 5 | fpu_fflags(fpu); break;
+    case CSR_VSTART:
+    case CSR_VXSAT:
+    case CSR_VXRM:
+    case CSR_VCSR: *value = 0; break;
+    case CSR_CYCLE:
+    case CSR_INSTRET:
+    case CSR_MCYCLE:
+    case CSR_MINSTRET: *value = (uint64_t)hart->stats.insns; break;
+    case CSR_CYCLEH:
+    case CSR_INSTRETH:
+    case CSR_MCYCLEH:
+    case CSR_MINSTRETH: *value = (uint64_t)hart->stats.insns >> 32; break;
+    case CSR_TIME: *value = clint_mtime(clint); break;
+    case CSR_TIMEH: *value = clint_mtime(clint) >> 32; break;
+    case CSR_VL: *value = hart->vec.vl; break;
+    case CSR_VTYPE: *value = hart->vec.vtype; break;
+    case CSR_VLENB: *value = VLENB; break;
+    case CSR_MSTATUS: *value = csrs->mstatus | MSTATUS_MPP; break;
+    case CSR_MISA: // RV32IMAFDCV
+        *value = 1u << 30 | 1 << ('I' - 'A') | 1 << ('M' - 'A') | 1 << ('A' - 'A') | 1 << ('F' - 'A') |
+                 1 << ('D' - 'A') | 1 << ('C' - 'A') | 1 << ('V' - 'A');
+        break;
+    case CSR_MIE: *value = csrs->mie; break;
+    case CSR_MTVEC: *value = csrs->mtvec; break;
+    case CSR_MSCRATCH: *value = csrs->mscratch; break;
+    case CSR_MEPC: *value = csrs->mepc; break;
+    case CSR_MCAUSE: *value = csrs->mcause; break;
+    case CSR_MTVAL: *value = csrs->mtval; break;
+    case CSR_MIP: *value = csrs->mip | device_interrupts(clint, hart->hartid); break;
+    case CSR_MVENDORID:
+    case CSR_MARCHID:
+    case CSR_MIMPID: *value = 0; break;
+    case CSR_MHARTID: *value = hart->hartid; break;
+    default: return 0;
+    }
+    return 1;
+}
+
+// Write a CSR, returns 0 if it doesn't exist or is read-only. The fixed
+// point CSRs of the vector extension, misa and the machine counters are
+// accepted and ignored, as is mip since all its bits come from devices.
+static int csr_write(unsigned int csr, unsigned int value, struct fpu *fpu, struct csr_state *csrs)
+{
+    switch (csr)
+    {
+    case CSR_FFLAGS: fpu_set_fflags(fpu, value & 0x1f); break;
+    case CSR_FRM: fpu->frm = value & 0x7; break;
+    case CSR_FCSR:
+        fpu_set_fflags(fpu, value & 0x1f);
+        fpu->frm = (value >> 5) & 0x7;
+        break;
+    case CSR_VSTART:
+    case CSR_VXSAT:
+    case CSR_VXRM:
+    case CSR_VCSR:
+    case CSR_MISA:
+    case CSR_MIP:
+    case CSR_MCYCLE:
+    case CSR_MINSTRET:
+    case CSR_MCYCLEH:
+    case CSR_MINSTRETH: break;
+    case CSR_MSTATUS: csrs->mstatus = value & (MSTATUS_MIE | MSTATUS_MPIE); break;
+    case CSR_MIE: csrs->mie = value & (MIP_MSIP | MIP_MTIP | MIP_MEIP); break;
+    case CSR_MTVEC: csrs->mtvec = value & ~2u; break; // direct or vectored
+    case CSR_MSCRATCH: csrs->mscratch = value; break;
+    case CSR_MEPC: csrs->mepc = value & ~1u; break;
+    case CSR_MCAUSE: csrs->mcause = value; break;
+    case CSR_MTVAL: csrs->mtval = value; break;
+    default: return 0;
+    }
+    return 1;
+}
+
+// The hart running on this thread, for the watchpoint check
+static __thread struct hart *this_hart;
+
+// Called by memory after a write to a watched page. A hit ends the hart's
+// run after the instruction doing the write.
+static void watch_write(void *arg, int addr, int size)
+{
+    struct machine *m = arg;
+    struct hart *hart = this_hart;
+    if (hart == NULL || hart->machine != m)
+        return;
+    for (int i = 0; i < m->num_watchpoints; ++i)
+    {
+        struct watchpoint *w = &m->watchpoints[i];
+        if ((unsigned)addr - w->addr < w->len || w->addr - (unsigned)addr < (unsigned)size)
+        {
+            hart->watch_hit = 1;
+            hart->stats.watch_addr = addr;
+            hart->stop_at = 0;
+            return;
+        }
+    }
+}
+
+// Run a hart for up to quantum instructions, or until it or the machine stops
+static void run_hart(struct hart *hart, struct machine *m, long int quantum)
+{
+    struct memory *mem = m->mem;
+    struct insn **dcache = m->dcache;
+    FILE *log_file = m->log_file;
+    struct symbols *symbols = m->symbols;
+    int profile = m->profile;
+    struct locality *locality = m->locality;
+    struct Stat *stats = &hart->stats;
+    struct fpu *fpu = &hart->fpu;
+    struct vector_unit *vec = &hart->vec;
+    struct csr_state *csrs = &hart->csrs;
+    int *registers = hart->registers;
+    long int *last_write = hart->last_write;
+    int pc = hart->pc;
+    int running = 1;
+    uint64_t deadline = m->deadline;
+    long int end = quantum < hart->end - stats->insns ? stats->insns + quantum : hart->end;
+    if (m->max_insns && end > m->max_insns)
+        end = m->max_insns;
+    hart->stop_at = end;
+    this_hart = hart;
+
+    while (running && stats->insns < hart->stop_at)
+    {
+        struct insn insn = *fetch(m, pc);
+        int next_pc = pc + insn.len;
 
         if (log_file)
-            fprintf(log_file, "%6ld     %05x : %08x  %-20s", stats.insns, pc, instruction, disassembled);
-
-        unsigned int opcode = instruction & 0x7f;
-        unsigned int rd = (instruction >> 7) & 0x1f;
-        unsigned int funct3 = (instruction >> 12) & 0x7;
-        unsigned int rs1 = (instruction >> 15) & 0x1f;
-        unsigned int rs2 = (instruction >> 20) & 0x1f;
-        unsigned int funct7 = (instruction >> 25) & 0x7f;
-
-        int imm_i = ((int)instruction) >> 20;
-        int imm_s = (((int)instruction) >> 20 & ~0x1f) | ((instruction >> 7) & 0x1f);
-        int imm_b = ((int)instruction >> 31 << 12) | ((instruction >> 7) & 0x1e) |
-                    ((instruction >> 20) & 0x7e0) | ((instruction << 4) & 0x800);
-        int imm_u = instruction & 0xfffff000;
-        int imm_j = ((int)instruction >> 31 << 20) | (instruction & 0xff000) |
-                    ((instruction >> 9) & 0x800) | ((instruction >> 20) & 0x7fe);
-
-        int rs1_val = registers[rs1], rs2_val = registers[rs2];
-        int reg_write = 0, reg_write_value = 0;
-
-        switch (opcode)
         {
-        case 0x33: // R-type ALU operations
-            if (rd != 0)
-            {
-                reg_write = 1;
-                if (funct7 == 0x01)
-                { // M-extension instructions
-                    switch (funct3)
-                    {
-                    case 0x0:
-                        reg_write_value = rs1_val * rs2_val;
-                        break; // MUL
-                    case 0x1:
-                        reg_write_value = ((long long)rs1_val * (long long)rs2_val) >> 32;
-                        break; // MULH
-                    case 0x4:
-                        reg_write_value = rs2_val ? (int)rs1_val / (int)rs2_val : -1;
-                        break; // DIV
-                    case 0x5:
-                        reg_write_value = rs2_val ? (unsigned)rs1_val / (unsigned)rs2_val : (unsigned)-1;
-                        break; // DIVU
-                    case 0x6:
-                        reg_write_value = rs2_val ? (int)rs1_val % (int)rs2_val : rs1_val;
-                        break; // REM
-                    case 0x7:
-                        reg_write_value = rs2_val ? (unsigned)rs1_val % (unsigned)rs2_val : (unsigned) rs1_val;
-                        break; // REMU
-                    }
-                }
-                else
-                {
-                    switch (funct3)
-                    {
-                    case 0x0:
-                        reg_write_value = (funct7 == 0x20) ? rs1_val - rs2_val : rs1_val + rs2_val;
-                        break; // ADD/SUB
-                    case 0x1:
-                        reg_write_value = rs1_val << (rs2_val & 0x1f);
-                        break; // SLL
-                    case 0x2:
-                        reg_write_value = (int)rs1_val < (int)rs2_val;
-                        break; // SLT
-                    case 0x3:
-                        reg_write_value = (unsigned)rs1_val < (unsigned)rs2_val;
-                        break; // SLTU
-                    case 0x4:
-                        reg_write_value = rs1_val ^ rs2_val;
-                        break; // XOR
-                    case 0x5:
-                        reg_write_value = (funct7 == 0x20) ? (int)rs1_val >> (rs2_val & 0x1f) : (int)(unsigned)rs1_val >> (rs2_val & 0x1f);
-                        break; // SRL/SRA
-                    case 0x6:
-                        reg_write_value = rs1_val | rs2_val;
-                        break; // OR
-                    case 0x7:
-                        reg_write_value = rs1_val & rs2_val;
-                        break; // AND
-                    }
-                }
-            }
+            char disassembled[64];
+            disassemble(pc, insn.raw, disassembled, sizeof(disassembled), symbols);
+            if (m->harts > 1)
+                fprintf(log_file, "[%d] ", hart->hartid);
+            if (insn.len == 2)
+                fprintf(log_file, "%6ld     %05x :     %04x  %-20s", stats->insns, pc, insn.raw, disassembled);
+            else
+                fprintf(log_file, "%6ld     %05x : %08x  %-20s", stats->insns, pc, insn.raw, disassembled);
+        }
+
+        stats->mix[insn.id]++;
+        stats->compressed += insn.len == 2;
+        if (profile)
+            profile_insn(stats, &insn, last_write);
+
+        unsigned int rd = insn.rd;
+        int imm = insn.imm;
+        int rs1_val = registers[insn.rs1], rs2_val = registers[insn.rs2];
+        int reg_write = 1, reg_write_value = 0;
+        int take_branch = 0;
+        struct trap trap = {-1, 0};
+
+        switch (insn.id)
+        {
+        // R-type ALU operations
+        case INSN_ADD:
+            reg_write_value = rs1_val + rs2_val;
+            break;
+        case INSN_SUB:
+            reg_write_value = rs1_val - rs2_val;
+            break;
+        case INSN_SLL:
+            reg_write_value = rs1_val << (rs2_val & 0x1f);
+            break;
+        case INSN_SLT:
+            reg_write_value = rs1_val < rs2_val;
+            break;
+        case INSN_SLTU:
+            reg_write_value = (unsigned)rs1_val < (unsigned)rs2_val;
+            break;
+        case INSN_XOR:
+            reg_write_value = rs1_val ^ rs2_val;
+            break;
+        case INSN_SRL:
+            reg_write_value = (unsigned)rs1_val >> (rs2_val & 0x1f);
+            break;
+        case INSN_SRA:
+            reg_write_value = rs1_val >> (rs2_val & 0x1f);
+            break;
+        case INSN_OR:
+            reg_write_value = rs1_val | rs2_val;
+            break;
+        case INSN_AND:
+            reg_write_value = rs1_val & rs2_val;
+            break;
+
+        // Zba/Zbb/Zbs bit manipulation, mapped onto host builtins
+        case INSN_SH1ADD:
+            reg_write_value = ((unsigned)rs1_val << 1) + rs2_val;
+            break;
+        case INSN_SH2ADD:
+            reg_write_value = ((unsigned)rs1_val << 2) + rs2_val;
+            break;
+        case INSN_SH3ADD:
+            reg_write_value = ((unsigned)rs1_val << 3) + rs2_val;
+            break;
+        case INSN_ANDN:
+            reg_write_value = rs1_val & ~rs2_val;
+            break;
+        case INSN_ORN:
+            reg_write_value = rs1_val | ~rs2_val;
+            break;
+        case INSN_XNOR:
+            reg_write_value = ~(rs1_val ^ rs2_val);
+            break;
+        case INSN_CLZ:
+            reg_write_value = rs1_val ? __builtin_clz(rs1_val) : 32;
+            break;
+        case INSN_CTZ:
+            reg_write_value = rs1_val ? __builtin_ctz(rs1_val) : 32;
+            break;
+        case INSN_CPOP:
+            reg_write_value = __builtin_popcount(rs1_val);
+            break;
+        case INSN_MIN:
+            reg_write_value = rs1_val < rs2_val ? rs1_val : rs2_val;
+            break;
+        case INSN_MINU:
+            reg_write_value = (unsigned)rs1_val < (unsigned)rs2_val ? rs1_val : rs2_val;
+            break;
+        case INSN_MAX:
+            reg_write_value = rs1_val > rs2_val ? rs1_val : rs2_val;
+            break;
+        case INSN_MAXU:
+            reg_write_value = (unsigned)rs1_val > (unsigned)rs2_val ? rs1_val : rs2_val;
+            break;
+        case INSN_SEXT_B:
+            reg_write_value = (signed char)rs1_val;
+            break;
+        case INSN_SEXT_H:
+            reg_write_value = (short)rs1_val;
+            break;
+        case INSN_ZEXT_H:
+            reg_write_value = (unsigned short)rs1_val;
+            break;
+        case INSN_ROL:
+            reg_write_value = ((unsigned)rs1_val << (rs2_val & 0x1f)) | ((unsigned)rs1_val >> (-rs2_val & 0x1f));
+            break;
+        case INSN_ROR:
+            reg_write_value = ((unsigned)rs1_val >> (rs2_val & 0x1f)) | ((unsigned)rs1_val << (-rs2_val & 0x1f));
+            break;
+        case INSN_RORI:
+            reg_write_value = ((unsigned)rs1_val >> imm) | ((unsigned)rs1_val << (-imm & 0x1f));
+            break;
+        case INSN_ORC_B:
+        {
+            unsigned int v = rs1_val;
+            // set every bit of the bytes that are non-zero
+            v = ((v & 0x7f7f7f7f) + 0x7f7f7f7f) | v;
+            reg_write_value = ((v & 0x80808080) >> 7) * 0xff;
+            break;
+        }
+        case INSN_REV8:
+            reg_write_value = __builtin_bswap32(rs1_val);
+            break;
+        case INSN_BCLR:
+            reg_write_value = rs1_val & ~(1u << (rs2_val & 0x1f));
+            break;
+        case INSN_BCLRI:
+            reg_write_value = rs1_val & ~(1u << imm);
+            break;
+        case INSN_BEXT:
+            reg_write_value = ((unsigned)rs1_val >> (rs2_val & 0x1f)) & 1;
+            break;
+        case INSN_BEXTI:
+            reg_write_value = ((unsigned)rs1_val >> imm) & 1;
+            break;
+        case INSN_BINV:
+            reg_write_value = rs1_val ^ (1u << (rs2_val & 0x1f));
+            break;
+        case INSN_BINVI:
+            reg_write_value = rs1_val ^ (1u << imm);
+            break;
+        case INSN_BSET:
+            reg_write_value = rs1_val | (1u << (rs2_val & 0x1f));
+            break;
+        case INSN_BSETI:
+            reg_write_value = rs1_val | (1u << imm);
             break;
 
-        case 0x13: // I-type immediate operations
-            if (rd != 0)
+        // M-extension instructions
+        case INSN_MUL:
+            reg_write_value = (unsigned)rs1_val * (unsigned)rs2_val;
+            break;
+        case INSN_MULH:
+            reg_write_value = ((long long)rs1_val * (long long)rs2_val) >> 32;
+            break;
+        case INSN_MULHSU:
+            reg_write_value = ((long long)rs1_val * (long long)(unsigned)rs2_val) >> 32;
+            break;
+        case INSN_MULHU:
+            reg_write_value = ((unsigned long long)(unsigned)rs1_val * (unsigned)rs2_val) >> 32;
+            break;
+        case INSN_DIV:
+            if (rs2_val == 0)
+                reg_write_value = -1;
+            else if (rs1_val == (int)0x80000000 && rs2_val == -1)
+                reg_write_value = rs1_val; // overflow, would trap on the host
+            else
+                reg_write_value = rs1_val / rs2_val;
+            break;
+        case INSN_DIVU:
+            reg_write_value = rs2_val ? (unsigned)rs1_val / (unsigned)rs2_val : (unsigned)-1;
+            break;
+        case INSN_REM:
+            if (rs2_val == 0)
+                reg_write_value = rs1_val;
+            else if (rs1_val == (int)0x80000000 && rs2_val == -1)
+                reg_write_value = 0;
+            else
+                reg_write_value = rs1_val % rs2_val;
+            break;
+        case INSN_REMU:
+            reg_write_value = rs2_val ? (unsigned)rs1_val % (unsigned)rs2_val : (unsigned)rs1_val;
+            break;
+
+        // I-type immediate operations
+        case INSN_ADDI:
+            reg_write_value = rs1_val + imm;
+            break;
+        case INSN_SLLI:
+            reg_write_value = rs1_val << imm;
+            break;
+        case INSN_SLTI:
+            reg_write_value = rs1_val < imm;
+            break;
+        case INSN_SLTIU:
+            reg_write_value = (unsigned)rs1_val < (unsigned)imm;
+            break;
+        case INSN_XORI:
+            reg_write_value = rs1_val ^ imm;
+            break;
+        case INSN_SRLI:
+            reg_write_value = (unsigned)rs1_val >> imm;
+            break;
+        case INSN_SRAI:
+            reg_write_value = rs1_val >> imm;
+            break;
+        case INSN_ORI:
+            reg_write_value = rs1_val | imm;
+            break;
+        case INSN_ANDI:
+            reg_write_value = rs1_val & imm;
+            break;
+
+        // Load instructions
+        case INSN_LB:
+            reg_write_value = (int)(signed char)load(mem, rs1_val + imm, 1, &trap);
+            break;
+        case INSN_LH:
+            reg_write_value = (int)(signed short)load(mem, rs1_val + imm, 2, &trap);
+            break;
+        case INSN_LW:
+            reg_write_value = load(mem, rs1_val + imm, 4, &trap);
+            break;
+        case INSN_LBU:
+            reg_write_value = (unsigned char)load(mem, rs1_val + imm, 1, &trap);
+            break;
+        case INSN_LHU:
+            reg_write_value = (unsigned short)load(mem, rs1_val + imm, 2, &trap);
+            break;
+
+        // Store instructions
+        case INSN_SB:
+            reg_write = 0;
+            store(mem, rs1_val + imm, 1, rs2_val, &trap);
+            if (dcache[(unsigned)(rs1_val + imm) >> 16])
+                invalidate_code(dcache, rs1_val + imm, 1);
+            if (log_file)
+                fprintf(log_file, "    M[%x] <- %x", rs1_val + imm, rs2_val);
+            break;
+        case INSN_SH:
+            reg_write = 0;
+            store(mem, rs1_val + imm, 2, rs2_val, &trap);
+            if (dcache[(unsigned)(rs1_val + imm) >> 16])
+                invalidate_code(dcache, rs1_val + imm, 2);
+            if (log_file)
+                fprintf(log_file, "    M[%x] <- %x", rs1_val + imm, rs2_val);
+            break;
+        case INSN_SW:
+            reg_write = 0;
+            store(mem, rs1_val + imm, 4, rs2_val, &trap);
+            if (dcache[(unsigned)(rs1_val + imm) >> 16])
+                invalidate_code(dcache, rs1_val + imm, 4);
+            if (log_file)
+                fprintf(log_file, "    M[%x] <- %x", rs1_val + imm, rs2_val);
+            break;
+
+        // F and D extension loads and stores, the rest is done by fpu_execute
+        case INSN_FLW:
+        {
+            reg_write = 0;
+            unsigned int lo = load(mem, rs1_val + imm, 4, &trap);
+            if (trap.cause >= 0)
+                break;
+            fpu->regs[rd] = 0xffffffff00000000ull | lo;
+            if (log_file)
+                fprintf(log_file, "F[%2d] <- %llx", rd, (unsigned long long)fpu->regs[rd]);
+            break;
+        }
+        case INSN_FLD:
+        {
+            reg_write = 0;
+            unsigned int lo = load(mem, rs1_val + imm, 4, &trap);
+            if (trap.cause >= 0)
+                break;
+            unsigned int hi = load(mem, rs1_val + imm + 4, 4, &trap);
+            if (trap.cause >= 0)
+                break;
+            fpu->regs[rd] = lo | (uint64_t)hi << 32;
+            if (log_file)
+                fprintf(log_file, "F[%2d] <- %llx", rd, (unsigned long long)fpu->regs[rd]);
+            break;
+        }
+        case INSN_FSW:
+            reg_write = 0;
+            store(mem, rs1_val + imm, 4, (int)fpu->regs[insn.rs2], &trap);
+            if (dcache[(unsigned)(rs1_val + imm) >> 16])
+                invalidate_code(dcache, rs1_val + imm, 4);
+            if (log_file)
+                fprintf(log_file, "    M[%x] <- %x", rs1_val + imm, (unsigned)fpu->regs[insn.rs2]);
+            break;
+        case INSN_FSD:
+            reg_write = 0;
+            // a fault on either word stores neither
+            if (store_fault(mem, rs1_val + imm, 4, &trap) || store_fault(mem, rs1_val + imm + 4, 4, &trap))
+                break;
+            store(mem, rs1_val + imm, 4, (int)fpu->regs[insn.rs2], &trap);
+            store(mem, rs1_val + imm + 4, 4, (int)(fpu->regs[insn.rs2] >> 32), &trap);
+            if (dcache[(unsigned)(rs1_val + imm) >> 16])
+                invalidate_code(dcache, rs1_val + imm, 8);
+            if (log_file)
+                fprintf(log_file, "    M[%x] <- %llx", rs1_val + imm, (unsigned long long)fpu->regs[insn.rs2]);
+            break;
+
+        // A-extension
+        case INSN_LR_W:
+        {
+            if (rs1_val & 3 || access_fault(mem, rs1_val))
             {
-                reg_write = 1;
-                switch (funct3)
-                {
-                case 0x0:
-                    reg_write_value = rs1_val + imm_i;
-                    break; // ADDI
-                case 0x1:
-                    reg_write_value = rs1_val << (imm_i & 0x1f);
-                    break; // SLLI
-                case 0x2:
-                    reg_write_value = (int)rs1_val < imm_i;
-                    break; // SLTI
-                case 0x3:
-                    reg_write_value = (unsigned)rs1_val < (unsigned)imm_i;
-                    break; // SLTIU
-                case 0x4:
-                    reg_write_value = rs1_val ^ imm_i;
-                    break; // XORI
-                case 0x5:
-                    reg_write_value = (imm_i & 0x400) ? (int)rs1_val >> (imm_i & 0x1f) : (int)(unsigned)rs1_val >> (imm_i & 0x1f);
-                    break; // SRLI/SRAI
-                case 0x6:
-                    reg_write_value = rs1_val | imm_i;
-                    break; // ORI
-                case 0x7:
-                    reg_write_value = rs1_val & imm_i;
-                    break; // ANDI
-                }
+                trap.cause = rs1_val & 3 ? CAUSE_MISALIGNED_LOAD : CAUSE_LOAD_FAULT;
+                trap.tval = rs1_val;
+                break;
             }
+            int len;
+            int *word = memory_page_ptr(mem, rs1_val, &len);
+            reg_write_value = word ? __atomic_load_n(word, __ATOMIC_SEQ_CST) : memory_rd_w(mem, rs1_val);
+            hart->reservation_valid = 1;
+            hart->reservation_addr = rs1_val;
+            hart->reservation_value = reg_write_value;
             break;
-
-        case 0x03: // Load instructions
-            if (rd != 0)
+        }
+        case INSN_SC_W:
+        {
+            if (store_fault(mem, rs1_val, 4, &trap))
+                break;
+            reg_write_value = 1;
+            if (hart->reservation_valid && hart->reservation_addr == rs1_val)
             {
-                reg_write = 1;
-                int addr = rs1_val + imm_i;
-                switch (funct3)
+                int len, expected = hart->reservation_value;
+                int *word = memory_page_ptr(mem, rs1_val, &len);
+                if (word == NULL)
                 {
-                case 0x0:
-                    reg_write_value = (int)(signed char)memory_rd_b(mem, addr);
-                    break; // LB
-                case 0x1:
-                    reg_write_value = (int)(signed short)memory_rd_h(mem, addr);
-                    break; // LH
-                case 0x2:
-                    reg_write_value = memory_rd_w(mem, addr);
-                    break; // LW
-                case 0x4:
-                    reg_write_value = (unsigned char)memory_rd_b(mem, addr);
-                    break; // LBU
-                case 0x5:
-                    reg_write_value = (unsigned short)memory_rd_h(mem, addr);
-                    break; // LHU
+                    memory_wr_w(mem, rs1_val, rs2_val);
+                    reg_write_value = 0;
                 }
+                else if (__atomic_compare_exchange_n(word, &expected, rs2_val, 0, __ATOMIC_SEQ_CST,
+                                                     __ATOMIC_SEQ_CST))
+                    reg_write_value = 0;
             }
+            if (reg_write_value == 0)
+            {
+                if (dcache[(unsigned)rs1_val >> 16])
+                    invalidate_code(dcache, rs1_val, 4);
+                if (log_file)
+                    fprintf(log_file, "    M[%x] <- %x", rs1_val, rs2_val);
+            }
+            hart->reservation_valid = 0;
             break;
-
-        case 0x23: // Store instructions
+        }
+        case INSN_AMOSWAP_W:
+        case INSN_AMOADD_W:
+        case INSN_AMOXOR_W:
+        case INSN_AMOAND_W:
+        case INSN_AMOOR_W:
+        case INSN_AMOMIN_W:
+        case INSN_AMOMAX_W:
+        case INSN_AMOMINU_W:
+        case INSN_AMOMAXU_W:
         {
-            int addr = rs1_val + imm_s;
-            switch (funct3)
+            if (store_fault(mem, rs1_val, 4, &trap))
+                break;
+            int len;
+            int *word = memory_page_ptr(mem, rs1_val, &len);
+            if (word)
+                reg_write_value = amo_atomic(insn.id, word, rs2_val);
+            else // a device register
             {
-            case 0x0:
-                memory_wr_b(mem, addr, rs2_val);
-                break; // SB
-            case 0x1:
-                memory_wr_h(mem, addr, rs2_val);
-                break; // SH
-            case 0x2:
-                memory_wr_w(mem, addr, rs2_val);
-                break; // SW
+                reg_write_value = memory_rd_w(mem, rs1_val);
+                memory_wr_w(mem, rs1_val, amo_result(insn.id, reg_write_value, rs2_val));
             }
+            int result = amo_result(insn.id, reg_write_value, rs2_val);
+            if (dcache[(unsigned)rs1_val >> 16])
+                invalidate_code(dcache, rs1_val, 4);
             if (log_file)
-                fprintf(log_file, "    M[%x] <- %x", addr, rs2_val);
+                fprintf(log_file, "    M[%x] <- %x", rs1_val, result);
             break;
         }
 
-        case 0x63: // Branch instructions
-        {
-            int take_branch = 0;
-            switch (funct3)
+        // Branch instructions
+        case INSN_BEQ:
+            take_branch = (rs1_val == rs2_val);
+            break;
+        case INSN_BNE:
+            take_branch = (rs1_val != rs2_val);
+            break;
+        case INSN_BLT:
+            take_branch = (rs1_val < rs2_val);
+            break;
+        case INSN_BGE:
+            take_branch = (rs1_val >= rs2_val);
+            break;
+        case INSN_BLTU:
+            take_branch = ((unsigned)rs1_val < (unsigned)rs2_val);
+            break;
+        case INSN_BGEU:
+            take_branch = ((unsigned)rs1_val >= (unsigned)rs2_val);
+            break;
+
+        case INSN_LUI:
+            reg_write_value = imm;
+            break;
+        case INSN_AUIPC:
+            reg_write_value = pc + imm;
+            break;
+
+        case INSN_JAL:
+            reg_write_value = pc + insn.len;
+            next_pc = pc + imm;
+            break;
+        case INSN_JALR:
+            reg_write_value = pc + insn.len;
+            next_pc = (rs1_val + imm) & ~1;
+            break;
+
+        case INSN_ECALL:
+            reg_write = 0;
+            // once the program has a trap handler, ECALL goes to it, except
+            // for exit so bare-metal programs can still end the simulation
+            if (csrs->mtvec && registers[17] != SYS_EXIT_OLD && registers[17] != SYS_EXIT)
             {
-            case 0x0:
-                take_branch = (rs1_val == rs2_val);
-                break; // BEQ
-            case 0x1:
-                take_branch = (rs1_val != rs2_val);
-                break; // BNE
-            case 0x4:
-                take_branch = ((int)rs1_val < (int)rs2_val);
-                break; // BLT
-            case 0x5:
-                take_branch = ((int)rs1_val >= (int)rs2_val);
-                break; // BGE
-            case 0x6:
-                take_branch = ((unsigned)rs1_val < (unsigned)rs2_val);
-                break; // BLTU
-            case 0x7:
-                take_branch = ((unsigned)rs1_val >= (unsigned)rs2_val);
-                break; // BGEU
+                trap.cause = CAUSE_ECALL_M;
+                break;
             }
-            if (take_branch)
+            // syscall_execute locks its own state and not across host I/O,
+            // so only the hook is serialized
+            int handled = -1;
+            if (m->syscall_hook)
             {
-                next_pc = pc + imm_b;
-                if (log_file)
-                    fprintf(log_file, "    {T}");
+                pthread_mutex_lock(&m->syscall_lock);
+                handled = m->syscall_hook(m->hook_arg, mem, registers);
+                pthread_mutex_unlock(&m->syscall_lock);
             }
-            break;
-        }
-
-        case 0x37: // LUI
-            if (rd != 0)
+            if (!(handled >= 0 ? handled : syscall_execute(m->syscalls, mem, registers)))
             {
-                reg_write = 1;
-                reg_write_value = imm_u;
+                running = 0;
+                stats->stop = STOP_EXIT;
+                stats->exit_code = registers[10];
+                __atomic_store_n(&m->exited, 1, __ATOMIC_RELAXED);
             }
             break;
-        case 0x17: // AUIPC
-            if (rd != 0)
+        case INSN_EBREAK: // no debugger to hand over to, stop unless handled
+            reg_write = 0;
+            if (csrs->mtvec)
+            {
+                trap.cause = CAUSE_BREAKPOINT;
+                trap.tval = pc;
+            }
+            else
             {
-                reg_write = 1;
-                reg_write_value = pc + imm_u;
+                running = 0;
+                stats->stop = STOP_BREAKPOINT;
             }
             break;
+        case INSN_BREAKPOINT: // see machine_add_breakpoint
+            trap.cause = TRAP_BREAKPOINT;
+            break;
+        case INSN_MRET:
+            reg_write = 0;
+            next_pc = csrs->mepc;
+            // MIE <- MPIE, MPIE <- 1
+            csrs->mstatus = (csrs->mstatus & ~MSTATUS_MIE) | ((csrs->mstatus & MSTATUS_MPIE) >> 4) | MSTATUS_MPIE;
+            break;
+        case INSN_WFI: // check for interrupts right away
+            reg_write = 0;
+            hart->irq_poll = 1;
+            break;
 
-        case 0x6F: // JAL
-            if (rd != 0)
+        // Zicsr, the immediate forms have their value in the rs1 field
+        case INSN_CSRRW:
+        case INSN_CSRRS:
+        case INSN_CSRRC:
+        case INSN_CSRRWI:
+        case INSN_CSRRSI:
+        case INSN_CSRRCI:
+        {
+            unsigned int csr = imm & 0xfff, old, value;
+            unsigned int src = insn.id >= INSN_CSRRWI ? insn.rs1 : (unsigned)rs1_val;
+            int id = insn.id >= INSN_CSRRWI ? insn.id - INSN_CSRRWI + INSN_CSRRW : insn.id;
+            if (!csr_read(csr, &old, hart, &m->clint))
             {
-                reg_write = 1;
-                reg_write_value = pc + 4;
+                trap.cause = CAUSE_ILLEGAL_INSTRUCTION;
+                trap.tval = insn.raw;
+                break;
             }
-            next_pc = pc + imm_j;
-            break;
-        case 0x67: // JALR
-            if (rd != 0)
+            // csrrs/csrrc with x0 or 0 only read
+            if (id == INSN_CSRRW || insn.rs1 != 0)
             {
-                reg_write = 1;
-                reg_write_value = pc + 4;
+                value = id == INSN_CSRRW ? src : id == INSN_CSRRS ? old | src : old & ~src;
+                if (CSR_READ_ONLY(csr) || !csr_write(csr, value, fpu, csrs))
+                {
+                    trap.cause = CAUSE_ILLEGAL_INSTRUCTION;
+                    trap.tval = insn.raw;
+                    break;
+                }
             }
-            next_pc = (rs1_val + imm_i) & ~1;
+            reg_write_value = old;
             break;
+        }
 
-        case 0x73: // System calls (ECALL)
-            switch (registers[17])
+        default:
+            if (insn_classes[insn.id] == CLASS_FP)
             {
-            case 1:
-                registers[10] = getchar();
-                break; // SYSCALL_GETCHAR
-            case 2:
-                putchar(registers[10]);
-                break; // SYSCALL_PUTCHAR
-            case 3:
-            case 93:
-                running = 0;
-                break; // SYSCALL_EXIT
+                reg_write = fpu_execute(fpu, &insn, rs1_val, &reg_write_value);
+                if (!reg_write && log_file)
+                    fprintf(log_file, "F[%2d] <- %llx", rd, (unsigned long long)fpu->regs[rd]);
+            }
+            else if (insn_classes[insn.id] == CLASS_VECTOR)
+            {
+                // vector stores invalidate the code they overwrite through
+                // memory's invalidate function
+                reg_write = vector_execute(vec, mem, &insn, rs1_val, rs2_val, &reg_write_value);
+                if (reg_write == VECTOR_ILLEGAL)
+                {
+                    trap.cause = CAUSE_ILLEGAL_INSTRUCTION;
+                    trap.tval = insn.raw;
+                }
+                else if (reg_write == VECTOR_FAULT)
+                {
+                    trap.cause = vec->fault_cause;
+                    trap.tval = vec->fault_addr;
+                }
+            }
+            else if (insn.id == INSN_ILLEGAL)
+            {
+                trap.cause = CAUSE_ILLEGAL_INSTRUCTION;
+                trap.tval = insn.raw;
+            }
+            else if (insn.id == INSN_FENCE_I)
+            {
+                reg_write = 0;
+                invalidate_all_code(dcache);
             }
+            else // FENCE
+                reg_write = 0;
             break;
+        }
 
-        default:
-            break;
+        if (trap.cause >= 0)
+        {
+            if (trap.cause == TRAP_BREAKPOINT)
+            {
+                stats->mix[INSN_BREAKPOINT]--;
+                stats->stop = STOP_BREAKPOINT;
+                if (log_file)
+                    fprintf(log_file, "    {breakpoint}\n");
+                m->paused = 1;
+                __atomic_store_n(&m->exited, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            reg_write = 0;
+            take_branch = 0;
+            stats->exceptions++;
+            if (log_file)
+                fprintf(log_file, "    {%s}", exception_name(trap.cause));
+            if (csrs->mtvec == 0)
+            {
+                // no handler installed, give up like a crashed program
+                if (log_file)
+                    fprintf(log_file, "\n");
+                stats->stop = STOP_FAULT;
+                stats->fatal_cause = trap.cause;
+                stats->fatal_pc = pc;
+                stats->fatal_tval = trap.tval;
+                __atomic_store_n(&m->exited, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            next_pc = take_trap(csrs, trap.cause, trap.tval, pc);
         }
 
-        if (reg_write)
+        if (locality)
+        {
+            int cls = insn_classes[insn.id];
+            if (cls == CLASS_LOAD || cls == CLASS_STORE)
+                locality_access(locality, rs1_val + imm, cls == CLASS_STORE);
+            else if (cls == CLASS_ATOMIC)
+                locality_access(locality, rs1_val, insn.id != INSN_LR_W);
+        }
+
+        if (take_branch)
+        {
+            next_pc = pc + imm;
+            stats->taken_branches++;
+            if (log_file)
+                fprintf(log_file, "    {T}");
+        }
+
+        if (reg_write && rd != 0)
         {
             registers[rd] = reg_write_value;
+            if (profile)
+            {
+                stats->reg_writes[rd]++;
+                last_write[rd] = stats->insns + 1;
+            }
             if (log_file)
                 fprintf(log_file, "R[%2d] <- %x", rd, reg_write_value);
         }
 
+        // Interrupts are only taken at the end of a block, and the devices
+        // are only looked at every IRQ_POLL_BLOCKS blocks
+        if ((csrs->mstatus & MSTATUS_MIE) && csrs->mie)
+        {
+            int cls = insn_classes[insn.id];
+            if ((cls == CLASS_BRANCH || cls == CLASS_JUMP || cls == CLASS_SYSTEM) && --hart->irq_poll <= 0)
+            {
+                unsigned int pending = (csrs->mip | device_interrupts(&m->clint, hart->hartid)) & csrs->mie;
+                hart->irq_poll = IRQ_POLL_BLOCKS;
+                if (pending)
+                {
+                    unsigned int cause = pending & MIP_MEIP ? 11 : pending & MIP_MSIP ? 3 : 7;
+                    next_pc = take_trap(csrs, CAUSE_INTERRUPT | cause, 0, next_pc);
+                    stats->interrupts++;
+                    if (log_file)
+                        fprintf(log_file, "    {interrupt %d}", cause);
+                }
+            }
+        }
+
         if (log_file)
             fprintf(log_file, "\n");
 
         pc = next_pc;
-        stats.insns++;
+        stats->insns++;
+
+        if (deadline)
+        {
+            int cls = insn_classes[insn.id];
+            if ((cls == CLASS_BRANCH || cls == CLASS_JUMP || cls == CLASS_SYSTEM) && --hart->watchdog_poll <= 0)
+            {
+                hart->watchdog_poll = WATCHDOG_BLOCKS;
+                if (host_time() >= deadline)
+                {
+                    running = 0;
+                    stats->stop = STOP_TIMEOUT;
+                    __atomic_store_n(&m->exited, 1, __ATOMIC_RELAXED);
+                }
+            }
+        }
+    }
+
+    if (hart->watch_hit)
+    {
+        hart->watch_hit = 0;
+        stats->stop = STOP_WATCHPOINT;
+        m->paused = 1;
+        __atomic_store_n(&m->exited, 1, __ATOMIC_RELAXED);
+    }
+    else if (running && m->max_insns && stats->insns >= m->max_insns)
+    {
+        running = 0;
+        stats->stop = STOP_BUDGET;
+        __atomic_store_n(&m->exited, 1, __ATOMIC_RELAXED);
+    }
+    this_hart = NULL;
+    hart->pc = pc;
+    hart->running = running;
+    fpu_release(fpu);
+}
+
+static int exited(struct machine *m)
+{
+    return __atomic_load_n(&m->exited, __ATOMIC_RELAXED);
+}
+
+// a hart on its own thread, looking for the machine stopping between quanta
+static void *hart_thread(void *arg)
+{
+    struct hart *hart = arg;
+    while (hart->running && !exited(hart->machine) && hart->stats.insns < hart->end)
+        run_hart(hart, hart->machine, HART_QUANTUM);
+    return NULL;
+}
+
+static void add_stats(struct Stat *total, struct Stat *stats)
+{
+    total->insns += stats->insns;
+    for (int id = 0; id < NUM_INSNS; ++id)
+        total->mix[id] += stats->mix[id];
+    total->taken_branches += stats->taken_branches;
+    total->compressed += stats->compressed;
+    total->fflags |= stats->fflags;
+    total->exceptions += stats->exceptions;
+    total->interrupts += stats->interrupts;
+    if (total->stop == STOP_NONE)
+        total->stop = stats->stop;
+    if (stats->stop == STOP_EXIT)
+        total->exit_code = stats->exit_code;
+    if (total->fatal_cause < 0 && stats->fatal_cause >= 0)
+    {
+        total->fatal_cause = stats->fatal_cause;
+        total->fatal_pc = stats->fatal_pc;
+        total->fatal_tval = stats->fatal_tval;
+    }
+    for (int reg = 0; reg < 32; ++reg)
+    {
+        total->reg_reads[reg] += stats->reg_reads[reg];
+        total->reg_writes[reg] += stats->reg_writes[reg];
+    }
+    for (int dist = 0; dist <= DEP_DIST_MAX; ++dist)
+        total->dep_dist[dist] += stats->dep_dist[dist];
+}
+
+static int is_breakpoint(struct machine *m, unsigned int addr)
+{
+    for (int i = 0; i < m->num_breakpoints; ++i)
+    {
+        if (m->breakpoints[i] == addr)
+            return 1;
+    }
+    return 0;
+}
+
+// decoding the instruction again puts the breakpoint in or takes it out
+void machine_add_breakpoint(struct machine *m, unsigned int addr)
+{
+    m->breakpoints = realloc(m->breakpoints, (m->num_breakpoints + 1) * sizeof(unsigned int));
+    m->breakpoints[m->num_breakpoints++] = addr;
+    invalidate_code(m->dcache, addr, 1);
+}
+
+int machine_remove_breakpoint(struct machine *m, unsigned int addr)
+{
+    for (int i = 0; i < m->num_breakpoints; ++i)
+    {
+        if (m->breakpoints[i] == addr)
+        {
+            m->breakpoints[i] = m->breakpoints[--m->num_breakpoints];
+            invalidate_code(m->dcache, addr, 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void watch_pages(struct machine *m, struct watchpoint *w, int watch)
+{
+    for (unsigned int page = w->addr >> 16; page <= (w->addr + w->len - 1) >> 16; ++page)
+        memory_watch_page(m->mem, page << 16, watch);
+}
+
+void machine_add_watchpoint(struct machine *m, unsigned int addr, unsigned int len)
+{
+    m->watchpoints = realloc(m->watchpoints, (m->num_watchpoints + 1) * sizeof(struct watchpoint));
+    struct watchpoint *w = &m->watchpoints[m->num_watchpoints++];
+    w->addr = addr;
+    w->len = len ? len : 1;
+    watch_pages(m, w, 1);
+    memory_set_watch(m->mem, watch_write, m);
+}
+
+int machine_remove_watchpoint(struct machine *m, unsigned int addr, unsigned int len)
+{
+    for (int i = 0; i < m->num_watchpoints; ++i)
+    {
+        struct watchpoint *w = &m->watchpoints[i];
+        if (w->addr == addr && (w->len == len || len == 0))
+        {
+            watch_pages(m, w, 0);
+            *w = m->watchpoints[--m->num_watchpoints];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+struct machine *machine_create(struct memory *mem, struct syscalls *syscalls, int start_addr,
+                               const struct sim_options *options)
+{
+    struct machine *m = calloc(1, sizeof(struct machine));
+    m->mem = mem;
+    m->syscalls = syscalls;
+    m->harts = options->harts > 0 ? options->harts : 1;
+    m->deterministic = options->deterministic;
+    m->max_insns = options->max_insns;
+    m->max_seconds = options->max_seconds;
+    m->log_file = options->log_file;
+    m->symbols = options->symbols;
+    m->profile = options->profile;
+    m->locality = options->locality;
+    pthread_mutex_init(&m->syscall_lock, NULL);
+    clint_init(&m->clint, m->deterministic);
+    memory_map_device(mem, CLINT_BASE, CLINT_SIZE, &m->clint, clint_read, clint_write);
+    m->dcache = calloc(0x10000, sizeof(struct insn *));
+    memory_set_invalidate(mem, invalidate_written, m);
+
+    // all harts start at the entry point, with their hart id in a0
+    m->hart = calloc(m->harts, sizeof(struct hart));
+    for (int i = 0; i < m->harts; ++i)
+    {
+        struct hart *hart = &m->hart[i];
+        hart->pc = start_addr;
+        hart->registers[10] = i;
+        hart->running = 1;
+        hart->hartid = i;
+        hart->irq_poll = IRQ_POLL_BLOCKS;
+        hart->watchdog_poll = WATCHDOG_BLOCKS;
+        hart->machine = m;
+        hart->stats.fatal_cause = -1;
+        fpu_init(&hart->fpu);
+        vector_init(&hart->vec);
+    }
+    return m;
+}
+
+void machine_delete(struct machine *m)
+{
+    for (int i = 0; i < m->num_watchpoints; ++i)
+        watch_pages(m, &m->watchpoints[i], 0);
+    if (m->num_watchpoints)
+        memory_set_watch(m->mem, NULL, NULL);
+    free(m->watchpoints);
+    free(m->breakpoints);
+    free(m->hart);
+    memory_unmap_device(m->mem, CLINT_BASE);
+    memory_set_invalidate(m->mem, NULL, NULL);
+    for (int i = 0; i < 0x10000; ++i)
+        free(m->dcache[i]);
+    free(m->dcache);
+    pthread_mutex_destroy(&m->syscall_lock);
+    free(m);
+}
+
+void machine_run(struct machine *m, long int insns)
+{
+    struct hart *hart = m->hart;
+    int harts = m->harts;
+    for (int i = 0; i < harts; ++i)
+        hart[i].end = insns ? hart[i].stats.insns + insns : __LONG_MAX__;
+    if (m->max_seconds && !m->deadline)
+        m->deadline = host_time() + (uint64_t)(m->max_seconds * TIME_FREQ);
+    if (m->paused)
+    {
+        m->paused = 0;
+        m->exited = 0;
+        for (int i = 0; i < harts; ++i)
+        {
+            if (hart[i].running)
+                hart[i].stats.stop = STOP_NONE;
+        }
+    }
+
+    // a hart sitting on a breakpoint runs that instruction first
+    for (int i = 0; i < harts && m->num_breakpoints && !m->exited; ++i)
+    {
+        int pc = hart[i].pc;
+        if (hart[i].running && hart[i].stats.insns < hart[i].end && is_breakpoint(m, pc))
+        {
+            m->step_over = 1;
+            invalidate_code(m->dcache, pc, 1);
+            run_hart(&hart[i], m, 1);
+            clint_advance(&m->clint, 1);
+            m->step_over = 0;
+            invalidate_code(m->dcache, pc, 1);
+        }
     }
 
+    // Several harts get a host thread each, unless the run has to be
+    // repeatable or the log and locality analysis would see them interleave.
+    // Then they take turns on this thread, and a single hart just runs.
+    if (harts > 1 && !m->deterministic && !m->log_file && !m->locality)
+    {
+        for (int i = 0; i < harts; ++i)
+            pthread_create(&hart[i].thread, NULL, hart_thread, &hart[i]);
+        for (int i = 0; i < harts; ++i)
+            pthread_join(hart[i].thread, NULL);
+    }
+    else
+    {
+        long int quantum = harts == 1 && !m->deterministic ? __LONG_MAX__ : HART_QUANTUM;
+        int running = 1;
+        while (running && !m->exited)
+        {
+            running = 0;
+            for (int i = 0; i < harts && !m->exited; ++i)
+            {
+                if (hart[i].running && hart[i].stats.insns < hart[i].end)
+                {
+                    long int before = hart[i].stats.insns;
+                    run_hart(&hart[i], m, quantum);
+                    clint_advance(&m->clint, hart[i].stats.insns - before);
+                    running = 1;
+                }
+            }
+        }
+    }
+}
+
+int machine_running(struct machine *m)
+{
+    for (int i = 0; i < m->harts && (!m->exited || m->paused); ++i)
+    {
+        if (m->hart[i].running)
+            return 1;
+    }
+    return 0;
+}
+
+struct Stat machine_stats(struct machine *m)
+{
+    struct Stat stats = {0};
+    stats.fatal_cause = -1;
+    for (int i = 0; i < m->harts; ++i)
+    {
+        m->hart[i].stats.fflags = fpu_fflags(&m->hart[i].fpu);
+        if (stats.stop == STOP_NONE)
+        {
+            stats.stop_hart = i;
+            stats.watch_addr = m->hart[i].stats.watch_addr;
+        }
+        add_stats(&stats, &m->hart[i].stats);
+    }
+    return stats;
+}
+
+struct memory *machine_memory(struct machine *m)
+{
+    return m->mem;
+}
+
+int *machine_registers(struct machine *m, int hart)
+{
+    return m->hart[hart].registers;
+}
+
+int *machine_pc(struct machine *m, int hart)
+{
+    return &m->hart[hart].pc;
+}
+
+void machine_write_memory(struct machine *m, int addr, const void *data, int len)
+{
+    memory_wr_bytes(m->mem, addr, data, len); // which invalidates the code there
+}
+
+void machine_invalidate_code(struct machine *m, int addr, int len)
+{
+    invalidate_code(m->dcache, addr, len);
+}
+
+void machine_set_syscall_hook(struct machine *m, syscall_hook hook, void *arg)
+{
+    m->syscall_hook = hook;
+    m->hook_arg = arg;
+}
+
+struct Stat simulate(struct memory *mem, struct syscalls *syscalls, int start_addr, const struct sim_options *options)
+{
+    struct machine *m = machine_create(mem, syscalls, start_addr, options);
+    machine_run(m, 0);
+    struct Stat stats = machine_stats(m);
+    machine_delete(m);
     return stats;
 }
@@ -3,11 +3,123 @@
 
 #include "memory.h"
 #include "read_elf.h"
+#include "decode.h"
+#include "locality.h"
+#include "syscall.h"
 #include <stdio.h>
 
+// Register dependency distances 1..DEP_DIST_MAX-1 are counted exactly,
+// anything further away ends up in the last bucket
+#define DEP_DIST_MAX 32
+
+// why the simulation stopped
+enum stop_reason
+{
+    STOP_NONE,       // still running, or stopped because another hart did
+    STOP_EXIT,       // the program called exit
+    STOP_FAULT,      // an exception without a trap handler
+    STOP_BREAKPOINT, // EBREAK without a trap handler, or a breakpoint
+    STOP_WATCHPOINT, // a write to a watched address
+    STOP_BUDGET,     // a hart ran max_insns instructions
+    STOP_TIMEOUT     // the watchdog, max_seconds of host time went by
+};
+
+// one word for each reason, "exit", "fault" and so on
+const char *stop_name(enum stop_reason stop);
+
 // Simuler RISC-V program i givet lager og fra given start adresse
-struct Stat { long int insns; };
+struct Stat
+{
+    long int insns;
+    long int mix[NUM_INSNS];    // executions per decoded instruction id
+    long int taken_branches;
+    long int compressed;        // executed instructions that were 16-bit
+    unsigned int fflags;        // accrued floating point exception flags
+    long int exceptions;
+    long int interrupts;
+    enum stop_reason stop;
+    int exit_code;           // a0 of the exit call
+    int stop_hart;           // the hart that stopped the simulation
+    unsigned int watch_addr; // the address written when stopped by a watchpoint
+    // the exception that ended the program because there was no handler, -1 if none
+    int fatal_cause;
+    unsigned int fatal_pc, fatal_tval;
+    // only filled in when simulating with profiling enabled
+    long int reg_reads[32];
+    long int reg_writes[32];
+    long int dep_dist[DEP_DIST_MAX + 1];
+};
+
+// How to simulate, zero is the default for every field
+struct sim_options
+{
+    // cores sharing memory (1..MAX_HARTS), they start together at the entry
+    // point, each on its own host thread
+    int harts;
+    // run the harts in turns on one thread instead, with the timer following
+    // the instruction count, so a run can be repeated exactly
+    int deterministic;
+    long int max_insns; // stop when a hart has run this many instructions, 0 for no limit
+    // Watchdog: stop after this much host time, 0 for no limit. The clock is
+    // only read every few thousand blocks, so it costs next to nothing.
+    double max_seconds;
+    FILE *log_file;     // log every instruction
+    struct symbols *symbols;
+    int profile; // count register use and dependency distances
+    struct locality *locality;
+};
+
+// the statistics are summed over all harts
+struct Stat simulate(struct memory *mem, struct syscalls *syscalls, int start_addr, const struct sim_options *options);
+
+// simulate() in steps, for driving the simulation from other code. The
+// machine adds the CLINT to mem and keeps the decode cache, the harts and
+// their statistics between runs.
+struct machine;
+
+// Called for every system call before the simulator's own, with the call in
+// registers[17]. Returns -1 to leave it to the simulator, otherwise what
+// syscall_execute would: 0 if the program exits, 1 to go on.
+typedef int (*syscall_hook)(void *arg, struct memory *mem, int *registers);
+
+struct machine *machine_create(struct memory *mem, struct syscalls *syscalls, int start_addr,
+                               const struct sim_options *options);
+void machine_delete(struct machine *m);
+
+// Runs every hart for up to insns more instructions, 0 for no limit, or
+// until the simulation stops, see stop in machine_stats. The watchdog
+// starts with the first run.
+void machine_run(struct machine *m, long int insns);
+
+// is any hart able to go on? Not once the simulation has stopped, and a
+// hart stops by itself on EBREAK without a trap handler
+int machine_running(struct machine *m);
+struct Stat machine_stats(struct machine *m);
+
+struct memory *machine_memory(struct machine *m);
+
+// the state of a hart, to read or change between runs
+int *machine_registers(struct machine *m, int hart);
+int *machine_pc(struct machine *m, int hart);
+
+// writes to memory, code included, between runs
+void machine_write_memory(struct machine *m, int addr, const void *data, int len);
+// drops the decoded instructions in addr..addr+len-1, they are decoded again
+// when they run next
+void machine_invalidate_code(struct machine *m, int addr, int len);
+
+void machine_set_syscall_hook(struct machine *m, syscall_hook hook, void *arg);
+
+// Breakpoints stop the simulation before the instruction at addr runs, and
+// a run where a hart starts on one runs that instruction first. The decoded
+// instruction is replaced by a BREAKPOINT, so nothing else gets slower.
+void machine_add_breakpoint(struct machine *m, unsigned int addr);
+// returns 0 if there was no such breakpoint
+int machine_remove_breakpoint(struct machine *m, unsigned int addr);
 
-struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file, struct symbols* symbols);
+// Watchpoints stop the simulation after an instruction writes to any of
+// addr..addr+len-1. Only writes to the pages holding them are checked.
+void machine_add_watchpoint(struct machine *m, unsigned int addr, unsigned int len);
+int machine_remove_watchpoint(struct machine *m, unsigned int addr, unsigned int len);
 
 #endif
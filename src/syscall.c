@@ -0,0 +1,372 @@
+#include "syscall.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_FILES 64
+#define CONSOLE_FD -2 // host_fd of guest fds 0..2
+#define COPY_SIZE 0x1000 // for device registers, which is rare
+#define MAX_SEGMENTS 64  // pages per readv/writev
+#define PATH_SIZE 1024
+
+// newlib's open flags, they differ from the host's
+#define GUEST_O_ACCMODE 0x3
+#define GUEST_O_APPEND 0x8
+#define GUEST_O_CREAT 0x200
+#define GUEST_O_TRUNC 0x400
+#define GUEST_O_EXCL 0x800
+#define GUEST_AT_FDCWD -100
+
+// newlib's clock ids
+#define GUEST_CLOCK_REALTIME 1
+#define GUEST_CLOCK_MONOTONIC 4
+
+// don't let the heap grow into the devices
+#define BRK_LIMIT 0xc0000000u
+
+// struct kernel_stat of libgloss for riscv32, 128 bytes
+struct guest_stat
+{
+    uint64_t dev, ino;
+    uint32_t mode, nlink, uid, gid;
+    uint64_t rdev, pad1;
+    int64_t size;
+    int32_t blksize, pad2;
+    int64_t blocks;
+    int64_t atime, atime_nsec, mtime, mtime_nsec, ctime, ctime_nsec;
+    int32_t reserved[2];
+};
+
+// struct timespec and struct timeval, newlib has a 64 bit time_t
+struct guest_time
+{
+    int64_t sec;
+    int32_t frac, pad;
+};
+
+// Harts on their own threads make calls at the same time. The lock guards
+// the fd table and the break, and is never held across host I/O, so a hart
+// waiting for input doesn't hold up the others
+struct syscalls
+{
+    struct console *console;
+    unsigned int brk, brk_start;
+    int host_fd[MAX_FILES]; // -1 when the guest fd is not open
+    pthread_mutex_t lock;
+};
+
+struct syscalls *syscalls_create(struct console *console, unsigned int brk)
+{
+    struct syscalls *sys = malloc(sizeof(struct syscalls));
+    sys->console = console;
+    sys->brk = sys->brk_start = brk;
+    for (int fd = 0; fd < MAX_FILES; ++fd)
+        sys->host_fd[fd] = fd <= 2 ? CONSOLE_FD : -1;
+    pthread_mutex_init(&sys->lock, NULL);
+    return sys;
+}
+
+void syscalls_delete(struct syscalls *sys)
+{
+    for (int fd = 0; fd < MAX_FILES; ++fd)
+    {
+        if (sys->host_fd[fd] >= 0)
+            close(sys->host_fd[fd]);
+    }
+    pthread_mutex_destroy(&sys->lock);
+    free(sys);
+}
+
+// host fd of a guest fd, CONSOLE_FD or -1
+static int host_fd(struct syscalls *sys, int fd)
+{
+    if (fd < 0 || fd >= MAX_FILES)
+        return -1;
+    pthread_mutex_lock(&sys->lock);
+    int host = sys->host_fd[fd];
+    pthread_mutex_unlock(&sys->lock);
+    return host;
+}
+
+static int sys_openat(struct syscalls *sys, struct memory *mem, int dirfd, int path_addr, int flags, int mode)
+{
+    char path[PATH_SIZE];
+    int len = 0;
+    do
+    {
+        if (len == PATH_SIZE)
+            return -ENAMETOOLONG;
+        path[len] = memory_rd_b(mem, path_addr + len);
+    } while (path[len++]);
+    int host_dir = dirfd == GUEST_AT_FDCWD ? AT_FDCWD : host_fd(sys, dirfd);
+    if (host_dir == -1 || host_dir == CONSOLE_FD)
+        return -EBADF;
+
+    int host_flags = (flags & GUEST_O_ACCMODE) == 1 ? O_WRONLY : (flags & GUEST_O_ACCMODE) == 2 ? O_RDWR : O_RDONLY;
+    if (flags & GUEST_O_APPEND)
+        host_flags |= O_APPEND;
+    if (flags & GUEST_O_CREAT)
+        host_flags |= O_CREAT;
+    if (flags & GUEST_O_TRUNC)
+        host_flags |= O_TRUNC;
+    if (flags & GUEST_O_EXCL)
+        host_flags |= O_EXCL;
+    // opening can wait, for a FIFO say, so the guest fd is taken after
+    int host = openat(host_dir, path, host_flags, mode);
+    if (host < 0)
+        return -errno;
+    pthread_mutex_lock(&sys->lock);
+    int fd = 0;
+    while (fd < MAX_FILES && sys->host_fd[fd] != -1)
+        fd++;
+    if (fd < MAX_FILES)
+        sys->host_fd[fd] = host;
+    pthread_mutex_unlock(&sys->lock);
+    if (fd == MAX_FILES)
+    {
+        close(host);
+        return -EMFILE;
+    }
+    return fd;
+}
+
+static int sys_close(struct syscalls *sys, int fd)
+{
+    if (fd < 0 || fd >= MAX_FILES)
+        return -EBADF;
+    pthread_mutex_lock(&sys->lock);
+    int host = sys->host_fd[fd];
+    sys->host_fd[fd] = -1;
+    pthread_mutex_unlock(&sys->lock);
+    if (host == -1)
+        return -EBADF;
+    if (host != CONSOLE_FD && close(host) < 0)
+        return -errno;
+    return 0;
+}
+
+// Host file data moves straight between the file and the pages holding the
+// guest buffer, with one readv/writev for up to MAX_SEGMENTS pages. Only
+// parts of the buffer that are device registers go through a copy buffer.
+// Fills iov for as much of addr..addr+len as is RAM and returns its length,
+// 0 if addr is a device page. Pages are only made writable, which copies
+// one shared with the program image, for a read into them
+static int map_pages(struct memory *mem, int addr, int len, int writable, struct iovec *iov, int *count)
+{
+    int mapped = 0;
+    *count = 0;
+    while (mapped < len && *count < MAX_SEGMENTS)
+    {
+        int room;
+        void *ptr = writable ? memory_page_ptr(mem, addr + mapped, &room)
+                             : (void *)memory_page_read_ptr(mem, addr + mapped, &room);
+        if (ptr == NULL)
+            break;
+        if (room > len - mapped)
+            room = len - mapped;
+        iov[(*count)++] = (struct iovec){ptr, room};
+        mapped += room;
+    }
+    return mapped;
+}
+
+// length of the device part at addr to pass through the copy buffer
+static int device_chunk(int addr, int len)
+{
+    int chunk = 0x10000 - (addr & 0xffff);
+    if (chunk > COPY_SIZE)
+        chunk = COPY_SIZE;
+    return chunk < len ? chunk : len;
+}
+
+static int sys_read(struct syscalls *sys, struct memory *mem, int fd, int addr, int len)
+{
+    int host = host_fd(sys, fd);
+    if (host == -1)
+        return -EBADF;
+    if (host == CONSOLE_FD)
+        return console_read(sys->console, mem, addr, len);
+    int done = 0;
+    while (done < len)
+    {
+        struct iovec iov[MAX_SEGMENTS];
+        int count;
+        int chunk = map_pages(mem, addr + done, len - done, 1, iov, &count);
+        ssize_t n;
+        if (chunk)
+        {
+            n = readv(host, iov, count);
+            if (n > 0) // straight into the pages, code there has to be decoded again
+                memory_invalidate(mem, addr + done, n);
+        }
+        else
+        {
+            chunk = device_chunk(addr + done, len - done);
+            char buffer[COPY_SIZE];
+            n = read(host, buffer, chunk);
+            if (n > 0)
+                memory_wr_bytes(mem, addr + done, buffer, n);
+        }
+        if (n < 0)
+            return done ? done : -errno;
+        done += n;
+        if (n < chunk)
+            break;
+    }
+    return done;
+}
+
+static int sys_write(struct syscalls *sys, struct memory *mem, int fd, int addr, int len)
+{
+    int host = host_fd(sys, fd);
+    if (host == -1)
+        return -EBADF;
+    if (host == CONSOLE_FD)
+    {
+        console_write(sys->console, mem, addr, len);
+        return len;
+    }
+    int done = 0;
+    while (done < len)
+    {
+        struct iovec iov[MAX_SEGMENTS];
+        int count;
+        int chunk = map_pages(mem, addr + done, len - done, 0, iov, &count);
+        ssize_t n;
+        if (chunk)
+            n = writev(host, iov, count);
+        else
+        {
+            chunk = device_chunk(addr + done, len - done);
+            char buffer[COPY_SIZE];
+            memory_rd_bytes(mem, addr + done, buffer, chunk);
+            n = write(host, buffer, chunk);
+        }
+        if (n < 0)
+            return done ? done : -errno;
+        done += n;
+        if (n < chunk)
+            break;
+    }
+    return done;
+}
+
+static int sys_lseek(struct syscalls *sys, int fd, int offset, int whence)
+{
+    int host = host_fd(sys, fd);
+    if (host == -1)
+        return -EBADF;
+    if (host == CONSOLE_FD)
+        return -ESPIPE;
+    off_t pos = lseek(host, offset, whence);
+    if (pos < 0)
+        return -errno;
+    return pos > INT32_MAX ? -EOVERFLOW : pos;
+}
+
+static int sys_fstat(struct syscalls *sys, struct memory *mem, int fd, int addr)
+{
+    int host = host_fd(sys, fd);
+    if (host == -1)
+        return -EBADF;
+    struct guest_stat gst = {0};
+    if (host == CONSOLE_FD)
+    {
+        // the console is a terminal whatever the simulator's own fds are,
+        // which makes newlib line buffer stdout
+        gst.mode = S_IFCHR | 0620;
+        gst.nlink = 1;
+        gst.blksize = COPY_SIZE;
+        memory_wr_bytes(mem, addr, &gst, sizeof(gst));
+        return 0;
+    }
+    struct stat st;
+    if (fstat(host, &st) < 0)
+        return -errno;
+    gst.dev = st.st_dev;
+    gst.ino = st.st_ino;
+    gst.mode = st.st_mode;
+    gst.nlink = st.st_nlink;
+    gst.uid = st.st_uid;
+    gst.gid = st.st_gid;
+    gst.rdev = st.st_rdev;
+    gst.size = st.st_size;
+    gst.blksize = st.st_blksize;
+    gst.blocks = st.st_blocks;
+    gst.atime = st.st_atim.tv_sec;
+    gst.atime_nsec = st.st_atim.tv_nsec;
+    gst.mtime = st.st_mtim.tv_sec;
+    gst.mtime_nsec = st.st_mtim.tv_nsec;
+    gst.ctime = st.st_ctim.tv_sec;
+    gst.ctime_nsec = st.st_ctim.tv_nsec;
+    memory_wr_bytes(mem, addr, &gst, sizeof(gst));
+    return 0;
+}
+
+static int sys_clock_gettime(struct memory *mem, int clock, int addr)
+{
+    clockid_t host_clock;
+    if (clock == GUEST_CLOCK_REALTIME)
+        host_clock = CLOCK_REALTIME;
+    else if (clock == GUEST_CLOCK_MONOTONIC)
+        host_clock = CLOCK_MONOTONIC;
+    else
+        return -EINVAL;
+    struct timespec ts;
+    if (clock_gettime(host_clock, &ts) < 0)
+        return -errno;
+    struct guest_time gt = {ts.tv_sec, ts.tv_nsec, 0};
+    memory_wr_bytes(mem, addr, &gt, sizeof(gt));
+    return 0;
+}
+
+static int sys_gettimeofday(struct memory *mem, int addr)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    struct guest_time gt = {ts.tv_sec, ts.tv_nsec / 1000, 0};
+    if (addr)
+        memory_wr_bytes(mem, addr, &gt, sizeof(gt));
+    return 0;
+}
+
+// memory is allocated when first touched, so moving the break is all there is
+static int sys_brk(struct syscalls *sys, unsigned int addr)
+{
+    pthread_mutex_lock(&sys->lock);
+    if (addr >= sys->brk_start && addr < BRK_LIMIT)
+        sys->brk = addr;
+    unsigned int brk = sys->brk;
+    pthread_mutex_unlock(&sys->lock);
+    return brk;
+}
+
+int syscall_execute(struct syscalls *sys, struct memory *mem, int *registers)
+{
+    int *a = registers + 10;
+    switch (registers[17])
+    {
+    case SYS_GETCHAR: a[0] = console_getc(sys->console); break;
+    case SYS_PUTCHAR: console_putc(sys->console, a[0]); break;
+    case SYS_EXIT_OLD:
+    case SYS_EXIT: return 0;
+    case SYS_OPENAT: a[0] = sys_openat(sys, mem, a[0], a[1], a[2], a[3]); break;
+    case SYS_CLOSE: a[0] = sys_close(sys, a[0]); break;
+    case SYS_LSEEK: a[0] = sys_lseek(sys, a[0], a[1], a[2]); break;
+    case SYS_READ: a[0] = sys_read(sys, mem, a[0], a[1], a[2]); break;
+    case SYS_WRITE: a[0] = sys_write(sys, mem, a[0], a[1], a[2]); break;
+    case SYS_FSTAT: a[0] = sys_fstat(sys, mem, a[0], a[1]); break;
+    case SYS_CLOCK_GETTIME: a[0] = sys_clock_gettime(mem, a[0], a[1]); break;
+    case SYS_GETTIMEOFDAY: a[0] = sys_gettimeofday(mem, a[0]); break;
+    case SYS_BRK: a[0] = sys_brk(sys, a[0]); break;
+    default: a[0] = -ENOSYS; break;
+    }
+    return 1;
+}
@@ -0,0 +1,36 @@
+#ifndef __SYSCALL_H__
+#define __SYSCALL_H__
+
+#include "memory.h"
+#include "console.h"
+
+// System calls of the newlib / proxy kernel ABI: the number is in a7, the
+// arguments in a0..a5 and the result goes to a0, negative errno on failure.
+// Guest file descriptors 0, 1 and 2 are the console, others are host files.
+#define SYS_GETCHAR 1 // the simulator's own calls from before there was a table
+#define SYS_PUTCHAR 2
+#define SYS_EXIT_OLD 3
+#define SYS_OPENAT 56
+#define SYS_CLOSE 57
+#define SYS_LSEEK 62
+#define SYS_READ 63
+#define SYS_WRITE 64
+#define SYS_FSTAT 80
+#define SYS_EXIT 93
+#define SYS_CLOCK_GETTIME 113
+#define SYS_GETTIMEOFDAY 169
+#define SYS_BRK 214
+
+struct syscalls;
+
+// brk is where the program break starts, just above the loaded program
+struct syscalls *syscalls_create(struct console *console, unsigned int brk);
+
+// closes the host files the program left open
+void syscalls_delete(struct syscalls *sys);
+
+// execute the call in registers[17], returns 0 when the program exits. Harts
+// on their own threads may call this at the same time
+int syscall_execute(struct syscalls *sys, struct memory *mem, int *registers);
+
+#endif
@@ -0,0 +1,71 @@
+#include "uart.h"
+#include <stdlib.h>
+
+struct uart
+{
+    struct console *console;
+    unsigned char ier, lcr, mcr, scr;
+};
+
+struct uart *uart_create(struct console *console)
+{
+    struct uart *uart = calloc(1, sizeof(struct uart));
+    uart->console = console;
+    return uart;
+}
+
+void uart_delete(struct uart *uart)
+{
+    free(uart);
+}
+
+int uart_read(void *dev, unsigned int offset, int size)
+{
+    struct uart *uart = dev;
+    (void)size;
+    switch (offset)
+    {
+    case UART_RBR:
+        return console_input_ready(uart->console) ? console_getc(uart->console) : 0;
+    case UART_IER:
+        return uart->ier;
+    case UART_IIR:
+        return 0x01; // no interrupt pending
+    case UART_LCR:
+        return uart->lcr;
+    case UART_MCR:
+        return uart->mcr;
+    case UART_LSR:
+        return UART_LSR_THRE | UART_LSR_TEMT | (console_input_ready(uart->console) ? UART_LSR_DR : 0);
+    case UART_SCR:
+        return uart->scr;
+    }
+    return 0;
+}
+
+void uart_write(void *dev, unsigned int offset, int size, int data)
+{
+    struct uart *uart = dev;
+    (void)size;
+    // with the divisor latch enabled offsets 0 and 1 set the baud rate, ignored
+    if ((uart->lcr & 0x80) && offset <= UART_IER)
+        return;
+    switch (offset)
+    {
+    case UART_THR:
+        console_putc(uart->console, data & 0xff);
+        break;
+    case UART_IER:
+        uart->ier = data & 0x0f;
+        break;
+    case UART_LCR:
+        uart->lcr = data;
+        break;
+    case UART_MCR:
+        uart->mcr = data;
+        break;
+    case UART_SCR:
+        uart->scr = data;
+        break;
+    }
+}
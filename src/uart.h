@@ -0,0 +1,36 @@
+#ifndef __UART_H__
+#define __UART_H__
+
+#include "console.h"
+
+// A 16550-style UART with byte wide registers: transmit/receive at offset 0
+// and line status at offset 5, connected to the console. Polling for input
+// doesn't block the simulation.
+#define UART_BASE 0xc0000000u
+#define UART_SIZE 0x10000
+
+#define UART_RBR 0 // receive buffer (read)
+#define UART_THR 0 // transmit holding (write)
+#define UART_IER 1
+#define UART_IIR 2 // interrupt identification (read)
+#define UART_FCR 2 // fifo control (write)
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+#define UART_MSR 6
+#define UART_SCR 7
+
+#define UART_LSR_DR 0x01   // data ready
+#define UART_LSR_THRE 0x20 // transmitter holding register empty
+#define UART_LSR_TEMT 0x40 // transmitter empty
+
+struct uart;
+
+struct uart *uart_create(struct console *console);
+void uart_delete(struct uart *uart);
+
+// device callbacks
+int uart_read(void *uart, unsigned int offset, int size);
+void uart_write(void *uart, unsigned int offset, int size, int data);
+
+#endif
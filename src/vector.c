@@ -0,0 +1,495 @@
+#include "vector.h"
+#include "csr.h"
+#include "memory.h"
+#include <string.h>
+
+// Elements are accessed through these so the byte array of the registers can
+// be viewed as any element width
+typedef int8_t __attribute__((may_alias)) s8;
+typedef int16_t __attribute__((may_alias)) s16;
+typedef int32_t __attribute__((may_alias)) s32;
+typedef int64_t __attribute__((may_alias)) s64;
+typedef uint8_t __attribute__((may_alias)) u8;
+typedef uint16_t __attribute__((may_alias)) u16;
+typedef uint32_t __attribute__((may_alias)) u32;
+typedef uint64_t __attribute__((may_alias)) u64;
+
+// largest register group, LMUL = 8
+#define GROUP_BYTES (8 * VLENB)
+
+void vector_init(struct vector_unit *v)
+{
+    memset(v, 0, sizeof(*v));
+    v->vtype = 0x80000000;
+}
+
+static void set_vtype(struct vector_unit *v, unsigned int vtype, unsigned int avl)
+{
+    unsigned int vlmul = vtype & 0x7, vsew = (vtype >> 3) & 0x7;
+    unsigned int sew = 1u << vsew;
+    // VLMAX = LMUL * VLEN / SEW, with fractional LMUL encoded as 5..7
+    unsigned int vlmax = vlmul < 4 ? (VLENB << vlmul) / sew : (VLENB >> (8 - vlmul)) / sew;
+    if (vsew > 3 || vlmul == 4 || (vtype >> 8) != 0 || vlmax == 0)
+    {
+        v->vtype = 0x80000000;
+        v->sew = v->vl = v->vlmax = 0;
+        return;
+    }
+    v->vtype = vtype;
+    v->sew = sew;
+    v->vlmax = vlmax;
+    v->vl = avl < vlmax ? avl : vlmax;
+}
+
+static inline int mask_bit(const uint8_t *mask, unsigned int i)
+{
+    return (mask[i >> 3] >> (i & 7)) & 1;
+}
+
+// Per element width: element-wise arithmetic into res, compares into one
+// byte per element, reductions and broadcasting a scalar. The loops have no
+// branches on the element values so the compiler can vectorize them.
+#define ELEMENT_OPS(BITS, S, U)                                                         \
+    static void arith_##BITS(int id, U *res, const U *a, const U *b, unsigned int n)    \
+    {                                                                                   \
+        unsigned int i;                                                                 \
+        switch (id)                                                                     \
+        {                                                                               \
+        case INSN_VADD:                                                                 \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = a[i] + b[i];                                                   \
+            break;                                                                      \
+        case INSN_VSUB:                                                                 \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = a[i] - b[i];                                                   \
+            break;                                                                      \
+        case INSN_VRSUB:                                                                \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = b[i] - a[i];                                                   \
+            break;                                                                      \
+        case INSN_VMUL:                                                                 \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = 1u * a[i] * b[i];                                              \
+            break;                                                                      \
+        case INSN_VAND:                                                                 \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = a[i] & b[i];                                                   \
+            break;                                                                      \
+        case INSN_VOR:                                                                  \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = a[i] | b[i];                                                   \
+            break;                                                                      \
+        case INSN_VXOR:                                                                 \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = a[i] ^ b[i];                                                   \
+            break;                                                                      \
+        case INSN_VMINU:                                                                \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = a[i] < b[i] ? a[i] : b[i];                                     \
+            break;                                                                      \
+        case INSN_VMAXU:                                                                \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = a[i] > b[i] ? a[i] : b[i];                                     \
+            break;                                                                      \
+        case INSN_VMIN:                                                                 \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = (S)a[i] < (S)b[i] ? a[i] : b[i];                               \
+            break;                                                                      \
+        case INSN_VMAX:                                                                 \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = (S)a[i] > (S)b[i] ? a[i] : b[i];                               \
+            break;                                                                      \
+        default: /* INSN_VMERGE without mask, vmv.v.* */                               \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = b[i];                                                          \
+            break;                                                                      \
+        }                                                                               \
+    }                                                                                   \
+                                                                                        \
+    static void compare_##BITS(int id, uint8_t *res, const U *a, const U *b, unsigned int n) \
+    {                                                                                   \
+        unsigned int i;                                                                 \
+        switch (id)                                                                     \
+        {                                                                               \
+        case INSN_VMSEQ:                                                                \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = a[i] == b[i];                                                  \
+            break;                                                                      \
+        case INSN_VMSNE:                                                                \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = a[i] != b[i];                                                  \
+            break;                                                                      \
+        case INSN_VMSLTU:                                                               \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = a[i] < b[i];                                                   \
+            break;                                                                      \
+        case INSN_VMSLT:                                                                \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = (S)a[i] < (S)b[i];                                             \
+            break;                                                                      \
+        case INSN_VMSLEU:                                                               \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = a[i] <= b[i];                                                  \
+            break;                                                                      \
+        case INSN_VMSLE:                                                                \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = (S)a[i] <= (S)b[i];                                            \
+            break;                                                                      \
+        case INSN_VMSGTU:                                                               \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = a[i] > b[i];                                                   \
+            break;                                                                      \
+        default: /* INSN_VMSGT */                                                       \
+            for (i = 0; i < n; ++i)                                                     \
+                res[i] = (S)a[i] > (S)b[i];                                             \
+            break;                                                                      \
+        }                                                                               \
+    }                                                                                   \
+                                                                                        \
+    /* masked off elements have already been replaced by the identity */              \
+    static U reduce_##BITS(int id, U acc, const U *a, unsigned int n)                   \
+    {                                                                                   \
+        unsigned int i;                                                                 \
+        switch (id)                                                                     \
+        {                                                                               \
+        case INSN_VREDSUM:                                                              \
+            for (i = 0; i < n; ++i)                                                     \
+                acc += a[i];                                                            \
+            break;                                                                      \
+        case INSN_VREDAND:                                                              \
+            for (i = 0; i < n; ++i)                                                     \
+                acc &= a[i];                                                            \
+            break;                                                                      \
+        case INSN_VREDOR:                                                               \
+            for (i = 0; i < n; ++i)                                                     \
+                acc |= a[i];                                                            \
+            break;                                                                      \
+        case INSN_VREDXOR:                                                              \
+            for (i = 0; i < n; ++i)                                                     \
+                acc ^= a[i];                                                            \
+            break;                                                                      \
+        case INSN_VREDMINU:                                                             \
+            for (i = 0; i < n; ++i)                                                     \
+                acc = a[i] < acc ? a[i] : acc;                                          \
+            break;                                                                      \
+        case INSN_VREDMAXU:                                                             \
+            for (i = 0; i < n; ++i)                                                     \
+                acc = a[i] > acc ? a[i] : acc;                                          \
+            break;                                                                      \
+        case INSN_VREDMIN:                                                              \
+            for (i = 0; i < n; ++i)                                                     \
+                acc = (S)a[i] < (S)acc ? a[i] : acc;                                    \
+            break;                                                                      \
+        default: /* INSN_VREDMAX */                                                     \
+            for (i = 0; i < n; ++i)                                                     \
+                acc = (S)a[i] > (S)acc ? a[i] : acc;                                    \
+            break;                                                                      \
+        }                                                                               \
+        return acc;                                                                     \
+    }                                                                                   \
+                                                                                        \
+    static void broadcast_##BITS(U *res, U val, unsigned int n)                         \
+    {                                                                                   \
+        for (unsigned int i = 0; i < n; ++i)                                            \
+            res[i] = val;                                                               \
+    }
+
+ELEMENT_OPS(8, s8, u8)
+ELEMENT_OPS(16, s16, u16)
+ELEMENT_OPS(32, s32, u32)
+ELEMENT_OPS(64, s64, u64)
+
+// fill n elements of the current width with a sign extended scalar
+static void broadcast(unsigned int sew, uint8_t *res, int val, unsigned int n)
+{
+    switch (sew)
+    {
+    case 1: broadcast_8((u8 *)res, val, n); break;
+    case 2: broadcast_16((u16 *)res, val, n); break;
+    case 4: broadcast_32((u32 *)res, val, n); break;
+    case 8: broadcast_64((u64 *)res, (int64_t)val, n); break;
+    }
+}
+
+// identity of a reduction, what masked off elements are replaced with
+static uint64_t identity(int id, unsigned int sew)
+{
+    uint64_t ones = sew == 8 ? ~0ull : (1ull << (8 * sew)) - 1;
+    switch (id)
+    {
+    case INSN_VREDAND:
+    case INSN_VREDMINU:
+        return ones;
+    case INSN_VREDMIN: // most positive
+        return ones >> 1;
+    case INSN_VREDMAX: // most negative
+        return (ones >> 1) + 1;
+    default:
+        return 0;
+    }
+}
+
+// does a register group of the given size starting at register r fit?
+static int group_ok(unsigned int r, unsigned int bytes)
+{
+    return r * VLENB + bytes <= 32 * VLENB;
+}
+
+// Checks the elements of a vector load or store before any is accessed, so a
+// fault leaves memory and the registers as they were. Returns the cause of
+// the first element that faults like a scalar access would, or 0 if none
+// does. *ram is cleared if an element is in a device page
+static int check_elements(struct vector_unit *v, struct memory *mem, struct insn *insn, int base, int stride,
+                          int store, int *ram)
+{
+    unsigned int eew = insn->imm;
+    int last_page = -1;
+    *ram = 1;
+    for (unsigned int i = 0; i < v->vl; ++i)
+    {
+        if (!(insn->vflags & VF_UNMASKED) && !mask_bit(v->regs, i))
+            continue;
+        int addr = base + i * stride;
+        if (addr & (eew - 1) || memory_unclaimed(mem, addr))
+        {
+            v->fault_addr = addr;
+            if (addr & (eew - 1))
+                return store ? CAUSE_MISALIGNED_STORE : CAUSE_MISALIGNED_LOAD;
+            return store ? CAUSE_STORE_FAULT : CAUSE_LOAD_FAULT;
+        }
+        // an aligned element never crosses a page
+        if ((addr >> 16) != last_page)
+        {
+            int len;
+            last_page = addr >> 16;
+            if (memory_page_read_ptr(mem, addr, &len) == NULL)
+                *ram = 0;
+        }
+    }
+    return 0;
+}
+
+// Device registers are accessed with the element's width, never a byte at a
+// time, 64 bit elements as two words
+static void element_read(struct memory *mem, int addr, unsigned int eew, uint8_t *element)
+{
+    switch (eew)
+    {
+    case 1: *(u8 *)element = memory_rd_b(mem, addr); break;
+    case 2: *(u16 *)element = memory_rd_h(mem, addr); break;
+    case 4: *(u32 *)element = memory_rd_w(mem, addr); break;
+    default:
+        *(u32 *)element = memory_rd_w(mem, addr);
+        *(u32 *)(element + 4) = memory_rd_w(mem, addr + 4);
+        break;
+    }
+}
+
+static void element_write(struct memory *mem, int addr, unsigned int eew, const uint8_t *element)
+{
+    switch (eew)
+    {
+    case 1: memory_wr_b(mem, addr, *(const u8 *)element); break;
+    case 2: memory_wr_h(mem, addr, *(const u16 *)element); break;
+    case 4: memory_wr_w(mem, addr, *(const u32 *)element); break;
+    default:
+        memory_wr_w(mem, addr, *(const u32 *)element);
+        memory_wr_w(mem, addr + 4, *(const u32 *)(element + 4));
+        break;
+    }
+    memory_invalidate(mem, addr, eew);
+}
+
+// returns 0, VECTOR_ILLEGAL or VECTOR_FAULT. Stores through memory_wr_bytes
+// and element_write invalidate any decoded code they overwrite
+static int vector_memory(struct vector_unit *v, struct memory *mem, struct insn *insn, int base, int stride)
+{
+    unsigned int eew = insn->imm, vl = v->vl;
+    uint8_t *vd = &v->regs[insn->rd * VLENB];
+    int store = insn->id == INSN_VSE || insn->id == INSN_VSSE;
+    if (!group_ok(insn->rd, vl * eew))
+        return VECTOR_ILLEGAL;
+    int ram;
+    v->fault_cause = check_elements(v, mem, insn, base, stride, store, &ram);
+    if (v->fault_cause)
+        return VECTOR_FAULT;
+
+    if (!ram)
+    {
+        for (unsigned int i = 0; i < vl; ++i)
+        {
+            if (!(insn->vflags & VF_UNMASKED) && !mask_bit(v->regs, i))
+                continue;
+            if (store)
+                element_write(mem, base + i * stride, eew, vd + i * eew);
+            else
+                element_read(mem, base + i * stride, eew, vd + i * eew);
+        }
+        return 0;
+    }
+    if ((insn->id == INSN_VLE || insn->id == INSN_VSE) && (insn->vflags & VF_UNMASKED))
+    {
+        // unit stride: one bulk copy instead of an access per element
+        if (store)
+            memory_wr_bytes(mem, base, vd, vl * eew);
+        else
+            memory_rd_bytes(mem, base, vd, vl * eew);
+        return 0;
+    }
+    for (unsigned int i = 0; i < vl; ++i)
+    {
+        if (!(insn->vflags & VF_UNMASKED) && !mask_bit(v->regs, i))
+            continue;
+        int addr = base + i * stride;
+        if (store)
+            memory_wr_bytes(mem, addr, vd + i * eew, eew);
+        else
+            memory_rd_bytes(mem, addr, vd + i * eew, eew);
+    }
+    return 0;
+}
+
+int vector_execute(struct vector_unit *v, struct memory *mem, struct insn *insn, int rs1_val, int rs2_val,
+                   int *result)
+{
+    uint8_t res[GROUP_BYTES] __attribute__((aligned(32)));
+    uint8_t scalar[GROUP_BYTES] __attribute__((aligned(32)));
+    unsigned int sew = v->sew, vl = v->vl;
+    unsigned int bytes = vl * sew;
+    const uint8_t *mask = (insn->vflags & VF_UNMASKED) ? NULL : v->regs;
+    uint8_t *vd = &v->regs[insn->rd * VLENB];
+    const uint8_t *vs2 = &v->regs[insn->rs2 * VLENB];
+    const uint8_t *vs1 = &v->regs[insn->rs1 * VLENB];
+    int id = insn->id;
+
+    switch (id)
+    {
+    case INSN_VSETVLI:
+    case INSN_VSETVL:
+    {
+        unsigned int avl = (unsigned)rs1_val;
+        if (insn->rs1 == 0) // keep vl, or set it to VLMAX when writing rd
+            avl = insn->rd ? ~0u : v->vl;
+        set_vtype(v, id == INSN_VSETVLI ? (unsigned)insn->imm : (unsigned)rs2_val, avl);
+        *result = v->vl;
+        return 1;
+    }
+    case INSN_VSETIVLI:
+        set_vtype(v, insn->imm, insn->rs1);
+        *result = v->vl;
+        return 1;
+    }
+
+    if (!sew) // vill: everything else is illegal
+        return VECTOR_ILLEGAL;
+
+    switch (id)
+    {
+    case INSN_VLE:
+    case INSN_VSE:
+        return vector_memory(v, mem, insn, rs1_val, insn->imm);
+    case INSN_VLSE:
+    case INSN_VSSE:
+        return vector_memory(v, mem, insn, rs1_val, rs2_val);
+
+    case INSN_VMV_X_S:
+        switch (sew)
+        {
+        case 1: *result = *(s8 *)vs2; break;
+        case 2: *result = *(s16 *)vs2; break;
+        default: *result = *(s32 *)vs2; break; // low 32 bits for SEW 64
+        }
+        return 1;
+    case INSN_VMV_S_X:
+        if (vl)
+            broadcast(sew, vd, rs1_val, 1);
+        return 0;
+
+    case INSN_VREDSUM:
+    case INSN_VREDAND:
+    case INSN_VREDOR:
+    case INSN_VREDXOR:
+    case INSN_VREDMINU:
+    case INSN_VREDMIN:
+    case INSN_VREDMAXU:
+    case INSN_VREDMAX:
+    {
+        if (!group_ok(insn->rs2, bytes))
+            return VECTOR_ILLEGAL;
+        if (!vl)
+            return 0;
+        const uint8_t *src = vs2;
+        if (mask)
+        {
+            uint64_t id_val = identity(id, sew);
+            memcpy(res, vs2, bytes);
+            for (unsigned int i = 0; i < vl; ++i)
+                if (!mask_bit(mask, i))
+                    memcpy(res + i * sew, &id_val, sew);
+            src = res;
+        }
+        switch (sew)
+        {
+        case 1: *(u8 *)vd = reduce_8(id, *(u8 *)vs1, (const u8 *)src, vl); break;
+        case 2: *(u16 *)vd = reduce_16(id, *(u16 *)vs1, (const u16 *)src, vl); break;
+        case 4: *(u32 *)vd = reduce_32(id, *(u32 *)vs1, (const u32 *)src, vl); break;
+        case 8: *(u64 *)vd = reduce_64(id, *(u64 *)vs1, (const u64 *)src, vl); break;
+        }
+        return 0;
+    }
+    }
+
+    // element-wise operations, the second operand is vs1, rs1 or an immediate
+    if (!group_ok(insn->rd, bytes) || !group_ok(insn->rs2, bytes))
+        return VECTOR_ILLEGAL;
+    if ((insn->vflags & VF_FORM) == VF_VV)
+    {
+        if (!group_ok(insn->rs1, bytes))
+            return VECTOR_ILLEGAL;
+    }
+    else
+    {
+        broadcast(sew, scalar, (insn->vflags & VF_FORM) == VF_VX ? rs1_val : insn->imm, vl);
+        vs1 = scalar;
+    }
+
+    if (id >= INSN_VMSEQ && id <= INSN_VMSGT)
+    {
+        // result is a mask register, one bit per element
+        switch (sew)
+        {
+        case 1: compare_8(id, res, (const u8 *)vs2, (const u8 *)vs1, vl); break;
+        case 2: compare_16(id, res, (const u16 *)vs2, (const u16 *)vs1, vl); break;
+        case 4: compare_32(id, res, (const u32 *)vs2, (const u32 *)vs1, vl); break;
+        case 8: compare_64(id, res, (const u64 *)vs2, (const u64 *)vs1, vl); break;
+        }
+        for (unsigned int i = 0; i < vl; ++i)
+            if (!mask || mask_bit(mask, i))
+                vd[i >> 3] = (vd[i >> 3] & ~(1 << (i & 7))) | res[i] << (i & 7);
+        return 0;
+    }
+
+    if (id == INSN_VMERGE && mask)
+    {
+        // vmerge picks vs1/rs1/imm where v0 is set and vs2 elsewhere
+        for (unsigned int i = 0; i < vl; ++i)
+            memcpy(res + i * sew, (mask_bit(mask, i) ? vs1 : vs2) + i * sew, sew);
+        memcpy(vd, res, bytes);
+        return 0;
+    }
+
+    switch (sew)
+    {
+    case 1: arith_8(id, (u8 *)res, (const u8 *)vs2, (const u8 *)vs1, vl); break;
+    case 2: arith_16(id, (u16 *)res, (const u16 *)vs2, (const u16 *)vs1, vl); break;
+    case 4: arith_32(id, (u32 *)res, (const u32 *)vs2, (const u32 *)vs1, vl); break;
+    case 8: arith_64(id, (u64 *)res, (const u64 *)vs2, (const u64 *)vs1, vl); break;
+    }
+    if (!mask)
+        memcpy(vd, res, bytes);
+    else
+        for (unsigned int i = 0; i < vl; ++i)
+            if (mask_bit(mask, i))
+                memcpy(vd + i * sew, res + i * sew, sew);
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef __VECTOR_H__
+#define __VECTOR_H__
+
+#include "decode.h"
+#include "memory.h"
+#include <stdint.h>
+
+// Vector register length in bits, set with make VLEN=...
+#ifndef VLEN
+#define VLEN 128
+#endif
+#define VLENB (VLEN / 8)
+
+// V extension state, integer subset. The registers are laid out back to back
+// so a register group with LMUL > 1 is one contiguous array of elements.
+struct vector_unit
+{
+    uint8_t regs[32 * VLENB] __attribute__((aligned(32)));
+    unsigned int vl;
+    unsigned int vtype; // bit 31 is vill
+    unsigned int sew;   // element width in bytes from vtype, 0 when vill is set
+    unsigned int vlmax;
+    int fault_cause; // of the last VECTOR_FAULT
+    unsigned int fault_addr;
+};
+
+void vector_init(struct vector_unit *v);
+
+// returned by vector_execute for an instruction that is illegal with the
+// current vtype, like any but vset{i}vl{i} when vill is set, or whose
+// register groups don't fit in the register file
+#define VECTOR_ILLEGAL -1
+// returned when a vector load or store faults, before any element is
+// accessed. The exception is in fault_cause and fault_addr
+#define VECTOR_FAULT -2
+
+// execute a CLASS_VECTOR instruction. Returns 1 if it produced a value for
+// integer register rd in *result, 0 if not, VECTOR_ILLEGAL or VECTOR_FAULT.
+int vector_execute(struct vector_unit *v, struct memory *mem, struct insn *insn, int rs1_val, int rs2_val,
+                   int *result);
+
+#endif